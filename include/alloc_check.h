@@ -0,0 +1,9 @@
+#ifndef ECHO_SERVER_ALLOC_CHECK_H
+#define ECHO_SERVER_ALLOC_CHECK_H
+
+#include <cinttypes>
+
+// runs the custom_thread_pool engine in process and fails if its warmed up echo path allocates
+int alloc_check_main(uint16_t port);
+
+#endif //ECHO_SERVER_ALLOC_CHECK_H
@@ -0,0 +1,28 @@
+//
+// Thread placement: the pinned threads of a server take the CPUs of --cpu_set in turn,
+// interleaved over the NUMA nodes, so consecutive threads land on different nodes.
+// A thread allocates its tables after it is pinned; the default local allocation policy
+// of the kernel then places them on the node of its CPU.
+//
+
+#ifndef ECHO_SERVER_SIMPLE_AFFINITY_H
+#define ECHO_SERVER_SIMPLE_AFFINITY_H
+
+#include <cstddef>
+
+#define AFFINITY_NODE_DIR               ("/sys/devices/system/node")
+
+
+// reads the NUMA topology and the CPUs of --cpu_set; logs the placement order
+int affinity_init();
+
+// CPU of the thread with this index; -1 if pinning is disabled
+int affinity_get_cpu(size_t thread_index);
+
+// NUMA node of the CPU; 0 if the topology is not known
+int affinity_get_node(int cpu);
+
+// pins the calling thread to affinity_get_cpu(thread_index); a no-op if pinning is disabled
+int affinity_pin_thread(size_t thread_index);
+
+#endif //ECHO_SERVER_SIMPLE_AFFINITY_H
@@ -0,0 +1,150 @@
+//
+// Connection state of the callback-based asio engines: the socket, the echo buffer and the memory
+// of the asio handlers in one object recycled through per-thread free lists.
+// An echo session has exactly one operation in flight, so its handler owns it (asio_session_ptr)
+// and a single arena slot serves every handler of the session: a steady-state echo does not allocate.
+//
+
+#ifndef ECHO_SERVER_SIMPLE_ASIO_SESSION_H
+#define ECHO_SERVER_SIMPLE_ASIO_SESSION_H
+
+#include <boost/asio/ip/tcp.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <type_traits>
+
+#include "common/asio_timeouts.h"
+
+// fits the read and the composed write operation of an echo session
+#define ASIO_HANDLER_MEMORY_SIZE        (512)
+// sessions above this number are freed instead of cached by a thread
+#define ASIO_SESSION_THREAD_CACHE_SIZE  (1024)
+
+
+// one handler at a time; a bigger or a second concurrent handler goes to the heap
+class asio_handler_memory {
+    alignas(std::max_align_t) unsigned char storage[ASIO_HANDLER_MEMORY_SIZE];
+    bool in_use = false;
+
+public:
+    asio_handler_memory() = default;
+
+    asio_handler_memory(const asio_handler_memory &m) = delete;
+
+    asio_handler_memory &operator=(const asio_handler_memory &m) = delete;
+
+    void *allocate(size_t size);
+
+    void deallocate(void *pointer);
+};
+
+// returned by the associated allocator hook of asio_alloc_handler
+template<typename T>
+class asio_handler_allocator {
+    template<typename> friend
+    class asio_handler_allocator;
+
+    asio_handler_memory &memory;
+
+public:
+    using value_type = T;
+
+    explicit asio_handler_allocator(asio_handler_memory &memory) noexcept: memory(memory) {}
+
+    template<typename U>
+    asio_handler_allocator(const asio_handler_allocator<U> &other) noexcept : memory(other.memory) {}
+
+    T *allocate(size_t n) {
+        return static_cast<T *>(memory.allocate(sizeof(T) * n));
+    }
+
+    void deallocate(T *pointer, size_t) {
+        memory.deallocate(pointer);
+    }
+
+    template<typename U>
+    bool operator==(const asio_handler_allocator<U> &other) const noexcept {
+        return &memory == &other.memory;
+    }
+
+    template<typename U>
+    bool operator!=(const asio_handler_allocator<U> &other) const noexcept {
+        return &memory != &other.memory;
+    }
+};
+
+template<typename Handler>
+class asio_alloc_handler {
+    asio_handler_memory &memory;
+    Handler handler;
+
+public:
+    using allocator_type = asio_handler_allocator<Handler>;
+
+    asio_alloc_handler(asio_handler_memory &memory, Handler handler) : memory(memory), handler(std::move(handler)) {}
+
+    allocator_type get_allocator() const noexcept {
+        return allocator_type{memory};
+    }
+
+    template<typename ...Args>
+    void operator()(Args &&...args) {
+        handler(std::forward<Args>(args)...);
+    }
+};
+
+// wraps the handler of an operation, so asio takes its memory from the arena
+template<typename Handler>
+asio_alloc_handler<std::decay_t<Handler>> make_alloc_handler(asio_handler_memory &memory, Handler &&handler) {
+    return asio_alloc_handler<std::decay_t<Handler>>{memory, std::forward<Handler>(handler)};
+}
+
+
+struct asio_session;
+
+struct asio_session_deleter {
+    void operator()(asio_session *session) const;
+};
+
+// the owner of a session: the handler of its operation in flight
+using asio_session_ptr = std::unique_ptr<asio_session, asio_session_deleter>;
+
+struct asio_session {
+    // empty while the session is cached
+    std::optional<boost::asio::ip::tcp::socket> socket{};
+    std::unique_ptr<char[]> buffer{};
+    size_t capacity = 0;
+    // 0 if the first read is done
+    uint64_t accept_time_ns = 0;
+    // decremented when the session is released; nullptr if the connections are not counted
+    std::atomic<size_t> *connection_count = nullptr;
+    // watched by the engine after acquire; unwatched when the session is released
+    asio_deadline deadline{};
+    asio_handler_memory handler_memory{};
+    // link of the thread free list
+    asio_session *next = nullptr;
+
+    // takes a session from the current thread free list; allocates only if the list is empty
+    static asio_session_ptr acquire(boost::asio::ip::tcp::socket socket, uint64_t accept_time_ns);
+
+    // doubles the buffer up to --stream_buffer_max_size; the content is not kept
+    void grow_buffer();
+
+private:
+    friend struct asio_session_deleter;
+
+    // closes the socket and caches the session in the current thread free list
+    void release();
+};
+
+// sessions allocated from the heap since the start; flat once the connection number is steady
+size_t asio_session_get_alloc_count();
+
+// handlers which did not fit a session arena; flat in a steady state
+size_t asio_handler_get_alloc_count();
+
+#endif //ECHO_SERVER_SIMPLE_ASIO_SESSION_H
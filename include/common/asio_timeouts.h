@@ -0,0 +1,91 @@
+//
+// Idle and write deadlines of the asio connections. The completion handlers have no event loop to
+// check a timing wheel after each batch, so every io_context gets one wheel swept by a steady_timer.
+// A handler refreshes the deadline of its connection with a plain atomic store; the wheel lock is
+// taken only when a connection is watched or unwatched and by the sweep, which files a refreshed
+// deadline again and shuts down the sockets past theirs, so their pending operation fails.
+//
+
+#ifndef ECHO_SERVER_SIMPLE_ASIO_TIMEOUTS_H
+#define ECHO_SERVER_SIMPLE_ASIO_TIMEOUTS_H
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <optional>
+
+#include "common/timing_wheel.h"
+
+// the sweep period: the precision of the asio timeouts
+#define ASIO_TIMEOUT_SWEEP_MS           (100)
+
+
+class asio_timeouts;
+
+// the deadline of one connection; unwatched before its socket is closed, so the sweep never shuts down a reused fd
+class asio_deadline {
+    friend class asio_timeouts;
+
+    std::atomic<uint64_t> deadline_ms = TIMER_DEADLINE_NEVER;
+    // guarded by the mutex of the timeouts
+    timer_id timer = TIMER_ID_NONE;
+    int fd = -1;
+    asio_timeouts *timeouts = nullptr;
+
+public:
+    asio_deadline() = default;
+
+    asio_deadline(const asio_deadline &d) = delete;
+
+    asio_deadline &operator=(const asio_deadline &d) = delete;
+
+    ~asio_deadline() {
+        unwatch();
+    }
+
+    // no-op if the timeouts are disabled
+    void watch(asio_timeouts &owner, int socket_fd);
+
+    void unwatch();
+
+    // lock free; write_pending selects --write_timeout_ms over --idle_timeout_ms
+    void refresh(bool write_pending) {
+        if (nullptr != timeouts) {
+            deadline_ms.store(connection_deadline_ms(timing_wheel_now_ms(), write_pending), std::memory_order_relaxed);
+        }
+    }
+};
+
+class asio_timeouts {
+    friend class asio_deadline;
+
+    std::mutex mutex{};
+    // the owner of a timer is its asio_deadline
+    timing_wheel wheel{};
+    std::optional<boost::asio::steady_timer> sweep_timer{};
+
+    void arm_sweep();
+
+    void sweep();
+
+public:
+    asio_timeouts() = default;
+
+    asio_timeouts(const asio_timeouts &t) = delete;
+
+    asio_timeouts &operator=(const asio_timeouts &t) = delete;
+
+    // starts the sweep on the io_context if --idle_timeout_ms or --write_timeout_ms is set
+    void start(boost::asio::io_context &io_context);
+
+    // call before the io_context is destroyed; the watched deadlines may still be unwatched after it
+    void stop();
+};
+
+// connections shut down by every asio_timeouts since the start
+size_t asio_timeouts_get_reap_count();
+
+#endif //ECHO_SERVER_SIMPLE_ASIO_TIMEOUTS_H
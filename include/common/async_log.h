@@ -0,0 +1,139 @@
+//
+// Asynchronous logging of the data paths: ALOG/APLOG format a record straight into a slot of the
+// per-thread lock-free ring (one producer - the thread, one consumer - the flush thread) and return.
+// A record takes strings, characters, integers and peer addresses; no iostream is involved.
+// The flush thread writes the records to glog every --async_log_flush_ms, so glog stays the sink.
+// Once a flush finds the rings empty the thread sleeps until the next record wakes it.
+// A full ring drops the record and counts the drop. A ring is --async_log_ring_size slots, touched as they are
+// used; the rings of all threads take at most --async_log_memory_size, the threads beyond it log synchronously.
+// The glog time of a record is the time of its flush.
+// Before async_log_init, after async_log_deinit and with --async_log=false the records go to glog synchronously.
+//
+
+#ifndef ECHO_SERVER_SIMPLE_ASYNC_LOG_H
+#define ECHO_SERVER_SIMPLE_ASYNC_LOG_H
+
+#include <glog/logging.h>
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// a longer message is truncated
+#define ASYNC_LOG_RECORD_TEXT_SIZE      (232)
+#define ASYNC_LOG_RING_SIZE             (128)
+#define ASYNC_LOG_MEMORY_SIZE           (16 * 1024 * 1024)
+#define ASYNC_LOG_FLUSH_PERIOD_MS       (10)
+// the longest sleep of the idle flush thread; bounds the delay of a record racing with the sleep
+#define ASYNC_LOG_IDLE_FLUSH_PERIOD_MS  (1000)
+
+// the same use as LOG(severity): ALOG(WARNING) << "Error failed to read from " << name;
+// a FATAL record goes to glog synchronously, so the process aborts at the call site
+#define ALOG(severity) \
+    (google::GLOG_ ## severity < FLAGS_minloglevel) ? (void) 0 : \
+    async_log_voidify() & async_log_record(__FILE__, __LINE__, google::GLOG_ ## severity, -1).stream()
+
+// the same use as PLOG(severity): appends the errno description
+#define APLOG(severity) \
+    (google::GLOG_ ## severity < FLAGS_minloglevel) ? (void) 0 : \
+    async_log_voidify() & async_log_record(__FILE__, __LINE__, google::GLOG_ ## severity, errno).stream()
+
+
+// the ring of the records of a thread
+struct async_log_thread;
+
+struct async_log_slot;
+
+struct peer_addr;
+
+// a message in progress: the operators write into a ring slot, the destructor publishes it.
+// A synchronous record is formatted into a thread slot and written to glog by the destructor
+class async_log_record {
+    // nullptr if the record goes to glog synchronously
+    async_log_thread *thread;
+    // nullptr if the ring is full and the record is dropped
+    async_log_slot *slot;
+    // the free text of the slot; a longer message is cut, a dropped record has no text
+    char *pos;
+    char *end;
+
+    void append(const char *s, size_t size) {
+        size = std::min<size_t>(size, end - pos);
+        if (size > 0) {
+            memcpy(pos, s, size);
+            pos += size;
+        }
+    }
+
+public:
+    async_log_record(const char *file, int line, google::LogSeverity severity, int saved_errno);
+
+    ~async_log_record();
+
+    async_log_record(const async_log_record &r) = delete;
+
+    async_log_record &operator=(const async_log_record &r) = delete;
+
+    async_log_record &stream() {
+        return *this;
+    }
+
+    async_log_record &operator<<(std::string_view s) {
+        append(s.data(), s.size());
+        return *this;
+    }
+
+    async_log_record &operator<<(const char *s) {
+        return *this << std::string_view{s};
+    }
+
+    async_log_record &operator<<(const std::string &s) {
+        return *this << std::string_view{s};
+    }
+
+    async_log_record &operator<<(char c) {
+        if (pos < end) {
+            *pos++ = c;
+        }
+        return *this;
+    }
+
+    // 1 or 0, as glog prints it
+    async_log_record &operator<<(bool value) {
+        return *this << (value ? '1' : '0');
+    }
+
+    template<typename T> requires std::is_integral_v<T>
+    async_log_record &operator<<(T value) {
+        auto res = std::to_chars(pos, end, value);
+        // a number which does not fit is cut whole
+        pos = std::errc{} == res.ec ? res.ptr : end;
+        return *this;
+    }
+
+    async_log_record &operator<<(const peer_addr &peer);
+};
+
+// gives the ?: of ALOG the void type of both branches
+struct async_log_voidify {
+    void operator&(async_log_record &) {}
+};
+
+// starts the flush thread; call after the flags are parsed
+void async_log_init();
+
+// stops the flush thread and writes the queued records
+void async_log_deinit();
+
+// writes the queued records now, from the calling thread
+void async_log_flush();
+
+// records dropped on full rings since the start
+size_t async_log_get_drop_count();
+
+#endif //ECHO_SERVER_SIMPLE_ASYNC_LOG_H
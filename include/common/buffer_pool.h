@@ -0,0 +1,68 @@
+//
+// Fixed-size message buffers recycled through per-thread free lists.
+// A buffer may be released on another thread than the one that acquired it.
+// The size is set by --message_size, which must not change once a buffer is acquired.
+//
+
+#ifndef ECHO_SERVER_SIMPLE_BUFFER_POOL_H
+#define ECHO_SERVER_SIMPLE_BUFFER_POOL_H
+
+#include <cstddef>
+#include <sys/types.h>
+
+#include "common/defines.h"
+
+// buffers above this number go from a thread free list to the shared one
+#define BUFFER_POOL_THREAD_CACHE_SIZE   (1024)
+
+
+class pooled_buffer {
+public:
+    // capacity() bytes of data follow the header
+    struct block {
+        block *next;
+        ssize_t size;
+    };
+
+private:
+    block *ptr = nullptr;
+
+    explicit pooled_buffer(block *ptr) : ptr(ptr) {}
+
+public:
+    pooled_buffer() = default;
+
+    ~pooled_buffer();
+
+    pooled_buffer(const pooled_buffer &b) = delete;
+
+    const pooled_buffer &operator=(const pooled_buffer &b) = delete;
+
+    pooled_buffer(pooled_buffer &&b) noexcept;
+
+    pooled_buffer &operator=(pooled_buffer &&b) noexcept;
+
+    // takes a buffer from the current thread free list; allocates only if all free lists are empty
+    static pooled_buffer acquire();
+
+    // returns the buffer to the current thread free list
+    void release();
+
+    [[nodiscard]] bool is_valid() const;
+
+    [[nodiscard]] char *data();
+
+    [[nodiscard]] const char *data() const;
+
+    [[nodiscard]] ssize_t size() const;
+
+    void set_size(ssize_t size);
+
+    // one extra byte for the terminating '\0' written by read_buffer
+    [[nodiscard]] static ssize_t capacity();
+};
+
+// number of buffers allocated from the heap since the start; flat in a steady state
+size_t buffer_pool_get_alloc_count();
+
+#endif //ECHO_SERVER_SIMPLE_BUFFER_POOL_H
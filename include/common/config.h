@@ -0,0 +1,56 @@
+//
+// Runtime configuration: every performance knob of the servers is a command line flag.
+// The defaults come from defines.h and the flags are validated while they are parsed.
+//
+
+#ifndef ECHO_SERVER_SIMPLE_CONFIG_H
+#define ECHO_SERVER_SIMPLE_CONFIG_H
+
+#include <gflags/gflags.h>
+
+DECLARE_uint32(port);
+// resolved to the number of available CPUs by config_init if 0
+DECLARE_uint32(threads);
+DECLARE_uint32(message_size);
+DECLARE_uint32(stream_buffer_max_size);
+DECLARE_bool(splice_echo);
+DECLARE_uint32(splice_threshold);
+DECLARE_uint32(splice_pipe_size);
+DECLARE_int32(listen_backlog);
+DECLARE_uint32(expect_connections);
+DECLARE_uint32(accept_batch);
+DECLARE_uint32(admission_fd_reserve);
+// ADMISSION_SHED or ADMISSION_DEFER
+DECLARE_string(admission_policy);
+// SOCKET_PROFILE_NONE, SOCKET_PROFILE_LOW_LATENCY, SOCKET_PROFILE_THROUGHPUT or SOCKET_PROFILE_MEMORY_LEAN
+DECLARE_string(socket_profile);
+DECLARE_uint32(blocking_pool_size);
+DECLARE_uint32(blocking_pool_prespawn);
+DECLARE_uint32(thread_stack_size);
+DECLARE_uint32(idle_timeout_ms);
+DECLARE_uint32(write_timeout_ms);
+DECLARE_uint32(work_queue_size);
+DECLARE_uint32(epoll_max_events);
+DECLARE_uint32(uring_queue_depth);
+DECLARE_uint32(uring_buf_ring_entries);
+DECLARE_uint32(stage_stats_dump_period_s);
+DECLARE_bool(pin_threads);
+DECLARE_string(cpu_set);
+DECLARE_bool(incoming_cpu);
+DECLARE_bool(asio_context_per_thread);
+// ASIO_DISPATCH_ROUND_ROBIN or ASIO_DISPATCH_LEAST_LOADED
+DECLARE_string(asio_dispatch);
+
+DECLARE_uint32(udp_batch_size);
+DECLARE_bool(udp_gro);
+DECLARE_bool(udp_reuseport);
+DECLARE_bool(async_log);
+DECLARE_uint32(async_log_ring_size);
+DECLARE_uint32(async_log_memory_size);
+DECLARE_uint32(async_log_flush_ms);
+
+// call after the flags are parsed: resolves the automatic values, checks the flag combinations
+// and logs the effective configuration
+int config_init();
+
+#endif //ECHO_SERVER_SIMPLE_CONFIG_H
@@ -0,0 +1,37 @@
+//
+// Compact per-connection data shared by the engines: the peer address is kept raw and formatted
+// only when a log line prints it, so accepting a connection does not build a name string.
+//
+
+#ifndef ECHO_SERVER_SIMPLE_CONNECTION_H
+#define ECHO_SERVER_SIMPLE_CONNECTION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <netinet/in.h>
+
+
+// the IPv4 peer of a connection, in network byte order
+struct peer_addr {
+    uint32_t ip = 0;
+    uint16_t port = 0;
+};
+
+peer_addr peer_addr_from(const struct sockaddr_in &addr);
+
+// the peer of a connected socket; zero if the socket is closed
+peer_addr socket_get_peer(int fd);
+
+// writes "ip:port" without the terminating '\0', at most PEER_ADDR_MAX_STR_SIZE chars; returns the end
+char *peer_addr_format(const peer_addr &peer, char *buffer);
+
+// formats into the stream only when it is written, e.g. when the log severity is enabled
+std::ostream &operator<<(std::ostream &stream, const peer_addr &peer);
+
+// Logs the user memory an idle connection holds: its record in the engine tables, its timer node if
+// it is timed and the buffers it keeps between echoes; and the total for 1M idle connections.
+// The kernel socket memory comes on top
+void log_connection_footprint(size_t record_size, size_t buffer_size, bool timed);
+
+#endif //ECHO_SERVER_SIMPLE_CONNECTION_H
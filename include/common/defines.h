@@ -5,17 +5,69 @@
 #ifndef ECHO_SERVER_SIMPLE_DEFINES_H
 #define ECHO_SERVER_SIMPLE_DEFINES_H
 
-#define IP_MAX_STR_SIZE                 (16)
+// "255.255.255.255:65535"
+#define PEER_ADDR_MAX_STR_SIZE          (21)
 
+// Defaults of the runtime flags, see common/config.h
 #define ECHO_SERVER_PORT                (4025)
 
 #define EXPECTED_MESSAGE_SIZE           (128)
+// streaming echo buffers grow from EXPECTED_MESSAGE_SIZE up to this size
+#define STREAM_BUFFER_MAX_SIZE          (256 * 1024)
+// capacity requested for the splice() echo pipes; the kernel default is 64 KiB
+#define SPLICE_PIPE_SIZE                (1024 * 1024)
+// below this the two splice() calls and the pipe cost more than copying through the buffer
+#define SPLICE_THRESHOLD                (64 * 1024)
 #define SERVER_LISTEN_BACKLOG_SIZE      (10000)
 #define SERVER_EXPECT_CONNECTIONS       (11000)
+// a client owns at most one queued job, so the ring is never full below this clients number
+#define WORK_QUEUE_SIZE                 (1 << 16)
+#define EPOLL_MAX_EVENTS                (1024)
+#define URING_QUEUE_DEPTH               (4096)
+#define URING_BUF_RING_ENTRIES          (4096)
+// datagrams taken by one recvmmsg call of the udp engine
+#define UDP_BATCH_SIZE                  (32)
+// fits the largest datagram and a GRO-coalesced one
+#define UDP_DATAGRAM_BUFFER_SIZE        (65536)
+// connections accepted per listener wakeup, so a reconnect storm does not starve the connected clients
+#define ACCEPT_BATCH_SIZE               (64)
+// retry period of a listener out of fds, for the fds freed by another thread or process
+#define ACCEPT_RETRY_MS                 (100)
+// fds kept free below the open files limit by the admission control
+#define ADMISSION_FD_RESERVE            (64)
+#define ADMISSION_SHED                  ("shed")
+#define ADMISSION_DEFER                 ("defer")
+// socket options of the listeners and the accepted connections, see socket_tune_listener
+#define SOCKET_PROFILE_NONE             ("none")
+#define SOCKET_PROFILE_LOW_LATENCY      ("low_latency")
+#define SOCKET_PROFILE_THROUGHPUT       ("throughput")
+#define SOCKET_PROFILE_MEMORY_LEAN      ("memory_lean")
+// low_latency: busy polling of a blocking read and the unsent bytes kept in the socket
+#define SOCKET_BUSY_POLL_US             (50)
+#define SOCKET_NOTSENT_LOWAT            (16 * 1024)
+// SO_RCVBUF and SO_SNDBUF of the throughput and memory_lean profiles; the kernel doubles them
+#define SOCKET_THROUGHPUT_BUFFER_SIZE   (4 * 1024 * 1024)
+#define SOCKET_LEAN_BUFFER_SIZE         (16 * 1024)
+// handler threads of simple_threaded: the most, the ones started with the server, and their stack
+#define BLOCKING_POOL_SIZE              (16384)
+#define BLOCKING_POOL_PRESPAWN          (64)
+// a handler keeps its buffers on the heap; the glibc default reserves 8 MiB per thread
+#define THREAD_STACK_SIZE               (128 * 1024)
+// the validator also takes PTHREAD_STACK_MIN of the target, e.g. 128 KiB on aarch64
+#define THREAD_STACK_SIZE_MIN           (16 * 1024)
+
+#define IDLE_TIMEOUT_MS                 (60 * 1000)
+#define WRITE_TIMEOUT_MS                (10 * 1000)
+#define ASIO_DISPATCH_ROUND_ROBIN       ("round_robin")
+#define ASIO_DISPATCH_LEAST_LOADED      ("least_loaded")
+
+#define CACHE_LINE_SIZE                 (64)
 
 #define SERVER_DEFAULT_LOG_DIR          ("./logs")
 
 #define STATUS_SUCCESS                  (0)
 #define STATUS_FAIL                     (-1)
+#define STATUS_AGAIN                    (1)
+#define STATUS_EOF                      (2)
 
 #endif //ECHO_SERVER_SIMPLE_DEFINES_H
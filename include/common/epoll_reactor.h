@@ -0,0 +1,94 @@
+//
+// Edge-triggered epoll event loop of the epoll and thread_per_core engines: a listener, its connections
+// and their deadlines. Not thread-safe: thread_per_core runs one reactor per thread, each with its own
+// SO_REUSEPORT listener, and the reactors share only the counters.
+//
+
+#ifndef ECHO_SERVER_SIMPLE_EPOLL_REACTOR_H
+#define ECHO_SERVER_SIMPLE_EPOLL_REACTOR_H
+
+#include <sys/epoll.h>
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <vector>
+
+#include "common/io.h"
+#include "common/timing_wheel.h"
+#include "common/connection.h"
+#include "common/slot_map.h"
+
+
+// counters of all reactors of an engine
+struct epoll_reactor_stats {
+    std::atomic<size_t> accept_count = 0;
+    // connections reset by the admission control near the fd limit
+    std::atomic<size_t> shed_count = 0;
+    // listener pauses for lack of fds
+    std::atomic<size_t> defer_count = 0;
+    std::atomic<size_t> reap_count = 0;
+};
+
+class epoll_reactor {
+    struct client_data {
+        // reading is paused while it holds data the socket did not accept
+        stream_buffer stream{};
+        // 0 after the first read
+        uint64_t accept_time_ns = 0;
+        peer_addr peer{};
+        timer_id timer = TIMER_ID_NONE;
+        int fd = -1;
+    };
+
+    epoll_reactor_stats &stats;
+    int server_fd = -1;
+    int epoll_fd = -1;
+    std::vector<epoll_event> events{};
+    // dense over the connections of this reactor; the epoll data of a client is its packed slot key
+    slot_map<client_data> client_db{};
+    // idle and write deadlines of the clients; the owner of a timer is the client slot index
+    timing_wheel timers{};
+    // read once per epoll_wait batch
+    uint64_t now_ms = 0;
+    // out of fds: the listener is re-armed once a client closes, at the latest at accept_retry_ms
+    bool accept_deferred = false;
+    uint64_t accept_retry_ms = 0;
+
+    // epoll_wait timeout: until the next deadline
+    int get_wait_timeout();
+
+    // accepts up to --accept_batch pending connections
+    int connect_clients(const std::atomic_bool &running_flag);
+
+    // reports the pending backlog of the edge-triggered listener in the next epoll_wait
+    int rearm_listener();
+
+    void close_client(slot_key key);
+
+    void handle_client(slot_key key, uint32_t client_events);
+
+    // closes the clients whose deadline passed
+    void reap_clients();
+
+public:
+    explicit epoll_reactor(epoll_reactor_stats &stats) : stats(stats) {}
+
+    epoll_reactor(const epoll_reactor &r) = delete;
+
+    epoll_reactor &operator=(const epoll_reactor &r) = delete;
+
+    // closes the connections and the epoll fd; the listener belongs to the engine
+    ~epoll_reactor();
+
+    // listener_fd must be non-blocking; the table is reserved for expect_connections
+    int init(int listener_fd, size_t expect_connections);
+
+    // Runs the loop until running_flag is cleared or the listener is shut down.
+    // Returns STATUS_FAIL on an error while running_flag is set
+    int run(const std::atomic_bool &running_flag);
+
+    // logs the user memory of an idle connection
+    static void log_footprint();
+};
+
+#endif //ECHO_SERVER_SIMPLE_EPOLL_REACTOR_H
@@ -0,0 +1,60 @@
+//
+// Log-linear histogram in the HdrHistogram layout: values below HDR_HISTOGRAM_SUB_BUCKET_COUNT
+// are exact, bigger ones keep HDR_HISTOGRAM_SUB_BUCKET_BITS significant bits (under 1% error).
+// Recording is O(1) and does not allocate; it is not thread safe, so every thread records
+// into its own histogram and they are merged for a report.
+//
+
+#ifndef ECHO_SERVER_SIMPLE_HDR_HISTOGRAM_H
+#define ECHO_SERVER_SIMPLE_HDR_HISTOGRAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define HDR_HISTOGRAM_SUB_BUCKET_BITS   (8)
+#define HDR_HISTOGRAM_SUB_BUCKET_COUNT  (1 << HDR_HISTOGRAM_SUB_BUCKET_BITS)
+// every power of two above the exact range is split into this many buckets
+#define HDR_HISTOGRAM_HALF_COUNT        (HDR_HISTOGRAM_SUB_BUCKET_COUNT / 2)
+#define HDR_HISTOGRAM_BUCKET_COUNT      ((64 - HDR_HISTOGRAM_SUB_BUCKET_BITS + 2) * HDR_HISTOGRAM_HALF_COUNT)
+
+
+class hdr_histogram {
+private:
+    std::vector<uint64_t> counts;
+    uint64_t total_count = 0;
+    uint64_t min_value = UINT64_MAX;
+    uint64_t max_value = 0;
+    double sum = 0;
+
+public:
+    hdr_histogram();
+
+    // bucket layout, for owners which keep their own (e.g. atomic) counters
+    static size_t get_bucket_index(uint64_t value);
+
+    // highest value which is counted in the bucket
+    static uint64_t get_bucket_value(size_t index);
+
+    void record(uint64_t value);
+
+    void record(uint64_t value, uint64_t count);
+
+    void merge(const hdr_histogram &h);
+
+    void reset();
+
+    // value which percent (0, 100] of the records do not exceed; 0 if empty
+    [[nodiscard]] uint64_t get_percentile(double percent) const;
+
+    [[nodiscard]] uint64_t get_count() const;
+
+    // 0 if empty
+    [[nodiscard]] uint64_t get_min() const;
+
+    [[nodiscard]] uint64_t get_max() const;
+
+    [[nodiscard]] double get_mean() const;
+};
+
+#endif //ECHO_SERVER_SIMPLE_HDR_HISTOGRAM_H
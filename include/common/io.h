@@ -8,15 +8,62 @@
 #include <string>
 #include <sys/socket.h>
 #include <cstddef>
+#include <cstdint>
+#include <memory>
 
-std::string get_socket_addr_str(const struct sockaddr_in *cl_addr, socklen_t cl_addr_len);
+#include "common/buffer_pool.h"
+
+// per-connection buffer of the streaming echo; allocated on the first read.
+// The sizes are bounded by --stream_buffer_max_size, so they fit 32 bits
+struct stream_buffer {
+    std::unique_ptr<char[]> data{};
+    uint32_t capacity = 0;
+    // not yet echoed bytes are [begin, end)
+    uint32_t begin = 0;
+    uint32_t end = 0;
+    uint32_t last_read = 0;
+};
+
+// per-connection pipe of the splice() echo; created on the first bulk message
+struct splice_pipe {
+    int read_fd = -1;
+    int write_fd = -1;
+};
 
 ssize_t write_buffer(int fd, const char *buffer, ssize_t size);
 
 ssize_t read_buffer(int fd, char *buffer, ssize_t size);
 
+// for non-blocking sockets; returns written bytes count which is less than size if the socket would block
+ssize_t write_buffer_nonblock(int fd, const char *buffer, ssize_t size);
+
 int read_msg(int fd, std::string &s);
 
 int write_msg(int fd, const std::string &s);
 
+// reads straight into the pooled buffer; empty buffer means EOF
+int read_msg(int fd, pooled_buffer &buffer);
+
+int write_msg(int fd, const pooled_buffer &buffer);
+
+// reads once into the buffer, which grows and shrinks like the echo_stream one; empty buffer means EOF
+int read_msg(int fd, stream_buffer &buffer);
+
+int write_msg(int fd, const stream_buffer &buffer);
+
+// Echoes everything readable from a non-blocking socket: reads until EAGAIN and resumes partial writes.
+// The buffer grows up to --stream_buffer_max_size while reads fill it and shrinks back when the traffic gets small.
+// Returns STATUS_SUCCESS when drained, STATUS_AGAIN when the output is congested (wait for writability),
+// STATUS_EOF when the peer closed the connection and STATUS_FAIL on error.
+int echo_stream(int fd, stream_buffer &buffer);
+
+void stream_buffer_release(stream_buffer &buffer);
+
+// Echoes size bytes from a blocking socket back through the pipe, so they never reach user memory.
+// size should not exceed the received data, otherwise the call blocks waiting for the rest.
+// Returns STATUS_SUCCESS, STATUS_EOF when the peer closed the connection and STATUS_FAIL on error.
+int echo_splice(int fd, splice_pipe &pipe, size_t size);
+
+void splice_pipe_release(splice_pipe &pipe);
+
 #endif //ECHO_SERVER_SIMPLE_IO_H
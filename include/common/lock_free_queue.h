@@ -0,0 +1,270 @@
+//
+// Bounded MPMC ring queue with per-slot sequence numbers (D. Vyukov's design).
+// Unlike t_queue it is strictly FIFO: there are no front insertions or back pops.
+//
+
+#ifndef ECHO_SERVER_SIMPLE_LOCK_FREE_QUEUE_H
+#define ECHO_SERVER_SIMPLE_LOCK_FREE_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+#include <thread>
+
+#include "common/defines.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// number of failed attempts before a blocking call parks the thread
+#define LOCK_FREE_QUEUE_SPIN_COUNT      (256)
+
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#else
+    std::this_thread::yield();
+#endif
+}
+
+template<typename T>
+class t_queue_lock_free {
+private:
+    struct slot {
+        std::atomic<size_t> sequence;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    const size_t mask;
+    const std::unique_ptr<slot[]> buffer;
+
+    // producers and consumers work on different cache lines
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> enqueue_pos = 0;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> dequeue_pos = 0;
+
+    // event counts for parked threads; touched only when somebody waits
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> consumers_waiting = 0;
+    std::atomic<uint32_t> push_epoch = 0;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> producers_waiting = 0;
+    std::atomic<uint32_t> pop_epoch = 0;
+
+    static size_t round_up_capacity(size_t max_size);
+
+    void notify_consumers();
+
+    void notify_producers();
+
+public:
+    // max_size is rounded up to a power of two
+    explicit t_queue_lock_free(size_t max_size);
+
+    ~t_queue_lock_free();
+
+    t_queue_lock_free(const t_queue_lock_free &q) = delete;
+
+    const t_queue_lock_free &operator=(const t_queue_lock_free &q) = delete;
+
+    [[nodiscard]] bool try_emplace_back(T &&d);
+
+    [[nodiscard]] bool try_pop_front(T &d);
+
+    // waits while the queue is full: spins first and parks afterwards
+    void emplace_back(T &&d);
+
+    // same as emplace_back: a bounded ring can not grow past its capacity, so callers which must not wait
+    // keep the number of queued entries below get_max_size()
+    void emplace_back_force(T &&d);
+
+    // waits while the queue is empty: spins first and parks afterwards
+    T pop_front();
+
+    std::vector<T> pop_front_n(uint8_t n);
+
+    // approximate while other threads work on the queue
+    [[nodiscard]] size_t get_size() const;
+
+    [[nodiscard]] size_t get_max_size() const;
+};
+
+template<typename T>
+size_t t_queue_lock_free<T>::round_up_capacity(size_t max_size) {
+    size_t capacity = 2;
+    while (capacity < max_size) {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+template<typename T>
+t_queue_lock_free<T>::t_queue_lock_free(size_t max_size) : mask(round_up_capacity(max_size) - 1),
+                                                           buffer(new slot[mask + 1]) {
+    for (size_t i = 0; i <= mask; ++i) {
+        buffer[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+template<typename T>
+t_queue_lock_free<T>::~t_queue_lock_free() {
+    T d;
+    while (try_pop_front(d)) {}
+}
+
+template<typename T>
+bool t_queue_lock_free<T>::try_emplace_back(T &&d) {
+    slot *s;
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+
+    while (true) {
+        s = &buffer[pos & mask];
+        size_t seq = s->sequence.load(std::memory_order_acquire);
+        auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+        if (0 == diff) {
+            if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break; // while
+            }
+        } else if (diff < 0) {
+            // the slot still holds the value from the previous lap
+            return false;
+        } else {
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    new(s->storage) T(std::move(d));
+    s->sequence.store(pos + 1, std::memory_order_release);
+    notify_consumers();
+    return true;
+}
+
+template<typename T>
+bool t_queue_lock_free<T>::try_pop_front(T &d) {
+    slot *s;
+    size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+
+    while (true) {
+        s = &buffer[pos & mask];
+        size_t seq = s->sequence.load(std::memory_order_acquire);
+        auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+        if (0 == diff) {
+            if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break; // while
+            }
+        } else if (diff < 0) {
+            // not published yet
+            return false;
+        } else {
+            pos = dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    T *value = std::launder(reinterpret_cast<T *>(s->storage));
+    d = std::move(*value);
+    value->~T();
+    s->sequence.store(pos + mask + 1, std::memory_order_release);
+    notify_producers();
+    return true;
+}
+
+template<typename T>
+void t_queue_lock_free<T>::notify_consumers() {
+    // pairs with the increment of consumers_waiting before the last check in pop_front
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (consumers_waiting.load(std::memory_order_relaxed) > 0) {
+        push_epoch.fetch_add(1, std::memory_order_seq_cst);
+        push_epoch.notify_one();
+    }
+}
+
+template<typename T>
+void t_queue_lock_free<T>::notify_producers() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (producers_waiting.load(std::memory_order_relaxed) > 0) {
+        pop_epoch.fetch_add(1, std::memory_order_seq_cst);
+        pop_epoch.notify_one();
+    }
+}
+
+template<typename T>
+void t_queue_lock_free<T>::emplace_back(T &&d) {
+    uint32_t epoch;
+
+    for (uint32_t i = 0; i < LOCK_FREE_QUEUE_SPIN_COUNT; ++i) {
+        if (try_emplace_back(std::move(d))) {
+            return;
+        }
+        cpu_relax();
+    }
+    while (true) {
+        producers_waiting.fetch_add(1, std::memory_order_seq_cst);
+        epoch = pop_epoch.load(std::memory_order_seq_cst);
+        if (try_emplace_back(std::move(d))) {
+            producers_waiting.fetch_sub(1, std::memory_order_relaxed);
+            return;
+        }
+        pop_epoch.wait(epoch, std::memory_order_seq_cst);
+        producers_waiting.fetch_sub(1, std::memory_order_relaxed);
+        if (try_emplace_back(std::move(d))) {
+            return;
+        }
+    }
+}
+
+template<typename T>
+void t_queue_lock_free<T>::emplace_back_force(T &&d) {
+    emplace_back(std::move(d));
+}
+
+template<typename T>
+T t_queue_lock_free<T>::pop_front() {
+    T d;
+    uint32_t epoch;
+
+    for (uint32_t i = 0; i < LOCK_FREE_QUEUE_SPIN_COUNT; ++i) {
+        if (try_pop_front(d)) {
+            return d;
+        }
+        cpu_relax();
+    }
+    while (true) {
+        consumers_waiting.fetch_add(1, std::memory_order_seq_cst);
+        epoch = push_epoch.load(std::memory_order_seq_cst);
+        if (try_pop_front(d)) {
+            consumers_waiting.fetch_sub(1, std::memory_order_relaxed);
+            return d;
+        }
+        push_epoch.wait(epoch, std::memory_order_seq_cst);
+        consumers_waiting.fetch_sub(1, std::memory_order_relaxed);
+        if (try_pop_front(d)) {
+            return d;
+        }
+    }
+}
+
+template<typename T>
+std::vector<T> t_queue_lock_free<T>::pop_front_n(uint8_t n) {
+    std::vector<T> res{};
+    res.reserve(n);
+    for (uint8_t i = 0; i < n; ++i) {
+        res.emplace_back(pop_front());
+    }
+    return res;
+}
+
+template<typename T>
+size_t t_queue_lock_free<T>::get_size() const {
+    size_t tail = enqueue_pos.load(std::memory_order_relaxed);
+    size_t head = dequeue_pos.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+}
+
+template<typename T>
+size_t t_queue_lock_free<T>::get_max_size() const {
+    return mask + 1;
+}
+
+#endif //ECHO_SERVER_SIMPLE_LOCK_FREE_QUEUE_H
@@ -4,6 +4,8 @@
 #include <glog/logging.h>
 #include <string>
 
+#include "common/async_log.h"
+
 typedef int severity_t;
 
 void logging_init(int *argc, char **argv[]);
@@ -0,0 +1,161 @@
+//
+// Generational slot map: O(1) insert and erase with a free list, no compaction.
+// Slots live in fixed-size chunks, so a value never moves once a slot is created
+// and raw pointers to values stay valid while other slots are added.
+// Values are recycled, not destroyed: the owner resets a value before erasing its slot.
+//
+
+#ifndef ECHO_SERVER_SIMPLE_SLOT_MAP_H
+#define ECHO_SERVER_SIMPLE_SLOT_MAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#define SLOT_MAP_CHUNK_SIZE             (4096)
+
+
+struct slot_key {
+    uint32_t index = UINT32_MAX;
+    uint32_t generation = 0;
+};
+
+template<typename T>
+class slot_map {
+public:
+    using key = slot_key;
+
+private:
+    struct slot {
+        // odd - the slot is occupied; bumped on every insert and erase
+        uint32_t generation = 0;
+        T value{};
+    };
+
+    std::vector<std::unique_ptr<slot[]>> chunks{};
+    std::vector<uint32_t> free_slots{};
+    uint32_t slot_count = 0;
+    size_t size = 0;
+
+    slot &get_slot(uint32_t index);
+
+    const slot &get_slot(uint32_t index) const;
+
+public:
+    // memory of one element with its generation
+    static constexpr size_t slot_size = sizeof(slot);
+
+    slot_map() = default;
+
+    ~slot_map() = default;
+
+    slot_map(const slot_map &m) = delete;
+
+    const slot_map &operator=(const slot_map &m) = delete;
+
+    void reserve(size_t n);
+
+    // reuses the most recently freed slot if any
+    key insert();
+
+    // false if the key is stale
+    bool erase(key k);
+
+    // nullptr if the key is stale
+    T *get(key k);
+
+    // unchecked access by slot index
+    T &operator[](uint32_t index);
+
+    [[nodiscard]] bool is_alive(uint32_t index) const;
+
+    [[nodiscard]] key get_key(uint32_t index) const;
+
+    // slot indexes are below this number; it never decreases
+    [[nodiscard]] uint32_t get_slot_count() const;
+
+    [[nodiscard]] size_t get_size() const;
+};
+
+template<typename T>
+typename slot_map<T>::slot &slot_map<T>::get_slot(uint32_t index) {
+    return chunks[index / SLOT_MAP_CHUNK_SIZE][index % SLOT_MAP_CHUNK_SIZE];
+}
+
+template<typename T>
+const typename slot_map<T>::slot &slot_map<T>::get_slot(uint32_t index) const {
+    return chunks[index / SLOT_MAP_CHUNK_SIZE][index % SLOT_MAP_CHUNK_SIZE];
+}
+
+template<typename T>
+void slot_map<T>::reserve(size_t n) {
+    chunks.reserve((n + SLOT_MAP_CHUNK_SIZE - 1) / SLOT_MAP_CHUNK_SIZE);
+    free_slots.reserve(n);
+}
+
+template<typename T>
+typename slot_map<T>::key slot_map<T>::insert() {
+    uint32_t index;
+
+    if (!free_slots.empty()) {
+        index = free_slots.back();
+        free_slots.pop_back();
+    } else {
+        index = slot_count++;
+        if (index / SLOT_MAP_CHUNK_SIZE == chunks.size()) {
+            chunks.emplace_back(new slot[SLOT_MAP_CHUNK_SIZE]);
+        }
+    }
+    slot &s = get_slot(index);
+    s.generation++;
+    size++;
+    return key{index, s.generation};
+}
+
+template<typename T>
+bool slot_map<T>::erase(key k) {
+    if (nullptr == get(k)) {
+        return false;
+    }
+    get_slot(k.index).generation++;
+    free_slots.push_back(k.index);
+    size--;
+    return true;
+}
+
+template<typename T>
+T *slot_map<T>::get(key k) {
+    if (k.index >= slot_count) {
+        return nullptr;
+    }
+    slot &s = get_slot(k.index);
+    return s.generation == k.generation && (s.generation & 1) ? &s.value : nullptr;
+}
+
+template<typename T>
+T &slot_map<T>::operator[](uint32_t index) {
+    return get_slot(index).value;
+}
+
+template<typename T>
+bool slot_map<T>::is_alive(uint32_t index) const {
+    return index < slot_count && (get_slot(index).generation & 1);
+}
+
+template<typename T>
+typename slot_map<T>::key slot_map<T>::get_key(uint32_t index) const {
+    return key{index, get_slot(index).generation};
+}
+
+template<typename T>
+uint32_t slot_map<T>::get_slot_count() const {
+    return slot_count;
+}
+
+template<typename T>
+size_t slot_map<T>::get_size() const {
+    return size;
+}
+
+#endif //ECHO_SERVER_SIMPLE_SLOT_MAP_H
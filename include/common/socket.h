@@ -7,11 +7,49 @@
 
 #include <cinttypes>
 #include <cstddef>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 
 extern size_t g_socket_num_limit;
 
 int server_socket_init(uint16_t port);
 
+// each call creates a separate listener on the same port (SO_REUSEPORT)
+int server_socket_reuseport_init(uint16_t port);
+
+// a bound UDP socket; with reuse_port each call creates a separate socket on the same port
+int server_udp_socket_init(uint16_t port, bool reuse_port);
+
 void sock_num_set_max_limit();
 
+int socket_set_nonblocking(int fd);
+
+// number of received bytes not read yet; STATUS_FAIL on error
+ssize_t socket_get_pending_size(int fd);
+
+// accept4 of a pending connection with the SOCK_* flags, retried on EINTR and ECONNABORTED;
+// -1 with errno EAGAIN if there is none on a non-blocking listener
+int socket_accept(int server_fd, int flags, struct sockaddr_in *addr, socklen_t *addr_len);
+
+// true if the accepted fd is within --admission_fd_reserve of g_socket_num_limit: fds are allocated lowest first,
+// so every fd below it is in use and the server should stop taking connections
+bool socket_admission_near_limit(int fd);
+
+// true if the connections near the fd limit are closed at once instead of left in the listen backlog
+bool socket_admission_sheds();
+
+// closes the socket with a RST, so the client fails at once instead of waiting for an echo
+void socket_shed(int fd);
+
+// prefers this listener for connections whose packets are received on the CPU (SO_REUSEPORT group)
+int socket_set_incoming_cpu(int fd, int cpu);
+
+// Sets the TCP options of --socket_profile on a listener; call before listen(), so the buffer sizes are
+// used for the window scale. The accepted connections inherit them
+int socket_tune_listener(int fd);
+
+// SO_RCVTIMEO and SO_SNDTIMEO of a blocking socket, ms; 0 leaves the call blocking without a limit
+int socket_set_timeouts(int fd, uint32_t recv_timeout_ms, uint32_t send_timeout_ms);
+
 #endif //ECHO_SERVER_SIMPLE_SOCKET_H
@@ -0,0 +1,42 @@
+//
+// Server-side latency of the request stages, cheap enough to stay on in production.
+// A thread records into its own shard of atomic HDR counters (threads share shards only when
+// there are more of them than STAGE_STATS_MAX_SHARDS); the shards are merged on a dump.
+// A dump goes to glog on SIGUSR1 and, if --stage_stats_dump_period_s is set, to STAGE_STATS_FILE.
+//
+
+#ifndef ECHO_SERVER_SIMPLE_STAGE_STATS_H
+#define ECHO_SERVER_SIMPLE_STAGE_STATS_H
+
+#include <cstddef>
+#include <cstdint>
+
+#define STAGE_STATS_MAX_SHARDS          (64)
+#define STAGE_STATS_FILE                ("stage_stats.txt")
+
+
+enum stage_t {
+    // from the accepted connection to its first request read
+    STAGE_ACCEPT_TO_FIRST_READ,
+    // time a job waits in the thread pool queue
+    STAGE_QUEUE_SOJOURN,
+    STAGE_READ,
+    STAGE_WRITE,
+    STAGE_COUNT
+};
+
+// monotonic time in nanoseconds
+uint64_t stage_stats_now();
+
+// records the time from start_ns till now
+void stage_stats_record(stage_t stage, uint64_t start_ns);
+
+// installs the SIGUSR1 handler and starts the dump thread
+int stage_stats_init();
+
+void stage_stats_deinit();
+
+// merges the shards and writes the percentiles to glog
+void stage_stats_dump();
+
+#endif //ECHO_SERVER_SIMPLE_STAGE_STATS_H
@@ -0,0 +1,108 @@
+//
+// Hierarchical timing wheel for the connection deadlines of an event loop: TIMING_WHEEL_LEVELS levels
+// of TIMING_WHEEL_SLOTS slots, TIMING_WHEEL_TICK_MS per level 0 slot. Add, cancel and expiry are O(1)
+// and the nodes are recycled through a free list, so the connection churn does not allocate once the
+// peak is reached. A later deadline is only stored: the node moves when its old slot comes due,
+// so refreshing a deadline on every echo is a compare and a store.
+// Not thread-safe: one wheel per event loop.
+//
+
+#ifndef ECHO_SERVER_SIMPLE_TIMING_WHEEL_H
+#define ECHO_SERVER_SIMPLE_TIMING_WHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define TIMING_WHEEL_TICK_MS            (10)
+#define TIMING_WHEEL_SLOT_BITS          (6)
+#define TIMING_WHEEL_SLOTS              (1 << TIMING_WHEEL_SLOT_BITS)
+// 64^4 ticks of 10 ms cover 1.9 days; a later deadline is re-filed when the top level wraps
+#define TIMING_WHEEL_LEVELS             (4)
+#define TIMER_ID_NONE                   (UINT32_MAX)
+#define TIMER_DEADLINE_NEVER            (UINT64_MAX)
+
+using timer_id = uint32_t;
+
+
+class timing_wheel {
+    struct node {
+        uint64_t deadline_ms = 0;
+        // engine data returned on expiry, e.g. the client fd
+        uint64_t owner = 0;
+        uint32_t prev = TIMER_ID_NONE;
+        uint32_t next = TIMER_ID_NONE;
+        // list of the node: level * TIMING_WHEEL_SLOTS + slot, the expired list or none (free)
+        uint32_t list = TIMER_ID_NONE;
+    };
+
+    std::vector<node> nodes{};
+    uint32_t free_head = TIMER_ID_NONE;
+    // the wheel slots followed by the expired list
+    uint32_t heads[TIMING_WHEEL_LEVELS * TIMING_WHEEL_SLOTS + 1];
+    // bit i of a level is set if its slot i is not empty
+    uint64_t occupied[TIMING_WHEEL_LEVELS]{};
+    // the last processed tick
+    uint64_t current_tick;
+    size_t filed_count = 0;
+
+    void link(timer_id id, uint32_t list);
+
+    void unlink(timer_id id);
+
+    // files the node by its deadline, but not before min_tick
+    void file(timer_id id, uint64_t min_tick);
+
+    // the first tick with a due slot or a cascade; UINT64_MAX if the wheel is empty
+    [[nodiscard]] uint64_t next_event_tick() const;
+
+    void process_tick(uint64_t tick);
+
+public:
+    // memory of one timer
+    static constexpr size_t node_size = sizeof(node);
+
+    timing_wheel();
+
+    timing_wheel(const timing_wheel &w) = delete;
+
+    timing_wheel &operator=(const timing_wheel &w) = delete;
+
+    timer_id add(uint64_t deadline_ms, uint64_t owner);
+
+    // an earlier deadline moves the node, a later one is only stored
+    void update(timer_id id, uint64_t deadline_ms) {
+        node &n = nodes[id];
+        if (deadline_ms >= n.deadline_ms && n.list < TIMING_WHEEL_LEVELS * TIMING_WHEEL_SLOTS) {
+            n.deadline_ms = deadline_ms;
+        } else {
+            reschedule(id, deadline_ms);
+        }
+    }
+
+    void reschedule(timer_id id, uint64_t deadline_ms);
+
+    // the id is free after the call
+    void cancel(timer_id id);
+
+    // moves the nodes due by now_ms to the expired list; returns their number
+    size_t advance(uint64_t now_ms);
+
+    // takes a node of the expired list, whose id is free after the call; false if the list is empty
+    bool pop_expired(uint64_t &owner);
+
+    // for a poll/epoll timeout: ms until the next advance may expire a node; -1 if nothing is scheduled
+    [[nodiscard]] int next_timeout_ms(uint64_t now_ms) const;
+};
+
+// CLOCK_MONOTONIC_COARSE: cheap enough to read per event batch
+uint64_t timing_wheel_now_ms();
+
+// true if --idle_timeout_ms or --write_timeout_ms is set
+bool connection_timeouts_enabled();
+
+// --write_timeout_ms from now while an echo waits for the peer to read, --idle_timeout_ms otherwise;
+// TIMER_DEADLINE_NEVER if that timeout is 0
+uint64_t connection_deadline_ms(uint64_t now_ms, bool write_pending);
+
+#endif //ECHO_SERVER_SIMPLE_TIMING_WHEEL_H
@@ -0,0 +1,113 @@
+//
+// Per-worker job deque: the owner works on the back (LIFO, hot cache),
+// other workers steal the oldest job from the front.
+// A ring which only grows: unlike std::deque it does not allocate once it reached the peak size.
+//
+
+#ifndef ECHO_SERVER_SIMPLE_WORK_STEAL_DEQUE_H
+#define ECHO_SERVER_SIMPLE_WORK_STEAL_DEQUE_H
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <utility>
+
+#include "common/defines.h"
+
+#define WORK_STEAL_DEQUE_INITIAL_SIZE   (64)
+
+
+template<typename T>
+class alignas(CACHE_LINE_SIZE) t_work_steal_deque {
+private:
+    // power of two capacity; the jobs are [head, head + count) modulo the capacity
+    std::vector<T> ring;
+    size_t head = 0;
+    size_t count = 0;
+    mutable std::mutex mut;
+    // lets thieves skip empty deques without taking the lock
+    std::atomic<size_t> size = 0;
+
+    // doubles the capacity keeping the job order
+    void grow();
+
+public:
+    t_work_steal_deque() = default;
+
+    ~t_work_steal_deque() = default;
+
+    t_work_steal_deque(const t_work_steal_deque &q) = delete;
+
+    const t_work_steal_deque &operator=(const t_work_steal_deque &q) = delete;
+
+    // owner only
+    void push_back(T &&d);
+
+    // owner only
+    [[nodiscard]] bool try_pop_back(T &d);
+
+    // any thread
+    [[nodiscard]] bool try_steal_front(T &d);
+
+    [[nodiscard]] size_t get_size() const;
+};
+
+template<typename T>
+void t_work_steal_deque<T>::grow() {
+    std::vector<T> new_ring(ring.empty() ? WORK_STEAL_DEQUE_INITIAL_SIZE : 2 * ring.size());
+    for (size_t i = 0; i < count; ++i) {
+        new_ring[i] = std::move(ring[(head + i) & (ring.size() - 1)]);
+    }
+    ring.swap(new_ring);
+    head = 0;
+}
+
+template<typename T>
+void t_work_steal_deque<T>::push_back(T &&d) {
+    std::lock_guard<std::mutex> lg(mut);
+    if (count == ring.size()) {
+        grow();
+    }
+    ring[(head + count) & (ring.size() - 1)] = std::move(d);
+    count++;
+    size.store(count, std::memory_order_relaxed);
+}
+
+template<typename T>
+bool t_work_steal_deque<T>::try_pop_back(T &d) {
+    if (0 == size.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lg(mut);
+    if (0 == count) {
+        return false;
+    }
+    count--;
+    d = std::move(ring[(head + count) & (ring.size() - 1)]);
+    size.store(count, std::memory_order_relaxed);
+    return true;
+}
+
+template<typename T>
+bool t_work_steal_deque<T>::try_steal_front(T &d) {
+    if (0 == size.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    std::unique_lock<std::mutex> lg(mut, std::try_to_lock);
+    // the owner or another thief is here; do not wait for it
+    if (!lg.owns_lock() || 0 == count) {
+        return false;
+    }
+    d = std::move(ring[head]);
+    head = (head + 1) & (ring.size() - 1);
+    count--;
+    size.store(count, std::memory_order_relaxed);
+    return true;
+}
+
+template<typename T>
+size_t t_work_steal_deque<T>::get_size() const {
+    return size.load(std::memory_order_relaxed);
+}
+
+#endif //ECHO_SERVER_SIMPLE_WORK_STEAL_DEQUE_H
@@ -0,0 +1,9 @@
+#ifndef ECHO_SERVER_ECHO_BENCH_H
+#define ECHO_SERVER_ECHO_BENCH_H
+
+#include <cinttypes>
+
+// load generator for the echo servers; configured by the command line flags
+int echo_bench_main(uint16_t port);
+
+#endif //ECHO_SERVER_ECHO_BENCH_H
@@ -1,8 +1,8 @@
 #ifndef ECHO_SERVER_ECHO_SERVER_BOOST_ASIO_H
 #define ECHO_SERVER_ECHO_SERVER_BOOST_ASIO_H
 
-#include <cinttypes>
+#include "engine.h"
 
-int echo_server_boost_asio_main(uint16_t port);
+extern const engine_t g_engine_boost_asio;
 
 #endif //ECHO_SERVER_ECHO_SERVER_BOOST_ASIO_H
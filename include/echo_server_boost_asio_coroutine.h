@@ -0,0 +1,8 @@
+#ifndef ECHO_SERVER_ECHO_SERVER_BOOST_ASIO_COROUTINE_H
+#define ECHO_SERVER_ECHO_SERVER_BOOST_ASIO_COROUTINE_H
+
+#include "engine.h"
+
+extern const engine_t g_engine_boost_asio_coroutine;
+
+#endif //ECHO_SERVER_ECHO_SERVER_BOOST_ASIO_COROUTINE_H
@@ -1,8 +1,8 @@
 #ifndef ECHO_SERVER_SIMPLE_ECHO_SERVER_CUSTOM_THREAD_POOL_H
 #define ECHO_SERVER_SIMPLE_ECHO_SERVER_CUSTOM_THREAD_POOL_H
 
-#include <cinttypes>
+#include "engine.h"
 
-int echo_server_custom_thread_pool_main(uint16_t port);
+extern const engine_t g_engine_custom_thread_pool;
 
 #endif //ECHO_SERVER_SIMPLE_ECHO_SERVER_CUSTOM_THREAD_POOL_H
@@ -0,0 +1,8 @@
+#ifndef ECHO_SERVER_ECHO_SERVER_EPOLL_H
+#define ECHO_SERVER_ECHO_SERVER_EPOLL_H
+
+#include "engine.h"
+
+extern const engine_t g_engine_epoll;
+
+#endif //ECHO_SERVER_ECHO_SERVER_EPOLL_H
@@ -0,0 +1,8 @@
+#ifndef ECHO_SERVER_ECHO_SERVER_IO_URING_H
+#define ECHO_SERVER_ECHO_SERVER_IO_URING_H
+
+#include "engine.h"
+
+extern const engine_t g_engine_io_uring;
+
+#endif //ECHO_SERVER_ECHO_SERVER_IO_URING_H
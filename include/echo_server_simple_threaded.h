@@ -1,8 +1,8 @@
 #ifndef ECHO_SERVER_SIMPLE_ECHO_SERVER_SIMPLE_THREADED_H
 #define ECHO_SERVER_SIMPLE_ECHO_SERVER_SIMPLE_THREADED_H
 
-#include <cinttypes>
+#include "engine.h"
 
-int echo_server_simple_threaded_main(uint16_t port);
+extern const engine_t g_engine_simple_threaded;
 
 #endif //ECHO_SERVER_SIMPLE_ECHO_SERVER_SIMPLE_THREADED_H
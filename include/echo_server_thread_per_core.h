@@ -0,0 +1,8 @@
+#ifndef ECHO_SERVER_ECHO_SERVER_THREAD_PER_CORE_H
+#define ECHO_SERVER_ECHO_SERVER_THREAD_PER_CORE_H
+
+#include "engine.h"
+
+extern const engine_t g_engine_thread_per_core;
+
+#endif //ECHO_SERVER_ECHO_SERVER_THREAD_PER_CORE_H
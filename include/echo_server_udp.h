@@ -0,0 +1,8 @@
+#ifndef ECHO_SERVER_ECHO_SERVER_UDP_H
+#define ECHO_SERVER_ECHO_SERVER_UDP_H
+
+#include "engine.h"
+
+extern const engine_t g_engine_udp;
+
+#endif //ECHO_SERVER_ECHO_SERVER_UDP_H
@@ -0,0 +1,36 @@
+//
+// Common interface of the echo server engines. The echo_server binary links every engine
+// and runs the one named by --engine; a new engine adds its engine_t to g_engines in engine.cpp.
+//
+
+#ifndef ECHO_SERVER_ENGINE_H
+#define ECHO_SERVER_ENGINE_H
+
+#include <cinttypes>
+#include <string>
+#include <gflags/gflags.h>
+
+DECLARE_string(engine);
+
+struct engine_t {
+    const char *name;
+    // opens the listener and allocates the engine state; nothing is served before run
+    int (*init)(uint16_t port);
+    // serves clients until stop is called, then releases the engine state
+    int (*run)();
+    // makes run return; called from the engine stop thread on SIGINT, possibly before run starts
+    void (*stop)();
+    // logs the engine counters; called after run returns
+    void (*log_stats)();
+};
+
+// nullptr if there is no engine with the name
+const engine_t *engine_find(const std::string &name);
+
+// comma-separated names of all engines
+std::string engine_get_names();
+
+// init, run and log_stats of the engine; the first SIGINT stops it, the second one exits at once
+int engine_main(const engine_t &engine, uint16_t port);
+
+#endif //ECHO_SERVER_ENGINE_H
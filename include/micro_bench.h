@@ -0,0 +1,7 @@
+#ifndef ECHO_SERVER_MICRO_BENCH_H
+#define ECHO_SERVER_MICRO_BENCH_H
+
+// in-process benchmarks of the server building blocks; configured by the command line flags
+int micro_bench_main();
+
+#endif //ECHO_SERVER_MICRO_BENCH_H
@@ -2,21 +2,21 @@
 #include "common/logging.h"
 #include "common/socket.h"
 #include "common/defines.h"
+#include "common/stage_stats.h"
+#include "common/config.h"
+#include "common/affinity.h"
 
-#ifdef ECHO_SERVER_SIMPLE
-#include "echo_server_simple.h"
+#ifdef ECHO_SERVER
+#include "engine.h"
 
-#elif ECHO_SERVER_SIMPLE_THREADED
-#include "echo_server_simple_threaded.h"
+#elif  ECHO_BENCH
+#include "echo_bench.h"
 
-#elif  ECHO_SERVER_CUSTOM_THREAD_POOL
-#include "echo_server_custom_thread_pool.h"
+#elif  MICRO_BENCH
+#include "micro_bench.h"
 
-#elif  ECHO_SERVER_BOOST_ASIO
-#include "echo_server_boost_asio.h"
-
-#elif  ECHO_SERVER_BOOST_ASIO_THREADED
-#include "echo_server_boost_asio_threaded.h"
+#elif  ALLOC_CHECK
+#include "alloc_check.h"
 
 #endif
 
@@ -27,29 +27,48 @@ int main(int argc, char *argv[]) {
     // Initialize Google’s logging library.
     logging_init(&argc, &argv);
     set_log_severity(google::GLOG_INFO);
+    if (STATUS_SUCCESS != config_init()) {
+        logging_deinit();
+        return STATUS_FAIL;
+    }
     sock_num_set_max_limit();
+#ifdef ECHO_SERVER
+    if (nullptr == engine_find(FLAGS_engine)) {
+        LOG(ERROR) << "Error unknown engine " << FLAGS_engine << ", available: " << engine_get_names();
+        logging_deinit();
+        return STATUS_FAIL;
+    }
+    if (STATUS_SUCCESS != affinity_init()) {
+        logging_deinit();
+        return STATUS_FAIL;
+    }
+    // kill -USR1 <pid> dumps the stage latencies to the log
+    if (STATUS_SUCCESS != stage_stats_init()) {
+        LOG(WARNING) << "Stage latency stats are not available";
+    }
+#endif
 
-#ifdef ECHO_SERVER_SIMPLE
-    ret = echo_server_simple_main(ECHO_SERVER_PORT);
-
-#elif ECHO_SERVER_SIMPLE_THREADED
-    ret = echo_server_simple_threaded_main(ECHO_SERVER_PORT);
+#ifdef ECHO_SERVER
+    ret = engine_main(*engine_find(FLAGS_engine), FLAGS_port);
 
-#elif  ECHO_SERVER_CUSTOM_THREAD_POOL
-    ret = echo_server_custom_thread_pool_main(ECHO_SERVER_PORT);
+#elif  ECHO_BENCH
+    ret = echo_bench_main(FLAGS_port);
 
-#elif  ECHO_SERVER_BOOST_ASIO
-    ret = echo_server_boost_asio_main(ECHO_SERVER_PORT);
+#elif  MICRO_BENCH
+    ret = micro_bench_main();
 
-#elif  ECHO_SERVER_BOOST_ASIO_THREADED
-    ret = echo_server_boost_asio_threaded_main(ECHO_SERVER_PORT);
+#elif  ALLOC_CHECK
+    ret = alloc_check_main(FLAGS_port);
 
 #else
     LOG(FATAL) << "No valid target specified during compilation!!!";
 
 #endif
 
-    LOG(INFO) << "Server finished with exit code: " << ret;
+#ifdef ECHO_SERVER
+    stage_stats_deinit();
+#endif
+    LOG(INFO) << "Finished with exit code: " << ret;
     logging_deinit();
     return ret;
 }
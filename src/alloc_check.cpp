@@ -0,0 +1,198 @@
+#include "alloc_check.h"
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "common/defines.h"
+#include "common/socket.h"
+#include "common/logging.h"
+#include "common/config.h"
+#include "common/buffer_pool.h"
+#include "echo_server_custom_thread_pool.h"
+
+// a stuck echo fails the check instead of hanging it
+#define CHECK_IO_TIMEOUT_MS             (5000)
+
+DEFINE_uint32(check_connections, 16, "Client connections echoing in parallel");
+DEFINE_uint32(check_warmup_rounds, 1000, "Rounds before the allocations are counted; a round echoes one message "
+                                         "on every connection");
+DEFINE_uint32(check_rounds, 10000, "Rounds whose allocations are counted");
+
+
+// glibc entry points behind the replaced functions
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+}
+
+namespace {
+    // every heap allocation of the process; operator new of libstdc++ allocates through malloc
+    std::atomic<size_t> g_heap_alloc_count = 0;
+}
+
+extern "C" void *malloc(size_t size) {
+    g_heap_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size) {
+    g_heap_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) {
+    g_heap_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" void *aligned_alloc(size_t alignment, size_t size) {
+    g_heap_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" void *memalign(size_t alignment, size_t size) {
+    g_heap_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void **ptr, size_t alignment, size_t size) {
+    g_heap_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    *ptr = __libc_memalign(alignment, size);
+    return nullptr == *ptr ? ENOMEM : STATUS_SUCCESS;
+}
+
+namespace alloc_check {
+    int connect_clients(uint16_t port, std::vector<int> &client_fds);
+
+    // every connection sends one message, then every echo is read back; allocates nothing
+    int echo_round(const std::vector<int> &client_fds, const char *message, char *echo, size_t size);
+
+    void close_clients(std::vector<int> &client_fds);
+}
+
+int alloc_check_main(uint16_t port) {
+    using namespace alloc_check;
+
+    const engine_t &engine = g_engine_custom_thread_pool;
+    std::vector<int> client_fds{};
+    size_t size = FLAGS_message_size;
+    std::unique_ptr<char[]> message{new char[size]};
+    std::unique_ptr<char[]> echo{new char[size]};
+    size_t engine_alloc_count;
+    size_t heap_alloc_count;
+    int rc = STATUS_SUCCESS;
+    int engine_rc = STATUS_SUCCESS;
+
+    signal(SIGPIPE, SIG_IGN);
+    for (size_t i = 0; i < size; ++i) {
+        message[i] = static_cast<char>('a' + i % 26);
+    }
+
+    if (STATUS_SUCCESS != engine.init(port)) {
+        return STATUS_FAIL;
+    }
+    std::thread engine_thread{[&engine, &engine_rc]() { engine_rc = engine.run(); }};
+
+    if (STATUS_SUCCESS != connect_clients(port, client_fds)) {
+        rc = STATUS_FAIL;
+    }
+    // the pools, the tables and the lazily created thread state grow to the load here
+    for (uint32_t round = 0; STATUS_SUCCESS == rc && round < FLAGS_check_warmup_rounds; ++round) {
+        rc = echo_round(client_fds, message.get(), echo.get(), size);
+    }
+
+    engine_alloc_count = buffer_pool_get_alloc_count();
+    heap_alloc_count = g_heap_alloc_count.load(std::memory_order_relaxed);
+    for (uint32_t round = 0; STATUS_SUCCESS == rc && round < FLAGS_check_rounds; ++round) {
+        rc = echo_round(client_fds, message.get(), echo.get(), size);
+    }
+    heap_alloc_count = g_heap_alloc_count.load(std::memory_order_relaxed) - heap_alloc_count;
+    engine_alloc_count = buffer_pool_get_alloc_count() - engine_alloc_count;
+
+    close_clients(client_fds);
+    engine.stop();
+    engine_thread.join();
+    engine.log_stats();
+
+    if (STATUS_SUCCESS != rc) {
+        LOG(ERROR) << "Error echo failed, no allocation count";
+        return STATUS_FAIL;
+    }
+    LOG(INFO) << FLAGS_check_rounds << " rounds of " << client_fds.size() << " echoes of " << size
+              << " B: " << heap_alloc_count << " heap allocations, " << engine_alloc_count << " pooled buffers";
+    if (0 != heap_alloc_count) {
+        LOG(ERROR) << "Error the warmed up echo path allocates";
+        return STATUS_FAIL;
+    }
+    return engine_rc;
+}
+
+int alloc_check::connect_clients(uint16_t port, std::vector<int> &client_fds) {
+    sockaddr_in server_addr{};
+    int fd;
+    int no_delay = 1;
+
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    client_fds.reserve(FLAGS_check_connections);
+    for (uint32_t i = 0; i < FLAGS_check_connections; ++i) {
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            PLOG(ERROR) << "Error calling socket";
+            return STATUS_FAIL;
+        }
+        client_fds.push_back(fd);
+        if (STATUS_SUCCESS != connect(fd, reinterpret_cast<sockaddr *>(&server_addr), sizeof(server_addr))) {
+            PLOG(ERROR) << "Error calling connect";
+            return STATUS_FAIL;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+        socket_set_timeouts(fd, CHECK_IO_TIMEOUT_MS, CHECK_IO_TIMEOUT_MS);
+    }
+    return STATUS_SUCCESS;
+}
+
+int alloc_check::echo_round(const std::vector<int> &client_fds, const char *message, char *echo, size_t size) {
+    ssize_t io_bytes;
+
+    for (int fd: client_fds) {
+        if (static_cast<ssize_t>(size) != send(fd, message, size, MSG_NOSIGNAL)) {
+            PLOG(ERROR) << "Error calling send";
+            return STATUS_FAIL;
+        }
+    }
+    for (int fd: client_fds) {
+        for (size_t received = 0; received < size; received += io_bytes) {
+            io_bytes = recv(fd, echo + received, size - received, 0);
+            if (io_bytes <= 0) {
+                PLOG(ERROR) << "Error calling recv";
+                return STATUS_FAIL;
+            }
+        }
+        if (0 != memcmp(message, echo, size)) {
+            LOG(ERROR) << "Error echo does not match the message";
+            return STATUS_FAIL;
+        }
+    }
+    return STATUS_SUCCESS;
+}
+
+void alloc_check::close_clients(std::vector<int> &client_fds) {
+    for (int fd: client_fds) {
+        close(fd);
+    }
+}
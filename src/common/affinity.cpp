@@ -0,0 +1,170 @@
+#include "common/affinity.h"
+#include <pthread.h>
+#include <sched.h>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "common/defines.h"
+#include "common/logging.h"
+#include "common/config.h"
+
+
+namespace {
+    // placement order of the pinned threads
+    std::vector<int> g_cpu_order{};
+    // indexed by CPU; CPUs without a node entry are on node 0
+    std::vector<int> g_cpu_node{};
+
+    // kernel cpulist format: "0-3,8,10-11"; false on a malformed list
+    bool parse_cpu_list(const std::string &list, std::vector<int> &cpus) {
+        std::stringstream s{list};
+        std::string range;
+
+        while (std::getline(s, range, ',')) {
+            if (range.empty() || "\n" == range) {
+                continue; // while
+            }
+            char *end = nullptr;
+            long first = std::strtol(range.c_str(), &end, 10);
+            long last = first;
+            if ('-' == *end) {
+                last = std::strtol(end + 1, &end, 10);
+            }
+            if (end == range.c_str() || (*end != '\0' && *end != '\n') || first < 0 || last < first ||
+                last >= CPU_SETSIZE) {
+                return false;
+            }
+            for (long cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(static_cast<int>(cpu));
+            }
+        }
+        return true;
+    }
+
+    // node -> CPUs; empty without NUMA support
+    std::map<int, std::vector<int>> read_node_cpus() {
+        std::map<int, std::vector<int>> node_cpus{};
+        std::error_code ec;
+
+        for (const auto &entry: std::filesystem::directory_iterator(AFFINITY_NODE_DIR, ec)) {
+            std::string name = entry.path().filename().string();
+            if (0 != name.rfind("node", 0) || name.size() == 4 ||
+                std::string::npos != name.find_first_not_of("0123456789", 4)) {
+                continue; // for
+            }
+            std::ifstream file{entry.path() / "cpulist"};
+            std::string list;
+            std::vector<int> cpus{};
+            if (!std::getline(file, list) || !parse_cpu_list(list, cpus)) {
+                continue; // for
+            }
+            node_cpus[std::stoi(name.substr(4))] = std::move(cpus);
+        }
+        return node_cpus;
+    }
+}
+
+int affinity_init() {
+    cpu_set_t allowed_set;
+    std::vector<int> cpus{};
+
+    g_cpu_order.clear();
+    g_cpu_node.assign(CPU_SETSIZE, 0);
+    if (!FLAGS_pin_threads) {
+        LOG(INFO) << "Thread pinning is disabled";
+        return STATUS_SUCCESS;
+    }
+
+    if (STATUS_SUCCESS != sched_getaffinity(0, sizeof(allowed_set), &allowed_set)) {
+        PLOG(ERROR) << "Error calling sched_getaffinity";
+        return STATUS_FAIL;
+    }
+    if (FLAGS_cpu_set.empty()) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &allowed_set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    } else if (!parse_cpu_list(FLAGS_cpu_set, cpus)) {
+        LOG(ERROR) << "Error invalid cpu_set " << FLAGS_cpu_set;
+        return STATUS_FAIL;
+    }
+
+    std::map<int, std::vector<int>> node_cpus{};
+    for (const auto &[node, node_cpu_list]: read_node_cpus()) {
+        for (int cpu: node_cpu_list) {
+            g_cpu_node[cpu] = node;
+        }
+    }
+    for (int cpu: cpus) {
+        if (!CPU_ISSET(cpu, &allowed_set)) {
+            LOG(WARNING) << "CPU " << cpu << " of cpu_set is not available, skipped";
+            continue; // for
+        }
+        node_cpus[g_cpu_node[cpu]].push_back(cpu);
+    }
+    if (node_cpus.empty()) {
+        LOG(ERROR) << "Error no available CPUs in cpu_set " << FLAGS_cpu_set;
+        return STATUS_FAIL;
+    }
+
+    // Interleave the nodes: i-th CPU of every node, then the next one
+    for (size_t i = 0; g_cpu_order.size() < cpus.size(); ++i) {
+        bool added = false;
+        for (const auto &[node, node_cpu_list]: node_cpus) {
+            if (i < node_cpu_list.size()) {
+                g_cpu_order.push_back(node_cpu_list[i]);
+                added = true;
+            }
+        }
+        if (!added) {
+            break; // for
+        }
+    }
+
+    std::stringstream s{};
+    s << "Thread placement over " << node_cpus.size() << " NUMA node(s), cpu:node";
+    for (int cpu: g_cpu_order) {
+        s << ' ' << cpu << ':' << g_cpu_node[cpu];
+    }
+    LOG(INFO) << s.str();
+    return STATUS_SUCCESS;
+}
+
+int affinity_get_cpu(size_t thread_index) {
+    if (g_cpu_order.empty()) {
+        return -1;
+    }
+    return g_cpu_order[thread_index % g_cpu_order.size()];
+}
+
+int affinity_get_node(int cpu) {
+    if (cpu < 0 || static_cast<size_t>(cpu) >= g_cpu_node.size()) {
+        return 0;
+    }
+    return g_cpu_node[cpu];
+}
+
+int affinity_pin_thread(size_t thread_index) {
+    cpu_set_t cpu_set;
+    int cpu = affinity_get_cpu(thread_index);
+    int rc;
+
+    if (cpu < 0) {
+        return STATUS_SUCCESS;
+    }
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    rc = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+    if (STATUS_SUCCESS != rc) {
+        LOG(WARNING) << "Failed to pin thread " << thread_index << " to CPU " << cpu << ": " << strerror(rc);
+        return STATUS_FAIL;
+    }
+    DLOG(INFO) << "Thread " << thread_index << " pinned to CPU " << cpu << ", node " << affinity_get_node(cpu);
+    return STATUS_SUCCESS;
+}
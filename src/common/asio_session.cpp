@@ -0,0 +1,110 @@
+#include "common/asio_session.h"
+#include <algorithm>
+#include <new>
+
+#include "common/config.h"
+
+namespace {
+    // trivially destructible, so it is usable until the thread ends
+    struct thread_free_list {
+        asio_session *head;
+        size_t count;
+        bool detached;
+    };
+
+    // frees the cached sessions on thread exit
+    struct thread_free_list_guard {
+        ~thread_free_list_guard();
+    };
+
+    std::atomic<size_t> g_session_alloc_count = 0;
+    std::atomic<size_t> g_handler_alloc_count = 0;
+    thread_local thread_free_list t_free_list{nullptr, 0, false};
+    thread_local thread_free_list_guard t_free_list_guard{};
+
+    thread_free_list_guard::~thread_free_list_guard() {
+        while (nullptr != t_free_list.head) {
+            delete std::exchange(t_free_list.head, t_free_list.head->next);
+        }
+        t_free_list = thread_free_list{nullptr, 0, true};
+    }
+}
+
+
+void *asio_handler_memory::allocate(size_t size) {
+    if (!in_use && size <= sizeof(storage)) {
+        in_use = true;
+        return storage;
+    }
+    g_handler_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    return ::operator new(size);
+}
+
+void asio_handler_memory::deallocate(void *pointer) {
+    if (pointer == storage) {
+        in_use = false;
+    } else {
+        ::operator delete(pointer);
+    }
+}
+
+void asio_session_deleter::operator()(asio_session *session) const {
+    session->release();
+}
+
+asio_session_ptr asio_session::acquire(boost::asio::ip::tcp::socket socket, uint64_t accept_time_ns) {
+    asio_session *session = t_free_list.head;
+
+    if (nullptr != session) {
+        t_free_list.head = session->next;
+        t_free_list.count--;
+    } else {
+        session = new asio_session{};
+        session->capacity = FLAGS_message_size;
+        session->buffer.reset(new char[session->capacity]);
+        g_session_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    }
+    // touch the guard so it is constructed and destroyed with this thread
+    (void) &t_free_list_guard;
+    session->socket.emplace(std::move(socket));
+    session->accept_time_ns = accept_time_ns;
+    session->connection_count = nullptr;
+    session->next = nullptr;
+    return asio_session_ptr{session};
+}
+
+void asio_session::grow_buffer() {
+    capacity = std::min<size_t>(capacity * 2, FLAGS_stream_buffer_max_size);
+    buffer.reset(new char[capacity]);
+}
+
+void asio_session::release() {
+    boost::system::error_code ec;
+
+    deadline.unwatch();
+    socket->close(ec);
+    socket.reset();
+    if (nullptr != connection_count) {
+        connection_count->fetch_sub(1, std::memory_order_relaxed);
+    }
+    if (t_free_list.detached || t_free_list.count >= ASIO_SESSION_THREAD_CACHE_SIZE) {
+        delete this;
+        return;
+    }
+    // a streaming connection grew the buffer; a cached session starts small again
+    if (capacity != FLAGS_message_size) {
+        capacity = FLAGS_message_size;
+        buffer.reset(new char[capacity]);
+    }
+    next = t_free_list.head;
+    t_free_list.head = this;
+    t_free_list.count++;
+}
+
+size_t asio_session_get_alloc_count() {
+    return g_session_alloc_count.load(std::memory_order_relaxed);
+}
+
+size_t asio_handler_get_alloc_count() {
+    return g_handler_alloc_count.load(std::memory_order_relaxed);
+}
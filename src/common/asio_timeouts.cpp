@@ -0,0 +1,102 @@
+#include "common/asio_timeouts.h"
+#include <sys/socket.h>
+#include <chrono>
+#include <algorithm>
+
+#include "common/config.h"
+
+namespace {
+    std::atomic<size_t> g_reap_count = 0;
+
+    // A refresh only stores the deadline, and a write deadline may come before the filed idle one:
+    // the node is filed no later than the shortest timeout from now, so it is never swept late
+    uint64_t filed_deadline_ms(uint64_t deadline_ms, uint64_t now_ms) {
+        uint32_t shortest_ms = 0 == FLAGS_write_timeout_ms ? FLAGS_idle_timeout_ms :
+                               0 == FLAGS_idle_timeout_ms ? FLAGS_write_timeout_ms :
+                               std::min(FLAGS_idle_timeout_ms, FLAGS_write_timeout_ms);
+        return std::min(deadline_ms, now_ms + shortest_ms);
+    }
+}
+
+
+void asio_deadline::watch(asio_timeouts &owner, int socket_fd) {
+    if (!connection_timeouts_enabled()) {
+        return;
+    }
+    uint64_t now_ms = timing_wheel_now_ms();
+    uint64_t deadline = connection_deadline_ms(now_ms, false);
+
+    deadline_ms.store(deadline, std::memory_order_relaxed);
+    fd = socket_fd;
+    timeouts = &owner;
+    std::lock_guard<std::mutex> lg{owner.mutex};
+    timer = owner.wheel.add(filed_deadline_ms(deadline, now_ms), reinterpret_cast<uint64_t>(this));
+}
+
+void asio_deadline::unwatch() {
+    if (nullptr == timeouts) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lg{timeouts->mutex};
+        if (TIMER_ID_NONE != timer) {
+            timeouts->wheel.cancel(timer);
+            timer = TIMER_ID_NONE;
+        }
+    }
+    timeouts = nullptr;
+    fd = -1;
+}
+
+void asio_timeouts::start(boost::asio::io_context &io_context) {
+    if (!connection_timeouts_enabled()) {
+        return;
+    }
+    sweep_timer.emplace(io_context);
+    arm_sweep();
+}
+
+void asio_timeouts::stop() {
+    sweep_timer.reset();
+}
+
+void asio_timeouts::arm_sweep() {
+    sweep_timer->expires_after(std::chrono::milliseconds{ASIO_TIMEOUT_SWEEP_MS});
+    sweep_timer->async_wait([this](boost::system::error_code ec) {
+        if (ec) {
+            return;
+        }
+        sweep();
+        arm_sweep();
+    });
+}
+
+void asio_timeouts::sweep() {
+    uint64_t now_ms = timing_wheel_now_ms();
+    uint64_t owner;
+    size_t reap_count = 0;
+    std::lock_guard<std::mutex> lg{mutex};
+
+    if (0 == wheel.advance(now_ms)) {
+        return;
+    }
+    while (wheel.pop_expired(owner)) {
+        auto *deadline = reinterpret_cast<asio_deadline *>(owner);
+        uint64_t deadline_ms = deadline->deadline_ms.load(std::memory_order_relaxed);
+
+        // the deadline was refreshed by the handlers since it was filed
+        if (deadline_ms > now_ms) {
+            deadline->timer = wheel.add(filed_deadline_ms(deadline_ms, now_ms), owner);
+            continue; // while
+        }
+        // the socket is not closed while its deadline is watched; the failed operation releases the connection
+        deadline->timer = TIMER_ID_NONE;
+        shutdown(deadline->fd, SHUT_RDWR);
+        reap_count++;
+    }
+    g_reap_count.fetch_add(reap_count, std::memory_order_relaxed);
+}
+
+size_t asio_timeouts_get_reap_count() {
+    return g_reap_count.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,309 @@
+#include "common/async_log.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common/defines.h"
+#include "common/config.h"
+#include "common/connection.h"
+
+struct async_log_slot {
+    const char *file;
+    int line;
+    google::LogSeverity severity;
+    // -1 for ALOG
+    int saved_errno;
+    uint32_t length;
+    char text[ASYNC_LOG_RECORD_TEXT_SIZE];
+};
+
+struct async_log_thread {
+    std::unique_ptr<async_log_slot[]> ring;
+    size_t mask;
+    // the producer side, written by the thread only
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> head = 0;
+    size_t cached_tail = 0;
+    // the consumer side, written by the flush thread only
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail = 0;
+    // set on thread exit; the flush thread frees the ring once it is drained
+    std::atomic<bool> retired = false;
+    // the next thread registered before the list was taken by a drain
+    async_log_thread *next_new = nullptr;
+
+    // not zeroed: the pages of the slots become resident as the records reach them
+    explicit async_log_thread(size_t size) : ring{new async_log_slot[size]}, mask{size - 1} {}
+
+    [[nodiscard]] size_t memory_size() const {
+        return (mask + 1) * sizeof(async_log_slot);
+    }
+
+    // nullptr if the ring is full
+    async_log_slot *reserve() {
+        size_t h = head.load(std::memory_order_relaxed);
+
+        if (h - cached_tail > mask) {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (h - cached_tail > mask) {
+                return nullptr;
+            }
+        }
+        return &ring[h & mask];
+    }
+
+    void publish() {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+};
+
+namespace {
+    struct log_registry {
+        // guards stop_flag; the flush thread sleeps on it, never writes to glog holding it
+        std::mutex mutex{};
+        // stops the flush thread, and wakes it from the idle wait
+        std::condition_variable flush_cv{};
+        bool stop_flag = false;
+        // the threads registered since the last drain; a thread pushes itself without a lock
+        std::atomic<async_log_thread *> new_threads = nullptr;
+        // serializes the drains, guards threads and reported_drop_count
+        std::mutex drain_mutex{};
+        // every adopted thread which logged since async_log_init
+        std::vector<std::unique_ptr<async_log_thread>> threads{};
+        std::thread flush_thread{};
+        size_t reported_drop_count = 0;
+    };
+
+    // retires the ring of the thread on its exit
+    struct thread_log_guard {
+        ~thread_log_guard();
+    };
+
+    std::atomic<bool> g_running = false;
+    std::atomic<size_t> g_drop_count = 0;
+    // the rings of the registered threads, bounded by --async_log_memory_size
+    std::atomic<size_t> g_ring_memory_size = 0;
+    std::atomic<bool> g_ring_memory_reported = false;
+    // set by the flush thread once the rings are empty; the first record after that wakes it
+    std::atomic<bool> g_flush_idle = false;
+    thread_local async_log_thread *t_log_thread = nullptr;
+    // a thread logs synchronously once its guard is destroyed or if it found the ring memory taken
+    thread_local bool t_detached = false;
+    thread_local thread_log_guard t_log_guard{};
+    // the text of a synchronous record; trivial, so it outlives the guard
+    thread_local async_log_slot t_sync_slot;
+
+    // never destroyed: threads may log while the static destructors run
+    log_registry &get_registry() {
+        static auto *registry = new log_registry{};
+        return *registry;
+    }
+
+    thread_log_guard::~thread_log_guard() {
+        if (nullptr != t_log_thread) {
+            t_log_thread->retired.store(true, std::memory_order_release);
+            t_log_thread = nullptr;
+        }
+        t_detached = true;
+    }
+
+    // nullptr if the thread logs synchronously
+    async_log_thread *get_log_thread() {
+        if (nullptr == t_log_thread && !t_detached) {
+            log_registry &registry = get_registry();
+            size_t memory_size = FLAGS_async_log_ring_size * sizeof(async_log_slot);
+
+            if (g_ring_memory_size.fetch_add(memory_size, std::memory_order_relaxed) + memory_size >
+                FLAGS_async_log_memory_size) {
+                g_ring_memory_size.fetch_sub(memory_size, std::memory_order_relaxed);
+                t_detached = true;
+                if (!g_ring_memory_reported.exchange(true, std::memory_order_relaxed)) {
+                    LOG(WARNING) << "Async log rings take " << FLAGS_async_log_memory_size
+                                 << " B, the next threads log synchronously";
+                }
+                return nullptr;
+            }
+            // owned by the drains once they adopt it
+            auto *thread = new async_log_thread(FLAGS_async_log_ring_size);
+
+            // touch the guard so it is constructed and destroyed with this thread
+            (void) &t_log_guard;
+            t_log_thread = thread;
+            thread->next_new = registry.new_threads.load(std::memory_order_relaxed);
+            while (!registry.new_threads.compare_exchange_weak(thread->next_new, thread, std::memory_order_release,
+                                                               std::memory_order_relaxed)) {
+            }
+        }
+        return t_log_thread;
+    }
+
+    void write_to_glog(const async_log_slot &slot) {
+        if (slot.saved_errno >= 0) {
+            // ErrnoLogMessage takes errno when it is constructed
+            errno = slot.saved_errno;
+            google::ErrnoLogMessage(slot.file, slot.line, slot.severity, 0,
+                                    &google::LogMessage::SendToLog).stream().write(slot.text, slot.length);
+        } else {
+            google::LogMessage(slot.file, slot.line, slot.severity).stream().write(slot.text, slot.length);
+        }
+    }
+
+    // returns the written records count; the drains take turns, the producers never wait for them
+    size_t drain_threads(log_registry &registry) {
+        std::lock_guard<std::mutex> lg{registry.drain_mutex};
+        auto &threads = registry.threads;
+        size_t write_count = 0;
+
+        // adopt the threads registered since the last drain
+        async_log_thread *new_thread = registry.new_threads.exchange(nullptr, std::memory_order_acquire);
+        while (nullptr != new_thread) {
+            threads.emplace_back(new_thread);
+            new_thread = new_thread->next_new;
+        }
+
+        for (auto it = threads.begin(); it != threads.end();) {
+            async_log_thread &thread = **it;
+            // read before the head: a retired thread has published all its records
+            bool retired = thread.retired.load(std::memory_order_acquire);
+            size_t h = thread.head.load(std::memory_order_acquire);
+            size_t t = thread.tail.load(std::memory_order_relaxed);
+
+            write_count += h - t;
+            for (; t != h; ++t) {
+                write_to_glog(thread.ring[t & thread.mask]);
+            }
+            thread.tail.store(t, std::memory_order_release);
+            if (retired) {
+                g_ring_memory_size.fetch_sub(thread.memory_size(), std::memory_order_relaxed);
+                it = threads.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        size_t drop_count = g_drop_count.load(std::memory_order_relaxed);
+        if (drop_count != registry.reported_drop_count) {
+            LOG(WARNING) << "Async log dropped " << drop_count - registry.reported_drop_count
+                         << " records on full rings";
+            registry.reported_drop_count = drop_count;
+        }
+        return write_count;
+    }
+
+    void flush_routine() {
+        log_registry &registry = get_registry();
+        std::unique_lock<std::mutex> lock{registry.mutex};
+
+        while (!registry.stop_flag) {
+            if (g_flush_idle.load(std::memory_order_relaxed)) {
+                registry.flush_cv.wait_for(lock, std::chrono::milliseconds{ASYNC_LOG_IDLE_FLUSH_PERIOD_MS},
+                                           [&registry]() {
+                                               return registry.stop_flag ||
+                                                      !g_flush_idle.load(std::memory_order_relaxed);
+                                           });
+                g_flush_idle.store(false, std::memory_order_relaxed);
+            } else {
+                registry.flush_cv.wait_for(lock, std::chrono::milliseconds{FLAGS_async_log_flush_ms});
+            }
+            lock.unlock();
+            if (0 == drain_threads(registry)) {
+                // a record published just before the flag is set sees no idle thread to wake, so drain once more;
+                // a record missing both waits at most the idle period
+                g_flush_idle.store(true, std::memory_order_seq_cst);
+                if (0 != drain_threads(registry)) {
+                    g_flush_idle.store(false, std::memory_order_relaxed);
+                }
+            }
+            lock.lock();
+        } // while (!registry.stop_flag)
+    }
+}
+
+
+async_log_record::async_log_record(const char *file, int line, google::LogSeverity severity, int saved_errno) :
+        thread{nullptr}, slot{nullptr}, pos{nullptr}, end{nullptr} {
+    if (severity < google::GLOG_FATAL && g_running.load(std::memory_order_relaxed)) {
+        thread = get_log_thread();
+    }
+    if (nullptr == thread) {
+        slot = &t_sync_slot;
+    } else {
+        slot = thread->reserve();
+        if (nullptr == slot) {
+            g_drop_count.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+    slot->file = file;
+    slot->line = line;
+    slot->severity = severity;
+    slot->saved_errno = saved_errno;
+    pos = slot->text;
+    end = slot->text + sizeof(slot->text);
+}
+
+async_log_record::~async_log_record() {
+    if (nullptr == slot) {
+        return;
+    }
+    slot->length = static_cast<uint32_t>(pos - slot->text);
+    if (nullptr == thread) {
+        write_to_glog(*slot);
+        return;
+    }
+    thread->publish();
+    // one waker per idle period; the others see the cleared flag
+    if (g_flush_idle.load(std::memory_order_relaxed) && g_flush_idle.exchange(false, std::memory_order_relaxed)) {
+        get_registry().flush_cv.notify_one();
+    }
+}
+
+async_log_record &async_log_record::operator<<(const peer_addr &peer) {
+    char buffer[PEER_ADDR_MAX_STR_SIZE];
+
+    append(buffer, peer_addr_format(peer, buffer) - buffer);
+    return *this;
+}
+
+void async_log_init() {
+    log_registry &registry = get_registry();
+
+    if (!FLAGS_async_log) {
+        return;
+    }
+    registry.stop_flag = false;
+    g_flush_idle.store(false, std::memory_order_relaxed);
+    registry.flush_thread = std::thread{flush_routine};
+    g_running.store(true, std::memory_order_relaxed);
+}
+
+void async_log_deinit() {
+    log_registry &registry = get_registry();
+
+    if (!g_running.exchange(false, std::memory_order_relaxed)) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lg{registry.mutex};
+        registry.stop_flag = true;
+    }
+    registry.flush_cv.notify_one();
+    registry.flush_thread.join();
+    // a record started before g_running was cleared may still be published after this drain and stays queued
+    drain_threads(registry);
+}
+
+void async_log_flush() {
+    log_registry &registry = get_registry();
+
+    if (!g_running.load(std::memory_order_relaxed)) {
+        return;
+    }
+    drain_threads(registry);
+}
+
+size_t async_log_get_drop_count() {
+    return g_drop_count.load(std::memory_order_relaxed);
+}
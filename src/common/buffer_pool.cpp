@@ -0,0 +1,142 @@
+#include "common/buffer_pool.h"
+#include <atomic>
+#include <mutex>
+#include <utility>
+#include <new>
+
+#include "common/config.h"
+
+namespace {
+    using block = pooled_buffer::block;
+
+    struct shared_free_list {
+        std::mutex mutex{};
+        block *head = nullptr;
+    };
+
+    // trivially destructible, so it is usable until the thread ends
+    struct thread_free_list {
+        block *head;
+        size_t count;
+        bool detached;
+    };
+
+    // hands the thread free list over to the shared one on thread exit
+    struct thread_free_list_guard {
+        ~thread_free_list_guard();
+    };
+
+    std::atomic<size_t> g_alloc_count = 0;
+    thread_local thread_free_list t_free_list{nullptr, 0, false};
+    thread_local thread_free_list_guard t_free_list_guard{};
+
+    // never destroyed: buffers may be released by static destructors
+    shared_free_list &get_shared_free_list() {
+        static auto *list = new shared_free_list{};
+        return *list;
+    }
+
+    void push_shared(block *first, block *last) {
+        shared_free_list &shared = get_shared_free_list();
+        std::lock_guard<std::mutex> lg{shared.mutex};
+        last->next = shared.head;
+        shared.head = first;
+    }
+
+    block *pop_shared() {
+        shared_free_list &shared = get_shared_free_list();
+        std::lock_guard<std::mutex> lg{shared.mutex};
+        block *b = shared.head;
+        if (nullptr != b) {
+            shared.head = b->next;
+        }
+        return b;
+    }
+
+    thread_free_list_guard::~thread_free_list_guard() {
+        block *last = t_free_list.head;
+        if (nullptr != last) {
+            while (nullptr != last->next) {
+                last = last->next;
+            }
+            push_shared(t_free_list.head, last);
+        }
+        t_free_list = thread_free_list{nullptr, 0, true};
+    }
+}
+
+
+pooled_buffer::~pooled_buffer() {
+    release();
+}
+
+pooled_buffer::pooled_buffer(pooled_buffer &&b) noexcept: ptr(std::exchange(b.ptr, nullptr)) {}
+
+pooled_buffer &pooled_buffer::operator=(pooled_buffer &&b) noexcept {
+    if (this != &b) {
+        release();
+        ptr = std::exchange(b.ptr, nullptr);
+    }
+    return *this;
+}
+
+pooled_buffer pooled_buffer::acquire() {
+    block *b = t_free_list.head;
+
+    if (nullptr != b) {
+        t_free_list.head = b->next;
+        t_free_list.count--;
+    } else {
+        b = pop_shared();
+        if (nullptr == b) {
+            b = new(::operator new(sizeof(block) + capacity())) block{};
+            g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    // touch the guard so it is constructed and destroyed with this thread
+    (void) &t_free_list_guard;
+    b->size = 0;
+    return pooled_buffer{b};
+}
+
+void pooled_buffer::release() {
+    if (nullptr == ptr) {
+        return;
+    }
+    if (t_free_list.detached || t_free_list.count >= BUFFER_POOL_THREAD_CACHE_SIZE) {
+        push_shared(ptr, ptr);
+    } else {
+        ptr->next = t_free_list.head;
+        t_free_list.head = ptr;
+        t_free_list.count++;
+    }
+    ptr = nullptr;
+}
+
+bool pooled_buffer::is_valid() const {
+    return nullptr != ptr;
+}
+
+char *pooled_buffer::data() {
+    return reinterpret_cast<char *>(ptr + 1);
+}
+
+const char *pooled_buffer::data() const {
+    return reinterpret_cast<const char *>(ptr + 1);
+}
+
+ssize_t pooled_buffer::size() const {
+    return ptr->size;
+}
+
+void pooled_buffer::set_size(ssize_t size) {
+    ptr->size = size;
+}
+
+ssize_t pooled_buffer::capacity() {
+    return static_cast<ssize_t>(FLAGS_message_size) + 1;
+}
+
+size_t buffer_pool_get_alloc_count() {
+    return g_alloc_count.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,212 @@
+#include "common/config.h"
+#include <unistd.h>
+#include <climits>
+#include <pthread.h>
+#include <sstream>
+#include <thread>
+#include <algorithm>
+
+#include "common/defines.h"
+#include "common/logging.h"
+#include "common/async_log.h"
+
+#define PORT_MAX                        (65535)
+#define THREADS_MAX                     (4096)
+#define MESSAGE_SIZE_MAX                (1024 * 1024)
+// buffer ids of an io_uring buffer ring are 16 bit
+#define URING_ENTRIES_MAX               (32768)
+// the kernel limit of the vector of one recvmmsg/sendmmsg call
+#define UDP_BATCH_SIZE_MAX              (1024)
+// 256 MiB of records per thread
+#define ASYNC_LOG_RING_SIZE_MAX         (1024 * 1024)
+
+
+DEFINE_uint32(port, ECHO_SERVER_PORT, "TCP port to listen on");
+DEFINE_uint32(threads, 0, "Worker or reactor threads of the multithreaded servers; 0 - one per available CPU");
+DEFINE_uint32(message_size, EXPECTED_MESSAGE_SIZE, "Read size of the message based servers and the initial "
+                                                   "buffer size of the streaming ones, bytes");
+DEFINE_uint32(stream_buffer_max_size, STREAM_BUFFER_MAX_SIZE, "Upper limit of an adaptive stream buffer, bytes");
+DEFINE_bool(splice_echo, true, "Echo bulk payloads with splice() where the server supports it");
+DEFINE_uint32(splice_threshold, SPLICE_THRESHOLD, "Pending bytes from which splice() is used instead of a copy "
+                                                  "through user space, bytes");
+DEFINE_uint32(splice_pipe_size, SPLICE_PIPE_SIZE, "Requested capacity of a splice() pipe, bytes");
+DEFINE_int32(listen_backlog, SERVER_LISTEN_BACKLOG_SIZE, "Listen queue length");
+DEFINE_uint32(expect_connections, SERVER_EXPECT_CONNECTIONS, "Connections number the tables are reserved for");
+DEFINE_uint32(accept_batch, ACCEPT_BATCH_SIZE, "Connections accepted per listener wakeup");
+DEFINE_uint32(admission_fd_reserve, ADMISSION_FD_RESERVE, "File descriptors kept free below the open files limit; "
+                                                          "0 - no admission control");
+DEFINE_string(admission_policy, ADMISSION_SHED, "Connections near the open files limit: shed - reset them at once, "
+                                                "defer - leave them in the listen backlog until a client closes "
+                                                "(simple and custom_thread_pool; the other TCP engines shed)");
+DEFINE_string(socket_profile, SOCKET_PROFILE_LOW_LATENCY, "TCP options of the listeners and the accepted "
+                                                          "connections: none - kernel defaults, low_latency - "
+                                                          "TCP_NODELAY, SO_BUSY_POLL and "
+                                                          "TCP_NOTSENT_LOWAT, throughput - TCP_NODELAY and large "
+                                                          "socket buffers, memory_lean - TCP_NODELAY, "
+                                                          "TCP_NOTSENT_LOWAT and small socket buffers");
+DEFINE_uint32(blocking_pool_size, BLOCKING_POOL_SIZE, "Most handler threads of simple_threaded, one per connection; "
+                                                      "the connections beyond wait for a free one");
+DEFINE_uint32(blocking_pool_prespawn, BLOCKING_POOL_PRESPAWN, "simple_threaded handler threads started with "
+                                                              "the server, at least one; the rest start on demand");
+DEFINE_uint32(thread_stack_size, THREAD_STACK_SIZE, "Stack size of a simple_threaded handler thread, bytes");
+DEFINE_uint32(idle_timeout_ms, IDLE_TIMEOUT_MS, "A connection without requests is closed after this time, ms; "
+                                                "0 - never");
+DEFINE_uint32(write_timeout_ms, WRITE_TIMEOUT_MS, "A connection whose peer does not read its echo is closed after "
+                                                  "this time, ms; 0 - never");
+DEFINE_uint32(work_queue_size, WORK_QUEUE_SIZE, "Job queue capacity of the custom thread pool and its "
+                                                "connections limit; at least --expect_connections, rounded up to a "
+                                                "power of 2");
+DEFINE_uint32(epoll_max_events, EPOLL_MAX_EVENTS, "Events taken by one epoll_wait call");
+DEFINE_uint32(uring_queue_depth, URING_QUEUE_DEPTH, "io_uring submission queue entries; a power of 2");
+DEFINE_uint32(uring_buf_ring_entries, URING_BUF_RING_ENTRIES, "io_uring provided buffers; a power of 2");
+DEFINE_uint32(stage_stats_dump_period_s, 0, "Period of the stage latency dump to a file; 0 - on SIGUSR1 only");
+DEFINE_bool(pin_threads, true, "Pin the threads of the multithreaded servers to CPUs, interleaved over NUMA nodes");
+DEFINE_string(cpu_set, "", "CPUs for the pinned threads in the cpulist format, e.g. 0-7,16-23; "
+                           "empty - every CPU the process may run on");
+DEFINE_bool(incoming_cpu, true, "Steer a connection to the listener of the CPU receiving its packets "
+                                "(SO_INCOMING_CPU); needs pin_threads");
+DEFINE_bool(asio_context_per_thread, true, "boost_asio_threaded: every thread runs its own io_context and keeps "
+                                           "its connections for life; false - all threads share one io_context");
+DEFINE_string(asio_dispatch, ASIO_DISPATCH_LEAST_LOADED, "boost_asio_threaded: how accepted connections are "
+                                                         "spread over the per-thread io_contexts: round_robin or "
+                                                         "least_loaded");
+DEFINE_uint32(udp_batch_size, UDP_BATCH_SIZE, "udp: datagrams received by one recvmmsg and echoed by one sendmmsg");
+DEFINE_bool(udp_gro, false, "udp: receive coalesced datagrams (UDP_GRO) and echo them with one segmented send "
+                            "(UDP_SEGMENT)");
+DEFINE_bool(udp_reuseport, true, "udp: every thread owns a SO_REUSEPORT socket; false - all threads read one socket");
+DEFINE_bool(async_log, true, "Data path records (ALOG) go through per-thread rings and a flush thread; "
+                             "false - they are written to glog synchronously");
+DEFINE_uint32(async_log_ring_size, ASYNC_LOG_RING_SIZE, "Records a thread may queue before the next ones "
+                                                        "are dropped; a power of 2");
+DEFINE_uint32(async_log_memory_size, ASYNC_LOG_MEMORY_SIZE, "Memory of the rings of all threads; the threads "
+                                                            "logging once it is taken log synchronously, bytes");
+DEFINE_uint32(async_log_flush_ms, ASYNC_LOG_FLUSH_PERIOD_MS, "Period of the async log flush, ms");
+
+static bool validate_port(const char *flag_name, uint32_t value) {
+    return value > 0 && value <= PORT_MAX;
+}
+
+static bool validate_threads(const char *flag_name, uint32_t value) {
+    return value <= THREADS_MAX;
+}
+
+static bool validate_size(const char *flag_name, uint32_t value) {
+    return value > 0 && value <= MESSAGE_SIZE_MAX;
+}
+
+static bool validate_positive(const char *flag_name, uint32_t value) {
+    return value > 0;
+}
+
+static bool validate_backlog(const char *flag_name, int32_t value) {
+    return value > 0;
+}
+
+static bool validate_uring_entries(const char *flag_name, uint32_t value) {
+    return value > 0 && value <= URING_ENTRIES_MAX && 0 == (value & (value - 1));
+}
+
+static bool validate_async_log_ring_size(const char *flag_name, uint32_t value) {
+    return value > 0 && value <= ASYNC_LOG_RING_SIZE_MAX && 0 == (value & (value - 1));
+}
+
+static bool validate_udp_batch_size(const char *flag_name, uint32_t value) {
+    return value > 0 && value <= UDP_BATCH_SIZE_MAX;
+}
+
+// pthread_attr_setstacksize rejects a stack below PTHREAD_STACK_MIN, which is not a constant on every target
+static bool validate_thread_stack_size(const char *flag_name, uint32_t value) {
+    return value >= std::max<uint64_t>(THREAD_STACK_SIZE_MIN, PTHREAD_STACK_MIN);
+}
+
+static bool validate_admission_policy(const char *flag_name, const std::string &value) {
+    return ADMISSION_SHED == value || ADMISSION_DEFER == value;
+}
+
+static bool validate_socket_profile(const char *flag_name, const std::string &value) {
+    return SOCKET_PROFILE_NONE == value || SOCKET_PROFILE_LOW_LATENCY == value ||
+           SOCKET_PROFILE_THROUGHPUT == value || SOCKET_PROFILE_MEMORY_LEAN == value;
+}
+
+static bool validate_asio_dispatch(const char *flag_name, const std::string &value) {
+    return ASIO_DISPATCH_ROUND_ROBIN == value || ASIO_DISPATCH_LEAST_LOADED == value;
+}
+
+DEFINE_validator(port, &validate_port);
+DEFINE_validator(threads, &validate_threads);
+DEFINE_validator(message_size, &validate_size);
+DEFINE_validator(stream_buffer_max_size, &validate_size);
+DEFINE_validator(splice_pipe_size, &validate_positive);
+DEFINE_validator(listen_backlog, &validate_backlog);
+DEFINE_validator(expect_connections, &validate_positive);
+DEFINE_validator(accept_batch, &validate_positive);
+DEFINE_validator(admission_policy, &validate_admission_policy);
+DEFINE_validator(socket_profile, &validate_socket_profile);
+DEFINE_validator(blocking_pool_size, &validate_positive);
+DEFINE_validator(thread_stack_size, &validate_thread_stack_size);
+DEFINE_validator(work_queue_size, &validate_positive);
+DEFINE_validator(epoll_max_events, &validate_positive);
+DEFINE_validator(uring_queue_depth, &validate_uring_entries);
+DEFINE_validator(uring_buf_ring_entries, &validate_uring_entries);
+DEFINE_validator(asio_dispatch, &validate_asio_dispatch);
+DEFINE_validator(udp_batch_size, &validate_udp_batch_size);
+DEFINE_validator(async_log_ring_size, &validate_async_log_ring_size);
+DEFINE_validator(async_log_memory_size, &validate_positive);
+DEFINE_validator(async_log_flush_ms, &validate_positive);
+
+int config_init() {
+    std::stringstream s{};
+    uint64_t page_size = sysconf(_SC_PAGESIZE);
+    uint64_t stack_size;
+
+    if (0 == FLAGS_threads) {
+        FLAGS_threads = std::max(1U, std::thread::hardware_concurrency());
+    }
+    // a stack size which is not a page multiple is rejected on some targets, round it up
+    stack_size = (FLAGS_thread_stack_size + page_size - 1) / page_size * page_size;
+    FLAGS_thread_stack_size = stack_size > UINT32_MAX ? stack_size - page_size : stack_size;
+    if (FLAGS_stream_buffer_max_size < FLAGS_message_size) {
+        LOG(ERROR) << "Error stream_buffer_max_size " << FLAGS_stream_buffer_max_size
+                   << " is less than message_size " << FLAGS_message_size;
+        return STATUS_FAIL;
+    }
+
+    s << "Configuration:"
+      << "\n  port " << FLAGS_port
+      << "\n  threads " << FLAGS_threads
+      << "\n  message_size " << FLAGS_message_size
+      << "\n  stream_buffer_max_size " << FLAGS_stream_buffer_max_size
+      << "\n  splice_echo " << std::boolalpha << FLAGS_splice_echo
+      << "\n  splice_threshold " << FLAGS_splice_threshold
+      << "\n  splice_pipe_size " << FLAGS_splice_pipe_size
+      << "\n  listen_backlog " << FLAGS_listen_backlog
+      << "\n  expect_connections " << FLAGS_expect_connections
+      << "\n  accept_batch " << FLAGS_accept_batch
+      << "\n  admission_fd_reserve " << FLAGS_admission_fd_reserve
+      << "\n  admission_policy " << FLAGS_admission_policy
+      << "\n  socket_profile " << FLAGS_socket_profile
+      << "\n  blocking_pool_size " << FLAGS_blocking_pool_size
+      << "\n  blocking_pool_prespawn " << FLAGS_blocking_pool_prespawn
+      << "\n  thread_stack_size " << FLAGS_thread_stack_size
+      << "\n  idle_timeout_ms " << FLAGS_idle_timeout_ms
+      << "\n  write_timeout_ms " << FLAGS_write_timeout_ms
+      << "\n  work_queue_size " << FLAGS_work_queue_size
+      << "\n  epoll_max_events " << FLAGS_epoll_max_events
+      << "\n  uring_queue_depth " << FLAGS_uring_queue_depth
+      << "\n  uring_buf_ring_entries " << FLAGS_uring_buf_ring_entries
+      << "\n  stage_stats_dump_period_s " << FLAGS_stage_stats_dump_period_s
+      << "\n  pin_threads " << FLAGS_pin_threads
+      << "\n  cpu_set " << (FLAGS_cpu_set.empty() ? "all" : FLAGS_cpu_set)
+      << "\n  incoming_cpu " << FLAGS_incoming_cpu
+      << "\n  asio_context_per_thread " << FLAGS_asio_context_per_thread
+      << "\n  asio_dispatch " << FLAGS_asio_dispatch
+      << "\n  udp_batch_size " << FLAGS_udp_batch_size
+      << "\n  udp_gro " << FLAGS_udp_gro
+      << "\n  udp_reuseport " << FLAGS_udp_reuseport
+      << "\n  async_log " << FLAGS_async_log
+      << "\n  async_log_ring_size " << FLAGS_async_log_ring_size
+      << "\n  async_log_memory_size " << FLAGS_async_log_memory_size
+      << "\n  async_log_flush_ms " << FLAGS_async_log_flush_ms;
+    LOG(INFO) << s.str();
+    return STATUS_SUCCESS;
+}
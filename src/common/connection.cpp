@@ -0,0 +1,55 @@
+#include "common/connection.h"
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <charconv>
+
+#include "common/defines.h"
+#include "common/logging.h"
+#include "common/timing_wheel.h"
+
+#define FOOTPRINT_CONNECTIONS           (1000000)
+
+
+peer_addr peer_addr_from(const struct sockaddr_in &addr) {
+    if (AF_INET != addr.sin_family) {
+        return peer_addr{};
+    }
+    return peer_addr{addr.sin_addr.s_addr, addr.sin_port};
+}
+
+peer_addr socket_get_peer(int fd) {
+    struct sockaddr_in addr{};
+    socklen_t addr_len = sizeof(addr);
+
+    if (STATUS_SUCCESS != getpeername(fd, reinterpret_cast<struct sockaddr *>(&addr), &addr_len)) {
+        return peer_addr{};
+    }
+    return peer_addr_from(addr);
+}
+
+char *peer_addr_format(const peer_addr &peer, char *buffer) {
+    char *end = buffer + PEER_ADDR_MAX_STR_SIZE;
+    const auto *octets = reinterpret_cast<const uint8_t *>(&peer.ip);
+
+    for (size_t i = 0; i < sizeof(peer.ip); ++i) {
+        buffer = std::to_chars(buffer, end, octets[i]).ptr;
+        *buffer++ = sizeof(peer.ip) - 1 == i ? ':' : '.';
+    }
+    return std::to_chars(buffer, end, ntohs(peer.port)).ptr;
+}
+
+std::ostream &operator<<(std::ostream &stream, const peer_addr &peer) {
+    char buffer[PEER_ADDR_MAX_STR_SIZE];
+
+    return stream.write(buffer, peer_addr_format(peer, buffer) - buffer);
+}
+
+void log_connection_footprint(size_t record_size, size_t buffer_size, bool timed) {
+    size_t timer_size = timed ? timing_wheel::node_size : 0;
+    size_t total_size = record_size + timer_size + buffer_size;
+
+    LOG(INFO) << "Idle connection footprint: " << record_size << " B record + " << timer_size << " B timer + "
+              << buffer_size << " B buffers = " << total_size << " B; " << FOOTPRINT_CONNECTIONS
+              << " idle connections take " << total_size * FOOTPRINT_CONNECTIONS / (1024 * 1024)
+              << " MiB of user memory plus the kernel socket memory";
+}
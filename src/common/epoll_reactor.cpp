@@ -0,0 +1,272 @@
+#include "common/epoll_reactor.h"
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <cerrno>
+
+#include "common/defines.h"
+#include "common/socket.h"
+#include "common/logging.h"
+#include "common/stage_stats.h"
+#include "common/config.h"
+
+#define INFTIM                          (-1)
+#define CLIENT_EVENTS                   (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET)
+// epoll data of the listener; no client slot key packs to it
+#define LISTENER_EVENT_DATA             (UINT64_MAX)
+
+static uint64_t pack_key(slot_key key) {
+    return static_cast<uint64_t>(key.generation) << 32 | key.index;
+}
+
+static slot_key unpack_key(uint64_t data) {
+    return slot_key{static_cast<uint32_t>(data), static_cast<uint32_t>(data >> 32)};
+}
+
+
+epoll_reactor::~epoll_reactor() {
+    for (uint32_t index = 0; index < client_db.get_slot_count(); ++index) {
+        if (client_db.is_alive(index)) {
+            close_client(client_db.get_key(index));
+        }
+    }
+    if (-1 != epoll_fd) {
+        close(epoll_fd);
+    }
+}
+
+int epoll_reactor::init(int listener_fd, size_t expect_connections) {
+    epoll_event event{};
+
+    server_fd = listener_fd;
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        PLOG(ERROR) << "Error calling epoll_create1";
+        return STATUS_FAIL;
+    }
+
+    event.events = EPOLLIN | EPOLLET;
+    event.data.u64 = LISTENER_EVENT_DATA;
+    if (STATUS_SUCCESS != epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &event)) {
+        PLOG(ERROR) << "Error calling epoll_ctl";
+        return STATUS_FAIL;
+    }
+
+    events.resize(FLAGS_epoll_max_events);
+    client_db.reserve(expect_connections);
+    return STATUS_SUCCESS;
+}
+
+int epoll_reactor::run(const std::atomic_bool &running_flag) {
+    int trig_fds_count;
+
+    while (running_flag) {
+        trig_fds_count = epoll_wait(epoll_fd, events.data(), static_cast<int>(events.size()), get_wait_timeout());
+        now_ms = timing_wheel_now_ms();
+        if (trig_fds_count < 0) {
+            if (EINTR == errno) {
+                continue; // while (running_flag)
+            }
+            if (running_flag) {
+                PLOG(ERROR) << "Error calling epoll_wait";
+                return STATUS_FAIL;
+            }
+            // user stop signal issued
+            break; // while (running_flag)
+        }
+
+        // Only ready fds are reported, so the cost does not depend on the connections number
+        for (int index = 0; index < trig_fds_count; ++index) {
+            const epoll_event &event = events[index];
+
+            // Server socket fd event
+            if (LISTENER_EVENT_DATA == event.data.u64) {
+                // Error handling; a stopped server shuts its listeners down
+                if (event.events & (EPOLLERR | EPOLLHUP)) {
+                    if (running_flag) {
+                        LOG(ERROR) << "Error server socket fail";
+                        return STATUS_FAIL;
+                    }
+                    DLOG(INFO) << "Server socket closed";
+                    return STATUS_SUCCESS;
+                }
+                if (STATUS_SUCCESS != connect_clients(running_flag)) {
+                    return running_flag ? STATUS_FAIL : STATUS_SUCCESS;
+                }
+                continue; // for
+            }
+
+            handle_client(unpack_key(event.data.u64), event.events);
+        } // for (int index = 0; index < trig_fds_count; ++index)
+
+        reap_clients();
+
+        if (accept_deferred && now_ms >= accept_retry_ms) {
+            accept_deferred = false;
+            if (STATUS_SUCCESS != rearm_listener()) {
+                return running_flag ? STATUS_FAIL : STATUS_SUCCESS;
+            }
+        }
+    } // while (running_flag)
+    return STATUS_SUCCESS;
+}
+
+void epoll_reactor::log_footprint() {
+    // an idle client keeps its stream buffer, shrunk back to --message_size; a freed slot adds its free list entry
+    log_connection_footprint(slot_map<client_data>::slot_size + sizeof(uint32_t), FLAGS_message_size,
+                             connection_timeouts_enabled());
+}
+
+int epoll_reactor::get_wait_timeout() {
+    uint64_t now = timing_wheel_now_ms();
+    int timeout_ms = timers.next_timeout_ms(now);
+    int retry_ms;
+
+    if (accept_deferred) {
+        retry_ms = accept_retry_ms > now ? static_cast<int>(accept_retry_ms - now) : 0;
+        if (-1 == timeout_ms || retry_ms < timeout_ms) {
+            timeout_ms = retry_ms;
+        }
+    }
+    return -1 == timeout_ms ? INFTIM : timeout_ms;
+}
+
+int epoll_reactor::connect_clients(const std::atomic_bool &running_flag) {
+    struct sockaddr_in client_addr{};
+    socklen_t client_addr_len;
+    int client_sock_fd;
+    slot_key key;
+    epoll_event event{};
+
+    // edge-triggered listener: accept until EAGAIN, but at most a batch, so the clients are not starved
+    for (uint32_t budget = FLAGS_accept_batch; budget > 0; --budget) {
+        client_sock_fd = socket_accept(server_fd, SOCK_NONBLOCK | SOCK_CLOEXEC, &client_addr, &client_addr_len);
+        if (client_sock_fd < 0) {
+            if (EAGAIN == errno || EWOULDBLOCK == errno) {
+                return STATUS_SUCCESS;
+            } else if (EMFILE == errno || ENFILE == errno) {
+                // re-armed now the listener would report the same backlog at once
+                ALOG(WARNING) << "Out of file descriptors, the new connections wait for a client to close";
+                accept_deferred = true;
+                accept_retry_ms = now_ms + ACCEPT_RETRY_MS;
+                stats.defer_count.fetch_add(1, std::memory_order_relaxed);
+                return STATUS_SUCCESS;
+            }
+            if (running_flag) {
+                PLOG(ERROR) << "Error calling accept4()";
+            }
+            return STATUS_FAIL;
+        }
+        // the fd limit is process wide, so every reactor sheds by the same reserve
+        if (socket_admission_near_limit(client_sock_fd)) {
+            socket_shed(client_sock_fd);
+            stats.shed_count.fetch_add(1, std::memory_order_relaxed);
+            continue; // for
+        }
+
+        // a freed slot is reused first, so the table grows only with the peak connections number of the reactor
+        key = client_db.insert();
+        event.events = CLIENT_EVENTS;
+        event.data.u64 = pack_key(key);
+        if (STATUS_SUCCESS != epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_sock_fd, &event)) {
+            APLOG(ERROR) << "Error calling epoll_ctl";
+            close(client_sock_fd);
+            client_db.erase(key);
+            continue; // for
+        }
+
+        client_data &client = client_db[key.index];
+        client.fd = client_sock_fd;
+        client.peer = peer_addr_from(client_addr);
+        client.accept_time_ns = stage_stats_now();
+        if (connection_timeouts_enabled()) {
+            client.timer = timers.add(connection_deadline_ms(now_ms, false), key.index);
+        }
+        stats.accept_count.fetch_add(1, std::memory_order_relaxed);
+        DLOG(INFO) << "New connection from " << client.peer;
+    }
+
+    // the batch is spent: the rest of the backlog is taken in the next round
+    return rearm_listener();
+}
+
+int epoll_reactor::rearm_listener() {
+    epoll_event event{};
+
+    event.events = EPOLLIN | EPOLLET;
+    event.data.u64 = LISTENER_EVENT_DATA;
+    if (STATUS_SUCCESS != epoll_ctl(epoll_fd, EPOLL_CTL_MOD, server_fd, &event)) {
+        PLOG(ERROR) << "Error calling epoll_ctl";
+        return STATUS_FAIL;
+    }
+    return STATUS_SUCCESS;
+}
+
+void epoll_reactor::close_client(slot_key key) {
+    client_data &client = client_db[key.index];
+
+    // Disconnect; closing the fd also removes it from the epoll set
+    close(client.fd);
+    DLOG(INFO) << "Connection closed for " << client.peer;
+    client.fd = -1;
+    stream_buffer_release(client.stream);
+    if (TIMER_ID_NONE != client.timer) {
+        timers.cancel(client.timer);
+        client.timer = TIMER_ID_NONE;
+    }
+    client_db.erase(key);
+    // the freed fd takes a pending connection
+    if (accept_deferred) {
+        accept_retry_ms = now_ms;
+    }
+}
+
+void epoll_reactor::handle_client(slot_key key, uint32_t client_events) {
+    int io_status;
+    client_data *client = client_db.get(key);
+
+    // Stale event of a client closed earlier in the same epoll_wait batch, even if its slot is reused
+    if (nullptr == client) {
+        return;
+    }
+
+    // Error handling
+    if (client_events & (EPOLLERR | EPOLLHUP)) {
+        close_client(key);
+        return;
+    }
+
+    if (0 != client->accept_time_ns && (client_events & EPOLLIN)) {
+        stage_stats_record(STAGE_ACCEPT_TO_FIRST_READ, client->accept_time_ns);
+        client->accept_time_ns = 0;
+    }
+
+    // Edge-triggered: echo until the socket would block; a congested output is resumed on EPOLLOUT
+    io_status = echo_stream(client->fd, client->stream);
+    if (STATUS_FAIL == io_status) {
+        ALOG(WARNING) << "Error failed to echo to " << client->peer;
+        close_client(key);
+    } else if (STATUS_EOF == io_status) {
+        close_client(key);
+    } else if (TIMER_ID_NONE != client->timer) {
+        // a later deadline is only stored, so the echo does not touch the wheel lists
+        timers.update(client->timer, connection_deadline_ms(now_ms, STATUS_AGAIN == io_status));
+    }
+}
+
+void epoll_reactor::reap_clients() {
+    uint64_t index;
+    size_t reap_count = 0;
+
+    if (0 == timers.advance(now_ms)) {
+        return;
+    }
+    while (timers.pop_expired(index)) {
+        // the timer id is already free
+        client_db[index].timer = TIMER_ID_NONE;
+        DLOG(INFO) << "Connection timed out for " << client_db[index].peer;
+        close_client(client_db.get_key(static_cast<uint32_t>(index)));
+        reap_count++;
+    }
+    stats.reap_count.fetch_add(reap_count, std::memory_order_relaxed);
+}
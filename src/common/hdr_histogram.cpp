@@ -0,0 +1,90 @@
+#include "common/hdr_histogram.h"
+#include <algorithm>
+#include <cmath>
+
+
+hdr_histogram::hdr_histogram() : counts(HDR_HISTOGRAM_BUCKET_COUNT, 0) {}
+
+size_t hdr_histogram::get_bucket_index(uint64_t value) {
+    if (value < HDR_HISTOGRAM_SUB_BUCKET_COUNT) {
+        return value;
+    }
+    // drop the bits below the significant ones; the top bit of the rest is always set
+    int shift = 63 - __builtin_clzll(value) - HDR_HISTOGRAM_SUB_BUCKET_BITS + 1;
+    return shift * HDR_HISTOGRAM_HALF_COUNT + (value >> shift);
+}
+
+uint64_t hdr_histogram::get_bucket_value(size_t index) {
+    if (index < HDR_HISTOGRAM_SUB_BUCKET_COUNT) {
+        return index;
+    }
+    size_t shift = index / HDR_HISTOGRAM_HALF_COUNT - 1;
+    uint64_t significand = index - shift * HDR_HISTOGRAM_HALF_COUNT;
+    return ((significand + 1) << shift) - 1;
+}
+
+void hdr_histogram::record(uint64_t value) {
+    record(value, 1);
+}
+
+void hdr_histogram::record(uint64_t value, uint64_t count) {
+    if (0 == count) {
+        return;
+    }
+    counts[get_bucket_index(value)] += count;
+    total_count += count;
+    min_value = std::min(min_value, value);
+    max_value = std::max(max_value, value);
+    sum += static_cast<double>(value) * static_cast<double>(count);
+}
+
+void hdr_histogram::merge(const hdr_histogram &h) {
+    for (size_t i = 0; i < counts.size(); ++i) {
+        counts[i] += h.counts[i];
+    }
+    total_count += h.total_count;
+    min_value = std::min(min_value, h.min_value);
+    max_value = std::max(max_value, h.max_value);
+    sum += h.sum;
+}
+
+void hdr_histogram::reset() {
+    std::fill(counts.begin(), counts.end(), 0);
+    total_count = 0;
+    min_value = UINT64_MAX;
+    max_value = 0;
+    sum = 0;
+}
+
+uint64_t hdr_histogram::get_percentile(double percent) const {
+    uint64_t cumulative_count = 0;
+
+    if (0 == total_count) {
+        return 0;
+    }
+    auto target_count = static_cast<uint64_t>(std::ceil(percent / 100 * static_cast<double>(total_count)));
+    target_count = std::clamp<uint64_t>(target_count, 1, total_count);
+    for (size_t i = 0; i < counts.size(); ++i) {
+        cumulative_count += counts[i];
+        if (cumulative_count >= target_count) {
+            return std::min(get_bucket_value(i), max_value);
+        }
+    }
+    return max_value;
+}
+
+uint64_t hdr_histogram::get_count() const {
+    return total_count;
+}
+
+uint64_t hdr_histogram::get_min() const {
+    return 0 == total_count ? 0 : min_value;
+}
+
+uint64_t hdr_histogram::get_max() const {
+    return max_value;
+}
+
+double hdr_histogram::get_mean() const {
+    return 0 == total_count ? 0 : sum / static_cast<double>(total_count);
+}
@@ -1,22 +1,11 @@
 #include "common/io.h"
-#include <arpa/inet.h>
 #include <unistd.h>
-#include <sstream>
+#include <fcntl.h>
+#include <algorithm>
 
 #include "common/defines.h"
-
-std::string get_socket_addr_str(const struct sockaddr_in *cl_addr, socklen_t cl_addr_len) {
-    char user_ip_str[IP_MAX_STR_SIZE];
-    std::stringstream user_addr_s{};
-
-    if (cl_addr->sin_family == AF_INET) {
-        inet_ntop(AF_INET, &cl_addr->sin_addr, user_ip_str, cl_addr_len);
-    } else {
-        return "Unknown AF";
-    }
-    user_addr_s << user_ip_str << ':' << ntohs(cl_addr->sin_port);
-    return user_addr_s.str();
-}
+#include "common/stage_stats.h"
+#include "common/config.h"
 
 // size param should include place for terminating '\0' character
 ssize_t read_buffer(int fd, char *buffer, ssize_t size) {
@@ -29,12 +18,14 @@ ssize_t read_buffer(int fd, char *buffer, ssize_t size) {
         return STATUS_FAIL;
     }
 
+    uint64_t start_ns = stage_stats_now();
     do {
         read_bytes = read(fd, static_cast<void *>(buffer), size);
         if (STATUS_FAIL == read_bytes && EINTR != errno) {
             return STATUS_FAIL;
         }
     } while (STATUS_FAIL == read_bytes);
+    stage_stats_record(STAGE_READ, start_ns);
 
     if (read_bytes >= 0) {
         buffer[read_bytes] = '\0';
@@ -47,6 +38,7 @@ ssize_t read_buffer(int fd, char *buffer, ssize_t size) {
 ssize_t write_buffer(int fd, const char *buffer, ssize_t size) {
     ssize_t written_bytes = 0;
     ssize_t written_now;
+    uint64_t start_ns = stage_stats_now();
 
     while (written_bytes < size) {
         written_now = write(fd, buffer + written_bytes, size - written_bytes);
@@ -59,21 +51,22 @@ ssize_t write_buffer(int fd, const char *buffer, ssize_t size) {
         } else
             written_bytes += written_now;
     }
+    stage_stats_record(STAGE_WRITE, start_ns);
     return written_bytes;
 }
 
 int read_msg(int fd, std::string &s) {
-    char buffer[EXPECTED_MESSAGE_SIZE + 1];
     ssize_t read_bytes;
 
-    s.reserve(EXPECTED_MESSAGE_SIZE);
-
-    read_bytes = read_buffer(fd, buffer, EXPECTED_MESSAGE_SIZE + 1);
+    // read straight into the string; the extra byte takes the terminating '\0'
+    s.resize(FLAGS_message_size + 1);
+    read_bytes = read_buffer(fd, s.data(), static_cast<ssize_t>(s.size()));
     if (read_bytes < 0) {
+        s.clear();
         return STATUS_FAIL;
     }
 
-    s.assign(buffer, read_bytes);
+    s.resize(read_bytes);
     return STATUS_SUCCESS;
 }
 
@@ -89,4 +82,190 @@ int write_msg(int fd, const std::string &s) {
     } else {
         return STATUS_SUCCESS;
     }
-}
\ No newline at end of file
+}
+
+int read_msg(int fd, pooled_buffer &buffer) {
+    ssize_t read_bytes = read_buffer(fd, buffer.data(), pooled_buffer::capacity());
+    if (read_bytes < 0) {
+        return STATUS_FAIL;
+    }
+    buffer.set_size(read_bytes);
+    return STATUS_SUCCESS;
+}
+
+int write_msg(int fd, const pooled_buffer &buffer) {
+    if (STATUS_FAIL == write_buffer(fd, buffer.data(), buffer.size())) {
+        return STATUS_FAIL;
+    } else {
+        return STATUS_SUCCESS;
+    }
+}
+
+ssize_t write_buffer_nonblock(int fd, const char *buffer, ssize_t size) {
+    ssize_t written_bytes = 0;
+    ssize_t written_now;
+    uint64_t start_ns = stage_stats_now();
+
+    while (written_bytes < size) {
+        written_now = write(fd, buffer + written_bytes, size - written_bytes);
+        if (STATUS_FAIL == written_now) {
+            if (EINTR == errno)
+                continue;
+            else if (EAGAIN == errno || EWOULDBLOCK == errno)
+                break;
+            else {
+                return STATUS_FAIL;
+            }
+        } else
+            written_bytes += written_now;
+    }
+    stage_stats_record(STAGE_WRITE, start_ns);
+    return written_bytes;
+}
+
+static void stream_buffer_resize(stream_buffer &buffer, uint32_t capacity) {
+    buffer.data.reset(new char[capacity]);
+    buffer.capacity = capacity;
+}
+
+// call only for an empty buffer
+static void stream_buffer_adapt(stream_buffer &buffer) {
+    if (0 == buffer.capacity) {
+        stream_buffer_resize(buffer, FLAGS_message_size);
+    } else if (buffer.last_read == buffer.capacity && buffer.capacity < FLAGS_stream_buffer_max_size) {
+        stream_buffer_resize(buffer, std::min<uint64_t>(buffer.capacity * 2ULL, FLAGS_stream_buffer_max_size));
+    } else if (buffer.last_read < buffer.capacity / 4 && buffer.capacity > FLAGS_message_size) {
+        stream_buffer_resize(buffer, std::max<uint32_t>(buffer.capacity / 2, FLAGS_message_size));
+    }
+}
+
+int echo_stream(int fd, stream_buffer &buffer) {
+    ssize_t io_bytes;
+    uint64_t start_ns;
+
+    while (true) {
+        // Resume the pending write first
+        if (buffer.begin < buffer.end) {
+            io_bytes = write_buffer_nonblock(fd, buffer.data.get() + buffer.begin,
+                                             static_cast<ssize_t>(buffer.end - buffer.begin));
+            if (STATUS_FAIL == io_bytes) {
+                return STATUS_FAIL;
+            }
+            buffer.begin += static_cast<uint32_t>(io_bytes);
+            if (buffer.begin < buffer.end) {
+                return STATUS_AGAIN;
+            }
+        }
+        buffer.begin = buffer.end = 0;
+        stream_buffer_adapt(buffer);
+
+        start_ns = stage_stats_now();
+        do {
+            io_bytes = read(fd, buffer.data.get(), buffer.capacity);
+        } while (STATUS_FAIL == io_bytes && EINTR == errno);
+        stage_stats_record(STAGE_READ, start_ns);
+        if (STATUS_FAIL == io_bytes) {
+            return EAGAIN == errno || EWOULDBLOCK == errno ? STATUS_SUCCESS : STATUS_FAIL;
+        }
+        if (0 == io_bytes) {
+            return STATUS_EOF;
+        }
+        buffer.end = static_cast<uint32_t>(io_bytes);
+        buffer.last_read = buffer.end;
+    }
+}
+
+int read_msg(int fd, stream_buffer &buffer) {
+    ssize_t read_bytes;
+
+    buffer.begin = buffer.end = 0;
+    stream_buffer_adapt(buffer);
+
+    uint64_t start_ns = stage_stats_now();
+    do {
+        read_bytes = read(fd, buffer.data.get(), buffer.capacity);
+    } while (STATUS_FAIL == read_bytes && EINTR == errno);
+    stage_stats_record(STAGE_READ, start_ns);
+    if (STATUS_FAIL == read_bytes) {
+        return STATUS_FAIL;
+    }
+    buffer.end = static_cast<uint32_t>(read_bytes);
+    buffer.last_read = buffer.end;
+    return STATUS_SUCCESS;
+}
+
+int write_msg(int fd, const stream_buffer &buffer) {
+    if (STATUS_FAIL == write_buffer(fd, buffer.data.get() + buffer.begin,
+                                    static_cast<ssize_t>(buffer.end - buffer.begin))) {
+        return STATUS_FAIL;
+    } else {
+        return STATUS_SUCCESS;
+    }
+}
+
+void stream_buffer_release(stream_buffer &buffer) {
+    buffer.data.reset();
+    buffer.capacity = buffer.begin = buffer.end = buffer.last_read = 0;
+}
+
+static int splice_pipe_init(splice_pipe &pipe) {
+    int pipe_fds[2];
+
+    if (STATUS_SUCCESS != pipe2(pipe_fds, O_CLOEXEC)) {
+        return STATUS_FAIL;
+    }
+    pipe.read_fd = pipe_fds[0];
+    pipe.write_fd = pipe_fds[1];
+    // a bigger pipe moves a bulk message in fewer splice() rounds; the default size still works
+    fcntl(pipe.write_fd, F_SETPIPE_SZ, FLAGS_splice_pipe_size);
+    return STATUS_SUCCESS;
+}
+
+int echo_splice(int fd, splice_pipe &pipe, size_t size) {
+    ssize_t piped_bytes;
+    ssize_t spliced_now;
+    uint64_t start_ns;
+
+    if (-1 == pipe.read_fd && STATUS_SUCCESS != splice_pipe_init(pipe)) {
+        return STATUS_FAIL;
+    }
+
+    while (size > 0) {
+        // socket -> pipe: takes at most the pipe capacity
+        start_ns = stage_stats_now();
+        do {
+            piped_bytes = splice(fd, nullptr, pipe.write_fd, nullptr, size, SPLICE_F_MOVE);
+        } while (STATUS_FAIL == piped_bytes && EINTR == errno);
+        stage_stats_record(STAGE_READ, start_ns);
+        if (STATUS_FAIL == piped_bytes) {
+            return STATUS_FAIL;
+        }
+        if (0 == piped_bytes) {
+            return STATUS_EOF;
+        }
+        size -= piped_bytes;
+
+        // pipe -> socket: the pipe is drained before the next round
+        start_ns = stage_stats_now();
+        while (piped_bytes > 0) {
+            spliced_now = splice(pipe.read_fd, nullptr, fd, nullptr, piped_bytes,
+                                 SPLICE_F_MOVE | (size > 0 ? SPLICE_F_MORE : 0));
+            if (STATUS_FAIL == spliced_now) {
+                if (EINTR == errno)
+                    continue;
+                return STATUS_FAIL;
+            }
+            piped_bytes -= spliced_now;
+        }
+        stage_stats_record(STAGE_WRITE, start_ns);
+    }
+    return STATUS_SUCCESS;
+}
+
+void splice_pipe_release(splice_pipe &pipe) {
+    if (-1 != pipe.read_fd) {
+        close(pipe.read_fd);
+        close(pipe.write_fd);
+    }
+    pipe.read_fd = pipe.write_fd = -1;
+}
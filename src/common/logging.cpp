@@ -14,9 +14,11 @@ void logging_init(int *argc, char **argv[]) {
     FLAGS_log_dir = log_path.string();
     LOG(INFO) << "Logging directory: " << log_path;
     google::ParseCommandLineFlags(argc, argv, false);
+    async_log_init();
 }
 
 void logging_deinit() {
+    async_log_deinit();
     google::ShutdownGoogleLogging();
 }
 
@@ -1,24 +1,61 @@
 #include "common/socket.h"
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <iostream>
 #include <unistd.h>
 #include <sys/resource.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <cerrno>
 
 #include "common/defines.h"
 #include "common/logging.h"
+#include "common/config.h"
 
 size_t g_socket_num_limit = 0;
 
+// the TCP options of a --socket_profile; 0 leaves an option at the kernel default
+struct socket_profile {
+    int no_delay = 0;
+    int busy_poll_us = 0;
+    int notsent_lowat = 0;
+    int buffer_size = 0;
+};
 
-int server_socket_init(uint16_t port) {
+static socket_profile get_socket_profile() {
+    if (SOCKET_PROFILE_LOW_LATENCY == FLAGS_socket_profile) {
+        // an echo is sent at once and a blocking read spins briefly before it sleeps; the echo itself carries the
+        // ack of the request, so delayed acks do not add latency and TCP_QUICKACK is not needed
+        return socket_profile{1, SOCKET_BUSY_POLL_US, SOCKET_NOTSENT_LOWAT, 0};
+    } else if (SOCKET_PROFILE_THROUGHPUT == FLAGS_socket_profile) {
+        // a bulk echo does not wait for the buffer autotuning to ramp up
+        return socket_profile{1, 0, 0, SOCKET_THROUGHPUT_BUFFER_SIZE};
+    } else if (SOCKET_PROFILE_MEMORY_LEAN == FLAGS_socket_profile) {
+        // bounds the kernel memory a connection may queue
+        return socket_profile{1, 0, SOCKET_NOTSENT_LOWAT, SOCKET_LEAN_BUFFER_SIZE};
+    }
+    return socket_profile{};
+}
+
+static int socket_set_int_option(int fd, int level, int name, int value, const char *name_str) {
+    if (STATUS_SUCCESS != setsockopt(fd, level, name, static_cast<const void *>(&value), sizeof(value))) {
+        APLOG(ERROR) << "Error setting " << name_str;
+        return STATUS_FAIL;
+    }
+    return STATUS_SUCCESS;
+}
+
+
+// type - SOCK_STREAM for a listener or SOCK_DGRAM for a bound datagram socket
+static int socket_init(uint16_t port, int type, bool reuse_port) {
     int rc;
     int server_sock_fd;
     struct sockaddr_in serv_addr{};
 
     LOG(INFO) << "Initializing...";
 
-    server_sock_fd = socket(AF_INET, SOCK_STREAM, 0);
+    server_sock_fd = socket(AF_INET, type, 0);
     if (server_sock_fd < 0) {
         PLOG(FATAL) << "Error creating listening socket.";
         return STATUS_FAIL;
@@ -30,6 +67,16 @@ int server_socket_init(uint16_t port) {
     /* setsockopt: reuse port for the server; server restart flow */
     int sock_optval = 1;
     setsockopt(server_sock_fd, SOL_SOCKET, SO_REUSEADDR, static_cast<const void *>(&sock_optval), sizeof(sock_optval));
+    /* setsockopt: several listeners on the same port; the kernel balances connections between them */
+    if (reuse_port) {
+        rc = setsockopt(server_sock_fd, SOL_SOCKET, SO_REUSEPORT, static_cast<const void *>(&sock_optval),
+                        sizeof(sock_optval));
+        if (rc < 0) {
+            PLOG(FATAL) << "Error setting SO_REUSEPORT";
+            close(server_sock_fd);
+            return STATUS_FAIL;
+        }
+    }
 
     rc = bind(server_sock_fd, (struct sockaddr *) &serv_addr, sizeof(serv_addr));
     if (rc < 0) {
@@ -38,7 +85,12 @@ int server_socket_init(uint16_t port) {
         return STATUS_FAIL;
     }
 
-    rc = listen(server_sock_fd, SERVER_LISTEN_BACKLOG_SIZE);
+    if (SOCK_STREAM == type && STATUS_SUCCESS != socket_tune_listener(server_sock_fd)) {
+        close(server_sock_fd);
+        return STATUS_FAIL;
+    }
+
+    rc = SOCK_STREAM == type ? listen(server_sock_fd, FLAGS_listen_backlog) : STATUS_SUCCESS;
     if (rc < 0) {
         PLOG(FATAL) << "Error calling listen()";
         close(server_sock_fd);
@@ -49,6 +101,18 @@ int server_socket_init(uint16_t port) {
     return server_sock_fd;
 }
 
+int server_socket_init(uint16_t port) {
+    return socket_init(port, SOCK_STREAM, false);
+}
+
+int server_socket_reuseport_init(uint16_t port) {
+    return socket_init(port, SOCK_STREAM, true);
+}
+
+int server_udp_socket_init(uint16_t port, bool reuse_port) {
+    return socket_init(port, SOCK_DGRAM, reuse_port);
+}
+
 void sock_num_set_max_limit() {
     rlimit limit{};
 
@@ -67,3 +131,98 @@ void sock_num_set_max_limit() {
     g_socket_num_limit = static_cast<size_t>(limit.rlim_cur);
     LOG(INFO) << "Set server max connections num: " << g_socket_num_limit;
 }
+
+
+int socket_set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) {
+        APLOG(ERROR) << "syscall fcntl(F_GETFL) failed";
+        return STATUS_FAIL;
+    }
+    if (STATUS_SUCCESS != fcntl(fd, F_SETFL, flags | O_NONBLOCK)) {
+        APLOG(ERROR) << "syscall fcntl(F_SETFL) failed";
+        return STATUS_FAIL;
+    }
+    return STATUS_SUCCESS;
+}
+
+ssize_t socket_get_pending_size(int fd) {
+    int pending_size;
+    if (STATUS_SUCCESS != ioctl(fd, FIONREAD, &pending_size)) {
+        APLOG(ERROR) << "syscall ioctl(FIONREAD) failed";
+        return STATUS_FAIL;
+    }
+    return pending_size;
+}
+
+int socket_accept(int server_fd, int flags, struct sockaddr_in *addr, socklen_t *addr_len) {
+    int fd;
+
+    do {
+        *addr_len = sizeof(*addr);
+        fd = accept4(server_fd, (struct sockaddr *) addr, addr_len, flags);
+    } while (fd < 0 && (EINTR == errno || ECONNABORTED == errno));
+    return fd;
+}
+
+bool socket_admission_near_limit(int fd) {
+    return 0 != FLAGS_admission_fd_reserve &&
+           static_cast<size_t>(fd) + FLAGS_admission_fd_reserve >= g_socket_num_limit;
+}
+
+bool socket_admission_sheds() {
+    return ADMISSION_SHED == FLAGS_admission_policy;
+}
+
+void socket_shed(int fd) {
+    struct linger linger{1, 0};
+
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, static_cast<const void *>(&linger), sizeof(linger));
+    close(fd);
+}
+
+int socket_set_incoming_cpu(int fd, int cpu) {
+    if (STATUS_SUCCESS != setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, static_cast<const void *>(&cpu), sizeof(cpu))) {
+        PLOG(ERROR) << "Error setting SO_INCOMING_CPU";
+        return STATUS_FAIL;
+    }
+    return STATUS_SUCCESS;
+}
+
+int socket_tune_listener(int fd) {
+    socket_profile profile = get_socket_profile();
+
+    if (0 != profile.no_delay &&
+        STATUS_SUCCESS != socket_set_int_option(fd, IPPROTO_TCP, TCP_NODELAY, profile.no_delay, "TCP_NODELAY")) {
+        return STATUS_FAIL;
+    }
+    if (0 != profile.notsent_lowat &&
+        STATUS_SUCCESS != socket_set_int_option(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, profile.notsent_lowat,
+                                                "TCP_NOTSENT_LOWAT")) {
+        return STATUS_FAIL;
+    }
+    if (0 != profile.buffer_size &&
+        (STATUS_SUCCESS != socket_set_int_option(fd, SOL_SOCKET, SO_RCVBUF, profile.buffer_size, "SO_RCVBUF") ||
+         STATUS_SUCCESS != socket_set_int_option(fd, SOL_SOCKET, SO_SNDBUF, profile.buffer_size, "SO_SNDBUF"))) {
+        return STATUS_FAIL;
+    }
+    // raising it above net.core.busy_read needs CAP_NET_ADMIN; the server runs without busy polling then
+    if (0 != profile.busy_poll_us &&
+        STATUS_SUCCESS != setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, static_cast<const void *>(&profile.busy_poll_us),
+                                     sizeof(profile.busy_poll_us))) {
+        PLOG(WARNING) << "Error setting SO_BUSY_POLL, the reads do not busy poll";
+    }
+    return STATUS_SUCCESS;
+}
+
+int socket_set_timeouts(int fd, uint32_t recv_timeout_ms, uint32_t send_timeout_ms) {
+    struct timeval recv_timeout{recv_timeout_ms / 1000, static_cast<suseconds_t>(recv_timeout_ms % 1000 * 1000)};
+    struct timeval send_timeout{send_timeout_ms / 1000, static_cast<suseconds_t>(send_timeout_ms % 1000 * 1000)};
+
+    if (STATUS_SUCCESS != setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &recv_timeout, sizeof(recv_timeout)) ||
+        STATUS_SUCCESS != setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout))) {
+        APLOG(ERROR) << "Error setting the socket timeouts";
+        return STATUS_FAIL;
+    }
+    return STATUS_SUCCESS;
+}
@@ -0,0 +1,190 @@
+#include "common/stage_stats.h"
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "common/defines.h"
+#include "common/logging.h"
+#include "common/hdr_histogram.h"
+#include "common/config.h"
+
+#define INFTIM                          (-1)
+
+
+namespace {
+    struct stage_stats_shard {
+        std::atomic<uint64_t> counts[STAGE_COUNT][HDR_HISTOGRAM_BUCKET_COUNT];
+    };
+
+    const char *const g_stage_names[STAGE_COUNT] = {
+            "accept_to_first_read",
+            "queue_sojourn",
+            "read",
+            "write",
+    };
+
+    // allocated on the first record of a shard owner; never destroyed, threads may record until they exit
+    std::atomic<stage_stats_shard *> g_shards[STAGE_STATS_MAX_SHARDS]{};
+    std::atomic<size_t> g_thread_count = 0;
+    thread_local stage_stats_shard *t_shard = nullptr;
+
+    std::atomic_bool g_running_flag = false;
+    int g_dump_fd = -1;
+    std::thread g_dump_thread{};
+
+    stage_stats_shard *get_shard() {
+        size_t shard_index = g_thread_count.fetch_add(1, std::memory_order_relaxed) % STAGE_STATS_MAX_SHARDS;
+        stage_stats_shard *shard = g_shards[shard_index].load(std::memory_order_acquire);
+        if (nullptr == shard) {
+            auto *new_shard = new stage_stats_shard{};
+            if (g_shards[shard_index].compare_exchange_strong(shard, new_shard, std::memory_order_acq_rel)) {
+                shard = new_shard;
+            } else {
+                delete new_shard;
+            }
+        }
+        return shard;
+    }
+
+    std::string format_stats() {
+        std::stringstream s{};
+        hdr_histogram histogram{};
+
+        s << "Stage latency, us: count / p50 / p90 / p99 / p99.9 / max" << std::fixed << std::setprecision(1);
+        for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+            histogram.reset();
+            for (auto &shard_p: g_shards) {
+                stage_stats_shard *shard = shard_p.load(std::memory_order_acquire);
+                if (nullptr == shard) {
+                    continue; // for
+                }
+                for (size_t i = 0; i < HDR_HISTOGRAM_BUCKET_COUNT; ++i) {
+                    histogram.record(hdr_histogram::get_bucket_value(i),
+                                     shard->counts[stage][i].load(std::memory_order_relaxed));
+                }
+            }
+            s << "\n  " << std::left << std::setw(22) << g_stage_names[stage] << std::right
+              << std::setw(12) << histogram.get_count();
+            for (double percent: {50.0, 90.0, 99.0, 99.9, 100.0}) {
+                s << std::setw(12) << static_cast<double>(histogram.get_percentile(percent)) / 1000;
+            }
+        }
+        return s.str();
+    }
+
+    void write_stats_file() {
+        auto path = std::filesystem::absolute(SERVER_DEFAULT_LOG_DIR) / STAGE_STATS_FILE;
+        // the histograms are cumulative, so the file holds only the latest snapshot
+        std::ofstream file{path, std::ios::trunc};
+        if (!file) {
+            LOG(WARNING) << "Failed to open " << path;
+            return;
+        }
+        file << format_stats() << std::endl;
+    }
+
+    void dump_signal_handler(int signum) {
+        int saved_errno = errno;
+        uint64_t value = 1;
+        // only async-signal-safe calls here: the dump thread does the work
+        if (write(g_dump_fd, &value, sizeof(value)) < 0) {}
+        errno = saved_errno;
+    }
+
+    void dump_routine() {
+        pollfd dump_pollfd{g_dump_fd, POLLIN, 0};
+        uint64_t value;
+        int timeout_ms = 0 == FLAGS_stage_stats_dump_period_s ? INFTIM
+                                                            : static_cast<int>(FLAGS_stage_stats_dump_period_s * 1000);
+
+        while (g_running_flag) {
+            int rc = poll(&dump_pollfd, 1, timeout_ms);
+            if (rc < 0) {
+                if (EINTR == errno) {
+                    continue; // while (g_running_flag)
+                }
+                PLOG(ERROR) << "Error calling poll";
+                break; // while (g_running_flag)
+            }
+            if (0 == rc) {
+                write_stats_file();
+                continue; // while (g_running_flag)
+            }
+            if (read(g_dump_fd, &value, sizeof(value)) < 0 || !g_running_flag) {
+                continue; // while (g_running_flag)
+            }
+            stage_stats_dump();
+        } // while (g_running_flag)
+    }
+}
+
+uint64_t stage_stats_now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void stage_stats_record(stage_t stage, uint64_t start_ns) {
+    if (nullptr == t_shard) {
+        t_shard = get_shard();
+    }
+    uint64_t now_ns = stage_stats_now();
+    uint64_t value = now_ns > start_ns ? now_ns - start_ns : 0;
+    t_shard->counts[stage][hdr_histogram::get_bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+}
+
+int stage_stats_init() {
+    struct sigaction action{};
+
+    g_dump_fd = eventfd(0, EFD_CLOEXEC);
+    if (g_dump_fd < 0) {
+        PLOG(ERROR) << "Error calling eventfd";
+        return STATUS_FAIL;
+    }
+    g_running_flag = true;
+    g_dump_thread = std::thread{dump_routine};
+
+    // SA_RESTART: blocking accept/read/write calls of the servers are not interrupted by a dump request
+    action.sa_handler = dump_signal_handler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (STATUS_SUCCESS != sigaction(SIGUSR1, &action, nullptr)) {
+        PLOG(ERROR) << "Error calling sigaction";
+        stage_stats_deinit();
+        return STATUS_FAIL;
+    }
+    return STATUS_SUCCESS;
+}
+
+void stage_stats_deinit() {
+    uint64_t value = 1;
+
+    if (!g_running_flag) {
+        return;
+    }
+    signal(SIGUSR1, SIG_IGN);
+    g_running_flag = false;
+    if (write(g_dump_fd, &value, sizeof(value)) < 0) {
+        PLOG(ERROR) << "Error waking the stage stats thread";
+    }
+    g_dump_thread.join();
+    close(g_dump_fd);
+    g_dump_fd = -1;
+    if (0 != FLAGS_stage_stats_dump_period_s) {
+        write_stats_file();
+    }
+}
+
+void stage_stats_dump() {
+    LOG(INFO) << format_stats();
+}
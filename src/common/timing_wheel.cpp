@@ -0,0 +1,204 @@
+#include "common/timing_wheel.h"
+#include <ctime>
+#include <bit>
+#include <climits>
+#include <algorithm>
+
+#include "common/config.h"
+
+#define SLOT_MASK                       (TIMING_WHEEL_SLOTS - 1)
+#define EXPIRED_LIST                    (TIMING_WHEEL_LEVELS * TIMING_WHEEL_SLOTS)
+
+namespace {
+    constexpr unsigned int level_shift(size_t level) {
+        return static_cast<unsigned int>(level * TIMING_WHEEL_SLOT_BITS);
+    }
+
+    // the first tick at which the deadline is due
+    uint64_t deadline_tick(uint64_t deadline_ms) {
+        return deadline_ms / TIMING_WHEEL_TICK_MS + (0 == deadline_ms % TIMING_WHEEL_TICK_MS ? 0 : 1);
+    }
+}
+
+
+timing_wheel::timing_wheel() : current_tick{timing_wheel_now_ms() / TIMING_WHEEL_TICK_MS} {
+    std::fill(std::begin(heads), std::end(heads), TIMER_ID_NONE);
+}
+
+void timing_wheel::link(timer_id id, uint32_t list) {
+    node &n = nodes[id];
+
+    n.list = list;
+    n.prev = TIMER_ID_NONE;
+    n.next = heads[list];
+    if (TIMER_ID_NONE != n.next) {
+        nodes[n.next].prev = id;
+    }
+    heads[list] = id;
+    if (EXPIRED_LIST != list) {
+        occupied[list / TIMING_WHEEL_SLOTS] |= 1ULL << (list & SLOT_MASK);
+        filed_count++;
+    }
+}
+
+void timing_wheel::unlink(timer_id id) {
+    node &n = nodes[id];
+
+    if (TIMER_ID_NONE != n.prev) {
+        nodes[n.prev].next = n.next;
+    } else {
+        heads[n.list] = n.next;
+    }
+    if (TIMER_ID_NONE != n.next) {
+        nodes[n.next].prev = n.prev;
+    }
+    if (EXPIRED_LIST != n.list) {
+        if (TIMER_ID_NONE == heads[n.list]) {
+            occupied[n.list / TIMING_WHEEL_SLOTS] &= ~(1ULL << (n.list & SLOT_MASK));
+        }
+        filed_count--;
+    }
+    n.list = TIMER_ID_NONE;
+}
+
+// A node goes to the lowest level whose slot is visited before its tick: the level 0 slot if the tick is
+// in the current level 0 round, otherwise the level whose next-higher digit the tick shares with the current one
+void timing_wheel::file(timer_id id, uint64_t min_tick) {
+    uint64_t tick = std::max(deadline_tick(nodes[id].deadline_ms), min_tick);
+
+    for (size_t level = 0; level < TIMING_WHEEL_LEVELS; ++level) {
+        if ((tick >> level_shift(level + 1)) == (current_tick >> level_shift(level + 1))) {
+            link(id, level * TIMING_WHEEL_SLOTS + ((tick >> level_shift(level)) & SLOT_MASK));
+            return;
+        }
+    }
+    // beyond the wheel: the top slot visited last, where it is filed again
+    size_t top = TIMING_WHEEL_LEVELS - 1;
+    link(id, top * TIMING_WHEEL_SLOTS + (((current_tick >> level_shift(top)) - 1) & SLOT_MASK));
+}
+
+uint64_t timing_wheel::next_event_tick() const {
+    uint64_t next_tick = UINT64_MAX;
+
+    for (size_t level = 0; level < TIMING_WHEEL_LEVELS; ++level) {
+        if (0 == occupied[level]) {
+            continue; // for
+        }
+        uint64_t position = current_tick >> level_shift(level);
+        // slots after the current one in the visiting order, wrapping around
+        auto first = static_cast<unsigned int>((position + 1) & SLOT_MASK);
+        uint64_t distance = std::countr_zero(std::rotr(occupied[level], static_cast<int>(first))) + 1;
+        next_tick = std::min(next_tick, (position + distance) << level_shift(level));
+    }
+    return next_tick;
+}
+
+void timing_wheel::process_tick(uint64_t tick) {
+    timer_id id;
+    timer_id next;
+
+    current_tick = tick;
+    // Cascade from the top, so the nodes moved down are cascaded again within the same tick if due
+    for (size_t level = TIMING_WHEEL_LEVELS - 1; level > 0; --level) {
+        if (0 != (tick & ((1ULL << level_shift(level)) - 1))) {
+            continue; // for
+        }
+        uint32_t list = level * TIMING_WHEEL_SLOTS + ((tick >> level_shift(level)) & SLOT_MASK);
+        for (id = heads[list]; TIMER_ID_NONE != id; id = next) {
+            next = nodes[id].next;
+            unlink(id);
+            file(id, tick);
+        }
+    }
+
+    // A node whose deadline was extended meanwhile is filed again instead of expiring
+    for (id = heads[tick & SLOT_MASK]; TIMER_ID_NONE != id; id = next) {
+        next = nodes[id].next;
+        unlink(id);
+        if (deadline_tick(nodes[id].deadline_ms) > tick) {
+            file(id, tick + 1);
+        } else {
+            link(id, EXPIRED_LIST);
+        }
+    }
+}
+
+timer_id timing_wheel::add(uint64_t deadline_ms, uint64_t owner) {
+    timer_id id = free_head;
+
+    if (TIMER_ID_NONE != id) {
+        free_head = nodes[id].next;
+    } else {
+        id = static_cast<timer_id>(nodes.size());
+        nodes.emplace_back();
+    }
+    nodes[id].deadline_ms = deadline_ms;
+    nodes[id].owner = owner;
+    file(id, current_tick + 1);
+    return id;
+}
+
+void timing_wheel::reschedule(timer_id id, uint64_t deadline_ms) {
+    unlink(id);
+    nodes[id].deadline_ms = deadline_ms;
+    file(id, current_tick + 1);
+}
+
+void timing_wheel::cancel(timer_id id) {
+    unlink(id);
+    nodes[id].next = free_head;
+    free_head = id;
+}
+
+size_t timing_wheel::advance(uint64_t now_ms) {
+    uint64_t now_tick = now_ms / TIMING_WHEEL_TICK_MS;
+    size_t expired_count = 0;
+    uint64_t tick;
+
+    // empty ticks are skipped: only the due slots and the cascades are visited
+    while (filed_count > 0 && (tick = next_event_tick()) <= now_tick) {
+        size_t filed_before = filed_count;
+        process_tick(tick);
+        expired_count += filed_before - filed_count;
+    }
+    current_tick = std::max(current_tick, now_tick);
+    return expired_count;
+}
+
+bool timing_wheel::pop_expired(uint64_t &owner) {
+    timer_id id = heads[EXPIRED_LIST];
+
+    if (TIMER_ID_NONE == id) {
+        return false;
+    }
+    owner = nodes[id].owner;
+    cancel(id);
+    return true;
+}
+
+int timing_wheel::next_timeout_ms(uint64_t now_ms) const {
+    uint64_t next_tick = next_event_tick();
+
+    if (UINT64_MAX == next_tick) {
+        return -1;
+    }
+    uint64_t next_ms = next_tick * TIMING_WHEEL_TICK_MS;
+    return next_ms <= now_ms ? 0 : static_cast<int>(std::min<uint64_t>(next_ms - now_ms, INT_MAX));
+}
+
+uint64_t timing_wheel_now_ms() {
+    struct timespec ts{};
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000 + static_cast<uint64_t>(ts.tv_nsec) / 1000000;
+}
+
+bool connection_timeouts_enabled() {
+    return 0 != FLAGS_idle_timeout_ms || 0 != FLAGS_write_timeout_ms;
+}
+
+uint64_t connection_deadline_ms(uint64_t now_ms, bool write_pending) {
+    uint32_t timeout_ms = write_pending ? FLAGS_write_timeout_ms : FLAGS_idle_timeout_ms;
+
+    return 0 == timeout_ms ? TIMER_DEADLINE_NEVER : now_ms + timeout_ms;
+}
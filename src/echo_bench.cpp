@@ -0,0 +1,817 @@
+#include "echo_bench.h"
+#include <iostream>
+#include <iomanip>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <csignal>
+#include <cstring>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include "common/defines.h"
+#include "common/socket.h"
+#include "common/logging.h"
+#include "common/hdr_histogram.h"
+
+
+#define CLIENT_EVENTS                   (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET)
+#define NS_IN_SEC                       (1000000000ULL)
+#define NS_IN_MS                        (1000000ULL)
+#define BENCH_READ_BUFFER_SIZE          (STREAM_BUFFER_MAX_SIZE)
+#define BENCH_NAME_MIN_WIDTH            (34)
+// how often an idle closed-loop worker checks the end of the run
+#define BENCH_POLL_TIMEOUT_NS           (100 * NS_IN_MS)
+#define SERVER_START_TIMEOUT_MS         (5000)
+#define SERVER_STOP_TIMEOUT_MS          (5000)
+#define SERVER_PROBE_INTERVAL_MS        (50)
+#define SERVER_BINARY                   ("echo_server")
+// the largest payload of an IPv4 datagram
+#define UDP_PAYLOAD_MAX                 (65507)
+
+// comma-separated list of the engines for --engines=all; set by the build
+#ifndef ECHO_BENCH_SERVER_ENGINES
+#define ECHO_BENCH_SERVER_ENGINES       ""
+#endif
+#ifndef ECHO_BENCH_SERVER_UDP_ENGINES
+#define ECHO_BENCH_SERVER_UDP_ENGINES   ""
+#endif
+
+DEFINE_string(host, "127.0.0.1", "Server IPv4 address");
+DEFINE_uint32(connections, 64, "Number of client connections");
+DEFINE_uint32(client_threads, 0, "Number of client threads; 0 - half of the available CPUs");
+DEFINE_uint32(duration_s, 10, "Duration of a run in seconds");
+DEFINE_uint64(qps, 0, "Total message rate; 0 - closed loop: a connection sends the next message once the echo is back");
+DEFINE_string(payload_sizes, "64,4096,65536,1048576", "Comma-separated payload sizes in bytes, one run per size");
+DEFINE_string(engines, "", "Comma-separated echo_server engines to launch in turn, 'all' - every engine of the "
+                           "protocol; empty - use the server which already listens on the port");
+DEFINE_string(server_dir, "", "Directory of the echo_server binary; empty - the echo_bench directory");
+DEFINE_bool(udp, false, "Load a datagram engine: every connection is a connected UDP socket with one datagram "
+                        "in flight; payload sizes up to 65507");
+DEFINE_uint32(udp_timeout_ms, 100, "udp: a datagram whose echo is not back in this time is counted lost");
+DEFINE_bool(reconnect, false, "Measure the connection rate: every message goes over a new connection, closed after "
+                              "the echo; the latency includes the handshake");
+DEFINE_string(server_args, "", "Semicolon-separated argument sets; every engine is launched once per set, "
+                               "e.g. '--pin_threads=true;--pin_threads=false'");
+
+
+namespace bench {
+    namespace client {
+        struct connection_data {
+            int fd = -1;
+            bool in_flight = false;
+            // progress of the message in flight
+            size_t sent = 0;
+            size_t received = 0;
+            // scheduled send time, so a message delayed by a slow server still counts its wait
+            uint64_t send_time_ns = 0;
+            uint64_t next_send_time_ns = 0;
+        };
+    }
+
+    struct worker_data {
+        std::vector<client::connection_data> connections{};
+        hdr_histogram histogram{};
+        uint64_t message_count = 0;
+        uint64_t error_count = 0;
+        // datagrams without an echo in --udp_timeout_ms
+        uint64_t lost_count = 0;
+        // reconnect: connections refused or reset before the echo, e.g. shed by the server
+        uint64_t refused_count = 0;
+    };
+
+    struct run_result {
+        std::string server{};
+        size_t payload_size = 0;
+        size_t connection_count = 0;
+        // the server did not start; the other fields are empty
+        bool failed = false;
+        hdr_histogram histogram{};
+        uint64_t message_count = 0;
+        uint64_t error_count = 0;
+        uint64_t lost_count = 0;
+        uint64_t refused_count = 0;
+        double duration_s = 0;
+        // server RSS growth from before connecting till the end of the run; -1 if the server is not ours
+        double connection_memory_kib = -1;
+    };
+}
+
+namespace bench {
+    std::atomic_bool g_running_flag = false;
+    int g_rc = STATUS_SUCCESS;
+    struct sockaddr_in g_server_addr{};
+    std::vector<size_t> g_payload_sizes{};
+    std::string g_server_path{};
+    std::vector<std::string> g_engines{};
+    // space-separated arguments of a launch; one empty set if --server_args is not given
+    std::vector<std::string> g_server_args{};
+    // every message carries the same pattern, so an echo is verified without a copy
+    std::vector<char> g_payload{};
+    std::vector<run_result> g_results{};
+
+    int bench_init(uint16_t port);
+
+    void bench_terminate_handler(int signum);
+
+    uint64_t get_time_ns();
+
+    std::vector<std::string> split_list(const std::string &list, char delimiter = ',');
+
+    // server_pid - -1 if the server is not launched by the bench
+    void run_bench(const std::string &server, pid_t server_pid, size_t payload_size);
+
+    void bench_worker(worker_data &worker, size_t payload_size, uint64_t start_time_ns, uint64_t end_time_ns);
+
+    void print_results();
+
+    namespace client {
+        int connect_client(connection_data &connection);
+
+        void close_client(connection_data &connection);
+
+        // reconnect: opens the next connection of the message and adds it to the worker epoll
+        int reconnect_client(connection_data &connection, int epoll_fd, size_t index);
+
+        // a reconnecting connection is counted refused and starts over, any other one stays closed
+        void fail_client(worker_data &worker, connection_data &connection, uint64_t now_ns);
+
+        void start_message_client(connection_data &connection, uint64_t send_time_ns);
+
+        int send_request_client(connection_data &connection, size_t payload_size);
+
+        int get_response_client(worker_data &worker, connection_data &connection, size_t payload_size,
+                                std::vector<char> &buffer);
+    }
+
+    namespace server {
+        pid_t launch_server(const std::string &engine, const std::string &args);
+
+        int wait_server_ready(pid_t pid);
+
+        // a datagram server is ready once it echoes a probe on the connected socket
+        int probe_udp_server(int probe_fd);
+
+        void stop_server(pid_t pid);
+
+        // resident memory of the server in KiB; STATUS_FAIL if it is not known
+        ssize_t get_memory_kib(pid_t pid);
+    }
+}
+
+int echo_bench_main(uint16_t port) {
+    using namespace bench;
+
+    if (STATUS_SUCCESS != bench_init(port)) {
+        return STATUS_FAIL;
+    }
+    g_running_flag = true;
+
+    if (g_engines.empty()) {
+        for (size_t payload_size: g_payload_sizes) {
+            if (!g_running_flag) {
+                break; // for
+            }
+            run_bench("port " + std::to_string(port), -1, payload_size);
+        }
+    }
+
+    for (size_t run = 0; run < g_engines.size() * g_server_args.size(); ++run) {
+        if (!g_running_flag) {
+            break; // for
+        }
+        const std::string &engine = g_engines[run / g_server_args.size()];
+        const std::string &server_args = g_server_args[run % g_server_args.size()];
+        std::string server_name = engine;
+        if (!server_args.empty()) {
+            server_name += " " + server_args;
+        }
+        LOG(INFO) << "Starting " << g_server_path << " --engine=" << engine << " " << server_args;
+        pid_t server_pid = server::launch_server(engine, server_args);
+        if (server_pid < 0 || STATUS_SUCCESS != server::wait_server_ready(server_pid)) {
+            LOG(ERROR) << "Error server " << server_name << " did not start";
+            run_result result{};
+            result.server = server_name;
+            result.failed = true;
+            g_results.push_back(std::move(result));
+            g_rc = STATUS_FAIL;
+            if (server_pid >= 0) {
+                server::stop_server(server_pid);
+            }
+            continue; // for
+        }
+
+        for (size_t payload_size: g_payload_sizes) {
+            if (!g_running_flag) {
+                break; // for
+            }
+            run_bench(server_name, server_pid, payload_size);
+        }
+        server::stop_server(server_pid);
+    }
+
+    print_results();
+    return g_rc;
+}
+
+int bench::bench_init(uint16_t port) {
+    g_server_addr.sin_family = AF_INET;
+    g_server_addr.sin_port = htons(port);
+    if (1 != inet_pton(AF_INET, FLAGS_host.c_str(), &g_server_addr.sin_addr)) {
+        LOG(ERROR) << "Error invalid host address " << FLAGS_host;
+        return STATUS_FAIL;
+    }
+    if (0 == FLAGS_connections || 0 == FLAGS_duration_s) {
+        LOG(ERROR) << "Error connections and duration_s must be positive";
+        return STATUS_FAIL;
+    }
+    if (FLAGS_udp && FLAGS_reconnect) {
+        LOG(ERROR) << "Error reconnect measures stream connections, it does not work with udp";
+        return STATUS_FAIL;
+    }
+
+    for (const auto &size_str: split_list(FLAGS_payload_sizes)) {
+        size_t payload_size = std::strtoull(size_str.c_str(), nullptr, 10);
+        if (0 == payload_size) {
+            LOG(ERROR) << "Error invalid payload size " << size_str;
+            return STATUS_FAIL;
+        }
+        if (FLAGS_udp && payload_size > UDP_PAYLOAD_MAX) {
+            LOG(ERROR) << "Error payload size " << payload_size << " does not fit a datagram";
+            return STATUS_FAIL;
+        }
+        g_payload_sizes.push_back(payload_size);
+    }
+    if (g_payload_sizes.empty()) {
+        LOG(ERROR) << "Error no payload sizes given";
+        return STATUS_FAIL;
+    }
+    g_payload.resize(*std::max_element(g_payload_sizes.begin(), g_payload_sizes.end()));
+    for (size_t i = 0; i < g_payload.size(); ++i) {
+        // 251 is prime, so a shifted or repeated chunk does not match the pattern
+        g_payload[i] = static_cast<char>(i % 251);
+    }
+
+    std::filesystem::path server_dir = FLAGS_server_dir;
+    if (server_dir.empty()) {
+        server_dir = std::filesystem::read_symlink("/proc/self/exe").parent_path();
+    }
+    g_server_path = (server_dir / SERVER_BINARY).string();
+    if ("all" == FLAGS_engines) {
+        g_engines = split_list(FLAGS_udp ? ECHO_BENCH_SERVER_UDP_ENGINES : ECHO_BENCH_SERVER_ENGINES);
+    } else {
+        g_engines = split_list(FLAGS_engines);
+    }
+    if ("all" == FLAGS_engines && g_engines.empty()) {
+        LOG(ERROR) << "Error the engines list is not set by the build";
+        return STATUS_FAIL;
+    }
+    g_server_args = split_list(FLAGS_server_args, ';');
+    if (g_server_args.empty()) {
+        g_server_args.emplace_back();
+    }
+
+    signal(SIGINT, bench_terminate_handler);
+    // a server which dies mid-run must not kill the bench with a write
+    signal(SIGPIPE, SIG_IGN);
+    return STATUS_SUCCESS;
+}
+
+void bench::bench_terminate_handler(int signum) {
+    if (!g_running_flag) {
+        LOG(WARNING) << "Bench force stop";
+        logging_deinit();
+        exit(STATUS_FAIL);
+    }
+    g_running_flag = false;
+    LOG(INFO) << "Bench stop command issued";
+}
+
+uint64_t bench::get_time_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::vector<std::string> bench::split_list(const std::string &list, char delimiter) {
+    std::vector<std::string> res{};
+    std::stringstream s{list};
+    std::string item;
+
+    while (std::getline(s, item, delimiter)) {
+        if (!item.empty()) {
+            res.push_back(item);
+        }
+    }
+    return res;
+}
+
+void bench::run_bench(const std::string &server, pid_t server_pid, size_t payload_size) {
+    size_t thread_num = FLAGS_client_threads;
+    std::vector<worker_data> workers{};
+    std::vector<std::thread> thread_list{};
+    run_result result{};
+    ssize_t idle_memory_kib = server_pid < 0 ? STATUS_FAIL : server::get_memory_kib(server_pid);
+
+    if (0 == thread_num) {
+        thread_num = std::max(1U, std::thread::hardware_concurrency() / 2);
+    }
+    thread_num = std::min<size_t>(thread_num, FLAGS_connections);
+    LOG(INFO) << "Running " << server << ": " << FLAGS_connections << " connections, " << payload_size
+              << " bytes payload, " << thread_num << " threads";
+
+    // connections are set up before the clock starts and spread round-robin over the workers;
+    // with --reconnect they are opened by the messages
+    uint64_t connect_start_ns = get_time_ns();
+    workers.resize(thread_num);
+    for (size_t i = 0; i < FLAGS_connections; ++i) {
+        worker_data &worker = workers[i % thread_num];
+        worker.connections.emplace_back();
+        if (!FLAGS_reconnect && STATUS_SUCCESS != client::connect_client(worker.connections.back())) {
+            worker.error_count++;
+        }
+    }
+    if (!FLAGS_reconnect) {
+        uint64_t connect_time_ns = get_time_ns() - connect_start_ns;
+        LOG(INFO) << "Connected in " << connect_time_ns / NS_IN_MS << " ms, "
+                  << connect_time_ns / 1000 / FLAGS_connections << " us per connection";
+    }
+
+    uint64_t start_time_ns = get_time_ns();
+    uint64_t end_time_ns = start_time_ns + FLAGS_duration_s * NS_IN_SEC;
+    thread_list.reserve(thread_num);
+    for (auto &worker: workers) {
+        thread_list.emplace_back(bench_worker, std::ref(worker), payload_size, start_time_ns, end_time_ns);
+    }
+    for (auto &thread: thread_list) {
+        thread.join();
+    }
+    // shorter than requested if the bench was stopped
+    result.duration_s = static_cast<double>(std::min(get_time_ns(), end_time_ns) - start_time_ns) / NS_IN_SEC;
+    // the connections are still open; memory the server recycled from a previous run is not counted
+    ssize_t loaded_memory_kib = server_pid < 0 ? STATUS_FAIL : server::get_memory_kib(server_pid);
+    if (idle_memory_kib >= 0 && loaded_memory_kib >= 0) {
+        result.connection_memory_kib = static_cast<double>(loaded_memory_kib - idle_memory_kib) /
+                                       static_cast<double>(FLAGS_connections);
+    }
+
+    result.server = server;
+    result.payload_size = payload_size;
+    result.connection_count = FLAGS_connections;
+    for (auto &worker: workers) {
+        result.histogram.merge(worker.histogram);
+        result.message_count += worker.message_count;
+        result.error_count += worker.error_count;
+        result.lost_count += worker.lost_count;
+        result.refused_count += worker.refused_count;
+        for (auto &connection: worker.connections) {
+            client::close_client(connection);
+        }
+    }
+    if (result.error_count > 0) {
+        LOG(WARNING) << result.error_count << " connections of " << server << " failed";
+        g_rc = STATUS_FAIL;
+    }
+    g_results.push_back(std::move(result));
+}
+
+void bench::bench_worker(worker_data &worker, size_t payload_size, uint64_t start_time_ns, uint64_t end_time_ns) {
+    int epoll_fd;
+    int trig_fds_count;
+    uint64_t timeout_ns;
+    struct timespec timeout{};
+    uint64_t now_ns;
+    epoll_event event{};
+    std::vector<epoll_event> events(EPOLL_MAX_EVENTS);
+    std::vector<char> buffer(BENCH_READ_BUFFER_SIZE);
+    // fixed rate: every connection sends with the same period, phases are spread over it
+    uint64_t send_period_ns = 0 == FLAGS_qps ? 0 : FLAGS_connections * NS_IN_SEC / FLAGS_qps;
+    uint64_t udp_timeout_ns = FLAGS_udp_timeout_ms * NS_IN_MS;
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        PLOG(ERROR) << "Error calling epoll_create1";
+        worker.error_count += worker.connections.size();
+        return;
+    }
+    for (size_t index = 0; index < worker.connections.size(); ++index) {
+        client::connection_data &connection = worker.connections[index];
+        connection.next_send_time_ns = start_time_ns + send_period_ns * index / worker.connections.size();
+        if (-1 == connection.fd) {
+            continue; // for
+        }
+        event.events = CLIENT_EVENTS;
+        event.data.u64 = index;
+        if (STATUS_SUCCESS != epoll_ctl(epoll_fd, EPOLL_CTL_ADD, connection.fd, &event)) {
+            PLOG(ERROR) << "Error calling epoll_ctl";
+            client::close_client(connection);
+            worker.error_count++;
+            continue; // for
+        }
+        if (0 == send_period_ns) {
+            client::start_message_client(connection, start_time_ns);
+            if (STATUS_SUCCESS != client::send_request_client(connection, payload_size)) {
+                client::close_client(connection);
+                worker.error_count++;
+            }
+        }
+    }
+
+    while (g_running_flag && (now_ns = get_time_ns()) < end_time_ns) {
+        timeout_ns = BENCH_POLL_TIMEOUT_NS;
+        // Datagrams are not retransmitted: a message without an echo in time is lost, the next one goes
+        for (size_t index = 0; FLAGS_udp && index < worker.connections.size(); ++index) {
+            client::connection_data &connection = worker.connections[index];
+            if (-1 == connection.fd || !connection.in_flight) {
+                continue; // for
+            }
+            if (connection.send_time_ns + udp_timeout_ns > now_ns) {
+                timeout_ns = std::min(timeout_ns, connection.send_time_ns + udp_timeout_ns - now_ns);
+                continue; // for
+            }
+            worker.lost_count++;
+            connection.in_flight = false;
+            if (0 == send_period_ns) {
+                client::start_message_client(connection, now_ns);
+                if (STATUS_SUCCESS != client::send_request_client(connection, payload_size)) {
+                    client::close_client(connection);
+                    worker.error_count++;
+                }
+            }
+        }
+        // Fixed rate or reconnect: start the due messages and sleep until the next one
+        for (size_t index = 0; (0 != send_period_ns || FLAGS_reconnect) && index < worker.connections.size();
+             ++index) {
+            client::connection_data &connection = worker.connections[index];
+            if ((-1 == connection.fd && !FLAGS_reconnect) || connection.in_flight) {
+                continue; // for
+            }
+            if (connection.next_send_time_ns <= now_ns) {
+                if (FLAGS_reconnect && STATUS_SUCCESS != client::reconnect_client(connection, epoll_fd, index)) {
+                    connection.next_send_time_ns += send_period_ns;
+                    client::fail_client(worker, connection, now_ns);
+                    continue; // for
+                }
+                client::start_message_client(connection, connection.next_send_time_ns);
+                connection.next_send_time_ns += send_period_ns;
+                if (STATUS_SUCCESS != client::send_request_client(connection, payload_size)) {
+                    client::fail_client(worker, connection, now_ns);
+                }
+            } else {
+                timeout_ns = std::min(timeout_ns, connection.next_send_time_ns - now_ns);
+            }
+        }
+
+        // a millisecond epoll_wait timeout would delay the sends of a fixed rate run
+        timeout.tv_sec = static_cast<time_t>(timeout_ns / NS_IN_SEC);
+        timeout.tv_nsec = static_cast<long>(timeout_ns % NS_IN_SEC);
+        trig_fds_count = epoll_pwait2(epoll_fd, events.data(), static_cast<int>(events.size()), &timeout, nullptr);
+        if (trig_fds_count < 0) {
+            if (EINTR == errno) {
+                continue; // while
+            }
+            PLOG(ERROR) << "Error calling epoll_pwait2";
+            worker.error_count++;
+            break; // while
+        }
+
+        for (int index = 0; index < trig_fds_count; ++index) {
+            client::connection_data &connection = worker.connections[events[index].data.u64];
+            if (-1 == connection.fd) {
+                continue; // for
+            }
+
+            if (events[index].events & EPOLLERR ||
+                STATUS_SUCCESS != client::send_request_client(connection, payload_size) ||
+                STATUS_SUCCESS != client::get_response_client(worker, connection, payload_size, buffer)) {
+                client::fail_client(worker, connection, now_ns);
+                continue; // for
+            }
+            // Reconnect: the echo is back, the next message opens a new connection
+            if (FLAGS_reconnect && !connection.in_flight) {
+                client::close_client(connection);
+                if (0 == send_period_ns) {
+                    connection.next_send_time_ns = get_time_ns();
+                }
+            }
+        } // for (int index = 0; index < trig_fds_count; ++index)
+    } // while (g_running_flag && (now_ns = get_time_ns()) < end_time_ns)
+
+    close(epoll_fd);
+}
+
+void bench::print_results() {
+    size_t name_width = BENCH_NAME_MIN_WIDTH;
+    for (const auto &result: g_results) {
+        name_width = std::max(name_width, result.server.size() + 2);
+    }
+
+    std::cout << std::left << std::setw(static_cast<int>(name_width)) << "server" << std::right
+              << std::setw(9) << "payload" << std::setw(7) << "conns"
+              << std::setw(12) << (FLAGS_udp ? "pkt/s" : FLAGS_reconnect ? "conn/s" : "msg/s")
+              << std::setw(10) << "MiB/s"
+              << std::setw(11) << "p50 us" << std::setw(11) << "p90 us"
+              << std::setw(11) << "p99 us" << std::setw(11) << "p99.9 us"
+              << std::setw(8) << "errors";
+    if (FLAGS_udp) {
+        std::cout << std::setw(10) << "lost";
+    }
+    if (FLAGS_reconnect) {
+        std::cout << std::setw(10) << "refused";
+    }
+    std::cout << std::setw(10) << "KiB/conn" << std::endl;
+
+    std::cout << std::fixed << std::setprecision(1);
+    for (const auto &result: g_results) {
+        std::cout << std::left << std::setw(static_cast<int>(name_width)) << result.server << std::right;
+        if (result.failed) {
+            std::cout << "  failed to start" << std::endl;
+            continue; // for
+        }
+        double msg_rate = static_cast<double>(result.message_count) / result.duration_s;
+        std::cout << std::setw(9) << result.payload_size << std::setw(7) << result.connection_count
+                  << std::setw(12) << msg_rate
+                  << std::setw(10) << msg_rate * static_cast<double>(result.payload_size) / (1024 * 1024);
+        for (double percent: {50.0, 90.0, 99.0, 99.9}) {
+            std::cout << std::setw(11) << static_cast<double>(result.histogram.get_percentile(percent)) / 1000;
+        }
+        std::cout << std::setw(8) << result.error_count;
+        if (FLAGS_udp) {
+            std::cout << std::setw(10) << result.lost_count;
+        }
+        if (FLAGS_reconnect) {
+            std::cout << std::setw(10) << result.refused_count;
+        }
+        if (result.connection_memory_kib < 0) {
+            std::cout << std::setw(10) << "-" << std::endl;
+        } else {
+            std::cout << std::setw(10) << result.connection_memory_kib << std::endl;
+        }
+    }
+}
+
+int bench::client::connect_client(connection_data &connection) {
+    int flag = 1;
+    // a reconnecting worker does not wait in connect(): the request goes on the EPOLLOUT edge of the handshake
+    int nonblocking = FLAGS_reconnect ? SOCK_NONBLOCK : 0;
+
+    connection.fd = socket(AF_INET, (FLAGS_udp ? SOCK_DGRAM : SOCK_STREAM) | SOCK_CLOEXEC | nonblocking, 0);
+    if (connection.fd < 0) {
+        PLOG(ERROR) << "Error creating client socket";
+        return STATUS_FAIL;
+    }
+    if (STATUS_SUCCESS != connect(connection.fd, (struct sockaddr *) &g_server_addr, sizeof(g_server_addr)) &&
+        !(FLAGS_reconnect && EINPROGRESS == errno)) {
+        // a refused reconnect is counted, not logged
+        if (!FLAGS_reconnect) {
+            PLOG(ERROR) << "Error calling connect()";
+        }
+        close_client(connection);
+        return STATUS_FAIL;
+    }
+    // every message is a separate request, Nagle would delay them
+    if (!FLAGS_udp) {
+        setsockopt(connection.fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    }
+    if (!FLAGS_reconnect && STATUS_SUCCESS != socket_set_nonblocking(connection.fd)) {
+        close_client(connection);
+        return STATUS_FAIL;
+    }
+    return STATUS_SUCCESS;
+}
+
+int bench::client::reconnect_client(connection_data &connection, int epoll_fd, size_t index) {
+    epoll_event event{};
+
+    if (STATUS_SUCCESS != connect_client(connection)) {
+        return STATUS_FAIL;
+    }
+    event.events = CLIENT_EVENTS;
+    event.data.u64 = index;
+    if (STATUS_SUCCESS != epoll_ctl(epoll_fd, EPOLL_CTL_ADD, connection.fd, &event)) {
+        PLOG(ERROR) << "Error calling epoll_ctl";
+        close_client(connection);
+        return STATUS_FAIL;
+    }
+    return STATUS_SUCCESS;
+}
+
+void bench::client::fail_client(worker_data &worker, connection_data &connection, uint64_t now_ns) {
+    close_client(connection);
+    if (!FLAGS_reconnect) {
+        worker.error_count++;
+        return;
+    }
+    worker.refused_count++;
+    // closed loop: the next connection goes right away; fixed rate: at its scheduled time
+    if (0 == FLAGS_qps) {
+        connection.next_send_time_ns = now_ns;
+    }
+}
+
+void bench::client::close_client(connection_data &connection) {
+    if (-1 != connection.fd) {
+        close(connection.fd);
+    }
+    connection.fd = -1;
+    connection.in_flight = false;
+}
+
+void bench::client::start_message_client(connection_data &connection, uint64_t send_time_ns) {
+    connection.in_flight = true;
+    connection.sent = 0;
+    connection.received = 0;
+    connection.send_time_ns = send_time_ns;
+}
+
+int bench::client::send_request_client(connection_data &connection, size_t payload_size) {
+    ssize_t sent_now;
+
+    while (connection.in_flight && connection.sent < payload_size) {
+        sent_now = send(connection.fd, g_payload.data() + connection.sent, payload_size - connection.sent,
+                        MSG_NOSIGNAL);
+        if (STATUS_FAIL == sent_now) {
+            if (EINTR == errno) {
+                continue; // while
+            } else if (EAGAIN == errno || EWOULDBLOCK == errno) {
+                // the rest goes on the next EPOLLOUT edge
+                return STATUS_SUCCESS;
+            }
+            if (!FLAGS_reconnect) {
+                PLOG(WARNING) << "Error calling send()";
+            }
+            return STATUS_FAIL;
+        }
+        connection.sent += sent_now;
+    }
+    return STATUS_SUCCESS;
+}
+
+int bench::client::get_response_client(worker_data &worker, connection_data &connection, size_t payload_size,
+                                       std::vector<char> &buffer) {
+    ssize_t read_bytes;
+
+    // edge-triggered: read until the socket would block
+    while (true) {
+        read_bytes = read(connection.fd, buffer.data(), buffer.size());
+        if (STATUS_FAIL == read_bytes) {
+            if (EINTR == errno) {
+                continue; // while
+            } else if (EAGAIN == errno || EWOULDBLOCK == errno) {
+                return STATUS_SUCCESS;
+            }
+            if (!FLAGS_reconnect) {
+                PLOG(WARNING) << "Error calling read()";
+            }
+            return STATUS_FAIL;
+        }
+        if (0 == read_bytes) {
+            if (!FLAGS_reconnect) {
+                LOG(WARNING) << "Error server closed the connection";
+            }
+            return STATUS_FAIL;
+        }
+        // the late echo of a datagram counted lost; a datagram echo is whole or not at all
+        if (FLAGS_udp && (!connection.in_flight || connection.sent < payload_size)) {
+            continue; // while
+        }
+        if (FLAGS_udp && static_cast<size_t>(read_bytes) != payload_size) {
+            LOG(WARNING) << "Error echo does not match the request";
+            return STATUS_FAIL;
+        }
+
+        // Echo verification: nothing unrequested, nothing altered
+        if (!connection.in_flight || connection.received + read_bytes > connection.sent ||
+            0 != memcmp(buffer.data(), g_payload.data() + connection.received, read_bytes)) {
+            LOG(WARNING) << "Error echo does not match the request";
+            return STATUS_FAIL;
+        }
+        connection.received += read_bytes;
+        if (connection.received < payload_size) {
+            continue; // while
+        }
+
+        uint64_t now_ns = get_time_ns();
+        worker.histogram.record(now_ns - connection.send_time_ns);
+        worker.message_count++;
+        connection.in_flight = false;
+        // Closed loop: the next message goes right away; with --reconnect over a new connection
+        if (0 == FLAGS_qps && !FLAGS_reconnect) {
+            start_message_client(connection, now_ns);
+            if (STATUS_SUCCESS != send_request_client(connection, payload_size)) {
+                return STATUS_FAIL;
+            }
+        }
+    }
+}
+
+pid_t bench::server::launch_server(const std::string &engine, const std::string &args) {
+    std::vector<std::string> arg_list = split_list(args, ' ');
+    std::vector<char *> argv{};
+    std::string engine_arg = "--engine=" + engine;
+    std::string port_arg = "--port=" + std::to_string(ntohs(g_server_addr.sin_port));
+
+    // built before fork(): the child only execs
+    argv.push_back(g_server_path.data());
+    argv.push_back(engine_arg.data());
+    argv.push_back(port_arg.data());
+    for (auto &arg: arg_list) {
+        argv.push_back(arg.data());
+    }
+    argv.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        PLOG(ERROR) << "Error calling fork()";
+        return STATUS_FAIL;
+    }
+    if (0 == pid) {
+        // the server output would mix with the report; its log files are still written
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd >= 0) {
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+        }
+        execv(g_server_path.c_str(), argv.data());
+        _exit(EXIT_FAILURE);
+    }
+    return pid;
+}
+
+// the server is ready once it accepts a connection, or echoes a datagram with --udp
+int bench::server::wait_server_ready(pid_t pid) {
+    int probe_fd;
+    int rc;
+
+    for (int waited_ms = 0; waited_ms < SERVER_START_TIMEOUT_MS; waited_ms += SERVER_PROBE_INTERVAL_MS) {
+        if (pid == waitpid(pid, nullptr, WNOHANG)) {
+            LOG(ERROR) << "Error server exited on start";
+            return STATUS_FAIL;
+        }
+        probe_fd = socket(AF_INET, (FLAGS_udp ? SOCK_DGRAM : SOCK_STREAM) | SOCK_CLOEXEC, 0);
+        if (probe_fd < 0) {
+            PLOG(ERROR) << "Error creating probe socket";
+            return STATUS_FAIL;
+        }
+        rc = connect(probe_fd, (struct sockaddr *) &g_server_addr, sizeof(g_server_addr));
+        if (FLAGS_udp && STATUS_SUCCESS == rc) {
+            rc = probe_udp_server(probe_fd);
+        }
+        close(probe_fd);
+        if (STATUS_SUCCESS == rc) {
+            return STATUS_SUCCESS;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(SERVER_PROBE_INTERVAL_MS));
+    }
+    LOG(ERROR) << "Error server does not accept connections";
+    return STATUS_FAIL;
+}
+
+int bench::server::probe_udp_server(int probe_fd) {
+    struct timeval timeout{0, SERVER_PROBE_INTERVAL_MS * 1000};
+    char probe = 0;
+
+    setsockopt(probe_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (1 != send(probe_fd, &probe, sizeof(probe), 0) || 1 != recv(probe_fd, &probe, sizeof(probe), 0)) {
+        return STATUS_FAIL;
+    }
+    return STATUS_SUCCESS;
+}
+
+void bench::server::stop_server(pid_t pid) {
+    kill(pid, SIGINT);
+    for (int waited_ms = 0; waited_ms < SERVER_STOP_TIMEOUT_MS; waited_ms += SERVER_PROBE_INTERVAL_MS) {
+        if (0 != waitpid(pid, nullptr, WNOHANG)) {
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(SERVER_PROBE_INTERVAL_MS));
+    }
+    LOG(WARNING) << "Server " << pid << " ignores SIGINT, killing it";
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+}
+
+ssize_t bench::server::get_memory_kib(pid_t pid) {
+    std::ifstream status{"/proc/" + std::to_string(pid) + "/status"};
+    std::string line;
+
+    while (std::getline(status, line)) {
+        // "VmRSS:     1234 kB"
+        if (0 == line.rfind("VmRSS:", 0)) {
+            return static_cast<ssize_t>(std::strtoll(line.c_str() + sizeof("VmRSS:") - 1, nullptr, 10));
+        }
+    }
+    LOG(WARNING) << "Failed to read the memory usage of server " << pid;
+    return STATUS_FAIL;
+}
@@ -5,53 +5,60 @@
 #include <boost/asio/buffer.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <exception>
-#include <csignal>
 #include <string>
-#include <sstream>
+#include <algorithm>
 
 #include "common/defines.h"
+#include "common/socket.h"
 #include "common/logging.h"
+#include "common/stage_stats.h"
+#include "common/config.h"
+#include "common/asio_session.h"
+#include "common/connection.h"
 
 
 namespace server_boost_asio {
     bool g_running_flag = false;
     int g_rc = STATUS_SUCCESS;
 
+    // defined before the io_service: the sessions destroyed with its pending handlers unwatch their deadlines
+    asio_timeouts g_timeouts{};
     boost::asio::io_service g_io_service{};
     boost::asio::ip::tcp::endpoint g_endpoint;
     boost::asio::ip::tcp::acceptor g_acceptor{g_io_service};
+    size_t g_accept_count = 0;
+    // connections reset by the admission control near the fd limit
+    size_t g_shed_count = 0;
 
     int server_init(uint16_t port);
 
-    void server_terminate_handler(int signum);
+    int server_run();
+
+    void server_stop();
+
+    void log_stats();
 
     namespace client {
         void connect_client();
 
-        void close_client(std::shared_ptr<boost::asio::ip::tcp::socket> client_p);
+        void close_client(asio_session_ptr session);
 
-        void
-        get_request_client(std::shared_ptr<boost::asio::ip::tcp::socket> socket_p, std::shared_ptr<char[]> buffer_p);
+        void get_request_client(asio_session_ptr session);
 
-        void send_response_client(std::shared_ptr<boost::asio::ip::tcp::socket> socket_p,
-                                  std::shared_ptr<char[]> buffer_p, size_t length);
+        void send_response_client(asio_session_ptr session, size_t length);
 
-        std::string get_client_name(std::shared_ptr<boost::asio::ip::tcp::socket> client_p);
+        peer_addr get_client_peer(boost::asio::ip::tcp::socket &socket);
     }
 }
 
-int echo_server_boost_asio_main(uint16_t port) {
-    std::string msg_buffer{};
-
-    using namespace server_boost_asio;
-
-    if (STATUS_SUCCESS != server_init(port)) {
-        return STATUS_FAIL;
-    }
-    g_running_flag = true;
+const engine_t g_engine_boost_asio{"boost_asio", server_boost_asio::server_init, server_boost_asio::server_run,
+                                   server_boost_asio::server_stop, server_boost_asio::log_stats};
 
+int server_boost_asio::server_run() {
+    g_timeouts.start(g_io_service);
     client::connect_client();
     g_io_service.run();
+    g_timeouts.stop();
     g_acceptor.close();
     LOG(INFO) << "Server stopped";
     return g_rc;
@@ -62,39 +69,46 @@ int server_boost_asio::server_init(uint16_t port) {
         g_endpoint = boost::asio::ip::tcp::endpoint{boost::asio::ip::tcp::v4(), port};
         g_acceptor.open(g_endpoint.protocol());
         g_acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
-        g_acceptor.set_option(boost::asio::ip::tcp::acceptor::receive_buffer_size(EXPECTED_MESSAGE_SIZE));
-        g_acceptor.set_option(boost::asio::ip::tcp::acceptor::send_buffer_size(EXPECTED_MESSAGE_SIZE));
+        if (STATUS_SUCCESS != socket_tune_listener(g_acceptor.native_handle())) {
+            return STATUS_FAIL;
+        }
         g_acceptor.bind(g_endpoint);
-        g_acceptor.listen(SERVER_LISTEN_BACKLOG_SIZE);
+        g_acceptor.listen(FLAGS_listen_backlog);
     } catch (std::exception &e) {
         LOG(ERROR) << e.what();
         return STATUS_FAIL;
     }
-    signal(SIGINT, server_terminate_handler);
+    // an idle session keeps its --message_size buffer
+    log_connection_footprint(sizeof(asio_session), FLAGS_message_size, connection_timeouts_enabled());
+    g_running_flag = true;
 
     LOG(INFO) << "Server started";
     return STATUS_SUCCESS;
 }
 
-void server_boost_asio::server_terminate_handler(int signum) {
-    if (!g_running_flag) {
-        g_acceptor.close();
-        LOG(WARNING) << "Server force stop";
-        logging_deinit();
-        exit(STATUS_FAIL);
-    }
+void server_boost_asio::server_stop() {
     g_running_flag = false;
     g_io_service.stop();
-    LOG(INFO) << "Server stop command issued";
+}
+
+void server_boost_asio::log_stats() {
+    LOG(INFO) << "Connections accepted: " << g_accept_count << ", shed: " << g_shed_count;
+    LOG(INFO) << "Connections reaped on timeout: " << asio_timeouts_get_reap_count();
+    LOG(INFO) << "Sessions allocated: " << asio_session_get_alloc_count()
+              << ", handlers allocated outside the sessions: " << asio_handler_get_alloc_count();
 }
 
 void server_boost_asio::client::connect_client() {
-    g_acceptor.async_accept([](boost::system::error_code ec, boost::asio::ip::tcp::socket socket_p) {
-        if (!ec) {
-            auto client_p = std::make_shared<boost::asio::ip::tcp::socket>(std::move(socket_p));
-            auto buffer_p = std::shared_ptr<char[]>{new char[EXPECTED_MESSAGE_SIZE]};
-            DLOG(INFO) << "New connection from " << get_client_name(client_p);
-            get_request_client(client_p, buffer_p);
+    g_acceptor.async_accept([](boost::system::error_code ec, boost::asio::ip::tcp::socket socket) {
+        if (!ec && socket_admission_near_limit(socket.native_handle())) {
+            socket_shed(socket.release());
+            g_shed_count++;
+        } else if (!ec) {
+            DLOG(INFO) << "New connection from " << get_client_peer(socket);
+            g_accept_count++;
+            asio_session_ptr session = asio_session::acquire(std::move(socket), stage_stats_now());
+            session->deadline.watch(g_timeouts, session->socket->native_handle());
+            get_request_client(std::move(session));
         } else {
             LOG(ERROR) << ec.message();
             g_rc = STATUS_FAIL;
@@ -108,45 +122,58 @@ void server_boost_asio::client::connect_client() {
     });
 }
 
-void server_boost_asio::client::get_request_client(std::shared_ptr<boost::asio::ip::tcp::socket> socket_p,
-                                                   std::shared_ptr<char[]> buffer_p) {
-    socket_p->async_read_some(
-            boost::asio::buffer(buffer_p.get(), EXPECTED_MESSAGE_SIZE),
-            [buffer_p, socket_p](boost::system::error_code ec, size_t length) {
+void server_boost_asio::client::get_request_client(asio_session_ptr session) {
+    // the handler takes the session, so it is referenced through a plain reference here
+    asio_session &s = *session;
+
+    s.socket->async_read_some(
+            boost::asio::buffer(s.buffer.get(), s.capacity),
+            make_alloc_handler(s.handler_memory, [session = std::move(session)](boost::system::error_code ec,
+                                                                                size_t length) mutable {
                 if (!ec) {
-                    DLOG(INFO) << "Read from " << get_client_name(socket_p) << " msg:\n"
-                               << std::string{buffer_p.get(), length};
-                    send_response_client(socket_p, buffer_p, length);
+                    if (0 != session->accept_time_ns) {
+                        stage_stats_record(STAGE_ACCEPT_TO_FIRST_READ, session->accept_time_ns);
+                        session->accept_time_ns = 0;
+                    }
+                    DLOG(INFO) << "Read from " << get_client_peer(*session->socket) << " msg:\n"
+                               << std::string{session->buffer.get(), length};
+                    session->deadline.refresh(true);
+                    send_response_client(std::move(session), length);
                 } else {
-                    close_client(socket_p);
+                    close_client(std::move(session));
                 }
-            }
+            })
     );
 }
 
-void server_boost_asio::client::send_response_client(std::shared_ptr<boost::asio::ip::tcp::socket> socket_p,
-                                                     std::shared_ptr<char[]> buffer_p, size_t length) {
-    socket_p->async_write_some(
-            boost::asio::buffer(buffer_p.get(), length),
-            [buffer_p, socket_p](boost::system::error_code ec, size_t length) {
+void server_boost_asio::client::send_response_client(asio_session_ptr session, size_t length) {
+    uint64_t send_time_ns = stage_stats_now();
+    asio_session &s = *session;
+
+    // async_write resumes partial writes itself, so the whole chunk is echoed before the next read
+    boost::asio::async_write(
+            *s.socket, boost::asio::buffer(s.buffer.get(), length),
+            make_alloc_handler(s.handler_memory, [session = std::move(session), length, send_time_ns](
+                    boost::system::error_code ec, size_t) mutable {
                 if (!ec) {
-                    get_request_client(socket_p, buffer_p);
+                    stage_stats_record(STAGE_WRITE, send_time_ns);
+                    session->deadline.refresh(false);
+                    // a read which filled the buffer means a bigger payload is streaming in
+                    if (length == session->capacity && session->capacity < FLAGS_stream_buffer_max_size) {
+                        session->grow_buffer();
+                    }
+                    get_request_client(std::move(session));
                 } else {
-                    close_client(socket_p);
+                    close_client(std::move(session));
                 }
-            }
+            })
     );
 }
 
-void server_boost_asio::client::close_client(std::shared_ptr<boost::asio::ip::tcp::socket> client_p) {
-    DLOG(INFO) << "Connection closed for " << get_client_name(client_p);
-    client_p->close();
+void server_boost_asio::client::close_client(asio_session_ptr session) {
+    DLOG(INFO) << "Connection closed for " << get_client_peer(*session->socket);
 }
 
-std::string server_boost_asio::client::get_client_name(
-        std::shared_ptr<boost::asio::ip::tcp::socket> client_p) {
-    std::stringstream s{};
-    s << client_p->remote_endpoint().address().to_string() << ":"
-      << client_p->remote_endpoint().port();
-    return s.str();
+peer_addr server_boost_asio::client::get_client_peer(boost::asio::ip::tcp::socket &socket) {
+    return socket_get_peer(socket.native_handle());
 }
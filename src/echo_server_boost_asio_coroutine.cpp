@@ -0,0 +1,195 @@
+// source link: https://www.boost.org/doc/libs/1_74_0/doc/html/boost_asio/overview/core/cpp20_coroutines.html
+#include "echo_server_boost_asio_coroutine.h"
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <exception>
+#include <memory>
+#include <string>
+#include <algorithm>
+#include <list>
+#include <thread>
+#include <atomic>
+
+#include "common/defines.h"
+#include "common/socket.h"
+#include "common/logging.h"
+#include "common/stage_stats.h"
+#include "common/config.h"
+#include "common/affinity.h"
+#include "common/asio_timeouts.h"
+#include "common/connection.h"
+
+// Every connection is one coroutine: its state lives in the coroutine frame, which asio allocates
+// from a per-thread recycling cache, so a read or write does not allocate a handler
+namespace server_boost_asio_coroutine {
+    std::atomic_bool g_running_flag = false;
+    std::atomic_int g_rc = STATUS_SUCCESS;
+
+    // defined before the io_context: the coroutine frames destroyed with it unwatch their deadlines
+    asio_timeouts g_timeouts{};
+    boost::asio::io_context g_io_context{};
+    boost::asio::ip::tcp::endpoint g_endpoint;
+    boost::asio::ip::tcp::acceptor g_acceptor{g_io_context};
+    std::list<std::thread> g_thread_list{};
+    std::atomic<size_t> g_accept_count = 0;
+    // connections reset by the admission control near the fd limit
+    std::atomic<size_t> g_shed_count = 0;
+
+    int server_init(uint16_t port);
+
+    int server_run();
+
+    void server_stop();
+
+    void log_stats();
+
+    void server_worker(size_t thread_index);
+
+    namespace client {
+        boost::asio::awaitable<void> connect_clients();
+
+        boost::asio::awaitable<void> client_session(boost::asio::ip::tcp::socket socket, uint64_t accept_time_ns);
+
+        peer_addr get_client_peer(boost::asio::ip::tcp::socket &socket);
+    }
+}
+
+const engine_t g_engine_boost_asio_coroutine{"boost_asio_coroutine", server_boost_asio_coroutine::server_init,
+                                             server_boost_asio_coroutine::server_run,
+                                             server_boost_asio_coroutine::server_stop,
+                                             server_boost_asio_coroutine::log_stats};
+
+int server_boost_asio_coroutine::server_run() {
+    g_timeouts.start(g_io_context);
+    boost::asio::co_spawn(g_io_context, client::connect_clients(), boost::asio::detached);
+
+    for (uint32_t i = 1; i < FLAGS_threads; ++i) {
+        g_thread_list.emplace_back(server_worker, i);
+    }
+    server_worker(0);
+    g_acceptor.close();
+    for (auto &thread: g_thread_list) {
+        thread.join();
+    }
+    g_timeouts.stop();
+    LOG(INFO) << "Server stopped";
+    return g_rc;
+}
+
+int server_boost_asio_coroutine::server_init(uint16_t port) {
+    try {
+        g_endpoint = boost::asio::ip::tcp::endpoint{boost::asio::ip::tcp::v4(), port};
+        g_acceptor.open(g_endpoint.protocol());
+        g_acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+        if (STATUS_SUCCESS != socket_tune_listener(g_acceptor.native_handle())) {
+            return STATUS_FAIL;
+        }
+        g_acceptor.bind(g_endpoint);
+        g_acceptor.listen(FLAGS_listen_backlog);
+    } catch (std::exception &e) {
+        LOG(ERROR) << e.what();
+        return STATUS_FAIL;
+    }
+    g_running_flag = true;
+
+    LOG(INFO) << "Server started";
+    return STATUS_SUCCESS;
+}
+
+void server_boost_asio_coroutine::server_stop() {
+    g_running_flag = false;
+    g_io_context.stop();
+}
+
+void server_boost_asio_coroutine::log_stats() {
+    LOG(INFO) << "Connections accepted: " << g_accept_count << ", shed: " << g_shed_count;
+    LOG(INFO) << "Connections reaped on timeout: " << asio_timeouts_get_reap_count();
+}
+
+void server_boost_asio_coroutine::server_worker(size_t thread_index) {
+    affinity_pin_thread(thread_index);
+    g_io_context.run();
+}
+
+boost::asio::awaitable<void> server_boost_asio_coroutine::client::connect_clients() {
+    boost::system::error_code ec;
+
+    while (g_running_flag) {
+        boost::asio::ip::tcp::socket socket = co_await g_acceptor.async_accept(
+                boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+        if (ec) {
+            if (g_running_flag) {
+                LOG(ERROR) << ec.message();
+                g_rc = STATUS_FAIL;
+            }
+            break; // while (g_running_flag)
+        }
+        if (socket_admission_near_limit(socket.native_handle())) {
+            socket_shed(socket.release());
+            g_shed_count.fetch_add(1, std::memory_order_relaxed);
+            continue; // while (g_running_flag)
+        }
+        DLOG(INFO) << "New connection from " << get_client_peer(socket);
+        g_accept_count.fetch_add(1, std::memory_order_relaxed);
+        boost::asio::co_spawn(g_io_context, client_session(std::move(socket), stage_stats_now()),
+                              boost::asio::detached);
+    } // while (g_running_flag)
+    g_io_context.stop();
+}
+
+boost::asio::awaitable<void> server_boost_asio_coroutine::client::client_session(boost::asio::ip::tcp::socket socket,
+                                                                                   uint64_t accept_time_ns) {
+    boost::system::error_code ec;
+    size_t capacity = FLAGS_message_size;
+    std::unique_ptr<char[]> buffer{new char[capacity]};
+    size_t length;
+    uint64_t send_time_ns;
+    asio_deadline deadline{};
+
+    deadline.watch(g_timeouts, socket.native_handle());
+    while (true) {
+        length = co_await socket.async_read_some(boost::asio::buffer(buffer.get(), capacity),
+                                                 boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+        if (ec) {
+            break; // while
+        }
+        if (0 != accept_time_ns) {
+            stage_stats_record(STAGE_ACCEPT_TO_FIRST_READ, accept_time_ns);
+            accept_time_ns = 0;
+        }
+        DLOG(INFO) << "Read from " << get_client_peer(socket) << " msg:\n" << std::string{buffer.get(), length};
+        deadline.refresh(true);
+
+        send_time_ns = stage_stats_now();
+        // async_write resumes partial writes itself, so the whole chunk is echoed before the next read
+        co_await boost::asio::async_write(socket, boost::asio::buffer(buffer.get(), length),
+                                          boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+        if (ec) {
+            break; // while
+        }
+        stage_stats_record(STAGE_WRITE, send_time_ns);
+        deadline.refresh(false);
+
+        // a read which filled the buffer means a bigger payload is streaming in
+        if (length == capacity && capacity < FLAGS_stream_buffer_max_size) {
+            capacity = std::min<size_t>(capacity * 2, FLAGS_stream_buffer_max_size);
+            buffer.reset(new char[capacity]);
+        }
+    } // while
+
+    DLOG(INFO) << "Connection closed for " << get_client_peer(socket);
+    // before the close: the sweep must not shut down a reused fd
+    deadline.unwatch();
+    socket.close(ec);
+}
+
+peer_addr server_boost_asio_coroutine::client::get_client_peer(boost::asio::ip::tcp::socket &socket) {
+    return socket_get_peer(socket.native_handle());
+}
@@ -1,117 +1,214 @@
 // source link: https://theboostcpplibraries.com/boost.asio-coroutines
 #include "echo_server_boost_asio_threaded.h"
-#include <boost/asio/io_service.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/post.hpp>
 #include <boost/asio/write.hpp>
 #include <boost/asio/buffer.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <exception>
-#include <csignal>
 #include <string>
-#include <sstream>
+#include <algorithm>
 #include <list>
+#include <memory>
+#include <vector>
 #include <thread>
+#include <atomic>
 
 #include "common/defines.h"
+#include "common/socket.h"
 #include "common/logging.h"
+#include "common/stage_stats.h"
+#include "common/config.h"
+#include "common/affinity.h"
+#include "common/asio_session.h"
+#include "common/connection.h"
 
-#define ECHO_SERVER_THREADS         (8)
+// With --asio_context_per_thread every thread runs its own io_context: the threads do not share a reactor
+// lock or an epoll descriptor, and all completions of a connection run on the thread it was handed to.
+// Otherwise all threads run one io_context, and completions of a socket hop between them.
+namespace server_boost_asio_threaded {
+    struct reactor_t {
+        // connections owned by the reactor; the least_loaded dispatch picks the minimum
+        std::atomic<size_t> connection_count = 0;
+        // before the io_context: the sessions destroyed with its pending handlers unwatch their deadlines
+        asio_timeouts timeouts{};
+        boost::asio::io_context io_context;
+        // keeps run() serving while the reactor has no connections
+        boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work_guard;
+
+        explicit reactor_t(int concurrency_hint) : io_context{concurrency_hint},
+                                                   work_guard{boost::asio::make_work_guard(io_context)} {
+            timeouts.start(io_context);
+        }
+
+        ~reactor_t() {
+            timeouts.stop();
+        }
+    };
+
+    // the socket type accepted into a reactor
+    using reactor_socket_t = boost::asio::ip::tcp::socket::rebind_executor<boost::asio::io_context::executor_type>::other;
 
-namespace server_boost_asio {
     bool g_running_flag = false;
     int g_rc = STATUS_SUCCESS;
 
-    boost::asio::io_service g_io_service{};
+    // one reactor per thread, or a single shared one; the acceptor runs on the first
+    std::vector<std::unique_ptr<reactor_t>> g_reactors{};
+    size_t g_next_reactor = 0;
     boost::asio::ip::tcp::endpoint g_endpoint;
-    boost::asio::ip::tcp::acceptor g_acceptor{g_io_service};
+    std::unique_ptr<boost::asio::ip::tcp::acceptor> g_acceptor{};
     std::list<std::thread> g_thread_list{};
+    size_t g_accept_count = 0;
+    // connections reset by the admission control near the fd limit
+    size_t g_shed_count = 0;
 
     int server_init(uint16_t port);
 
-    void server_terminate_handler(int signum);
+    int server_run();
 
-    void server_worker();
+    void server_stop();
+
+    void log_stats();
+
+    void server_worker(size_t thread_index);
+
+    // stops every reactor
+    void stop_reactors();
 
     namespace client {
+        // reactor of the next accepted connection
+        reactor_t &pick_reactor();
+
         void connect_client();
 
-        void close_client(std::shared_ptr<boost::asio::ip::tcp::socket> client_p);
+        // runs on the reactor of the socket, so the session comes from the free list of that thread
+        void start_session(reactor_t &reactor, boost::asio::ip::tcp::socket socket, uint64_t accept_time_ns);
+
+        void close_client(asio_session_ptr session);
 
-        void
-        get_request_client(std::shared_ptr<boost::asio::ip::tcp::socket> socket_p, std::shared_ptr<char[]> buffer_p);
+        void get_request_client(asio_session_ptr session);
 
-        void send_response_client(std::shared_ptr<boost::asio::ip::tcp::socket> socket_p,
-                                  std::shared_ptr<char[]> buffer_p, size_t length);
+        void send_response_client(asio_session_ptr session, size_t length);
 
-        std::string get_client_name(std::shared_ptr<boost::asio::ip::tcp::socket> client_p);
+        peer_addr get_client_peer(boost::asio::ip::tcp::socket &socket);
     }
 }
 
-int echo_server_boost_asio_threaded_main(uint16_t port) {
-    std::string msg_buffer{};
-
-    using namespace server_boost_asio;
-
-    if (STATUS_SUCCESS != server_init(port)) {
-        return STATUS_FAIL;
-    }
-    g_running_flag = true;
+const engine_t g_engine_boost_asio_threaded{"boost_asio_threaded", server_boost_asio_threaded::server_init,
+                                            server_boost_asio_threaded::server_run,
+                                            server_boost_asio_threaded::server_stop,
+                                            server_boost_asio_threaded::log_stats};
 
+int server_boost_asio_threaded::server_run() {
     client::connect_client();
 
-    for (int i = 0; i < ECHO_SERVER_THREADS - 1; ++i) {
-        g_thread_list.emplace_back(server_worker);
+    for (uint32_t i = 1; i < FLAGS_threads; ++i) {
+        g_thread_list.emplace_back(server_worker, i);
     }
-    server_worker();
-    g_acceptor.close();
+    server_worker(0);
+    stop_reactors();
     for (auto &thread: g_thread_list) {
         thread.join();
     }
+    g_acceptor.reset();
+    // the pending handlers release their sessions; a session only has handlers on its own reactor
+    g_reactors.clear();
     LOG(INFO) << "Server stopped";
     return g_rc;
 }
 
-int server_boost_asio::server_init(uint16_t port) {
+int server_boost_asio_threaded::server_init(uint16_t port) {
+    size_t reactor_num = FLAGS_asio_context_per_thread ? FLAGS_threads : 1;
+
+    // a per-thread io_context is run by a single thread, so it may skip the cross-thread wakeups
+    for (size_t i = 0; i < reactor_num; ++i) {
+        g_reactors.emplace_back(std::make_unique<reactor_t>(
+                FLAGS_asio_context_per_thread ? 1 : BOOST_ASIO_CONCURRENCY_HINT_DEFAULT));
+    }
     try {
+        g_acceptor = std::make_unique<boost::asio::ip::tcp::acceptor>(g_reactors[0]->io_context);
         g_endpoint = boost::asio::ip::tcp::endpoint{boost::asio::ip::tcp::v4(), port};
-        g_acceptor.open(g_endpoint.protocol());
-        g_acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
-        g_acceptor.set_option(boost::asio::ip::tcp::acceptor::receive_buffer_size(EXPECTED_MESSAGE_SIZE));
-        g_acceptor.set_option(boost::asio::ip::tcp::acceptor::send_buffer_size(EXPECTED_MESSAGE_SIZE));
-        g_acceptor.bind(g_endpoint);
-        g_acceptor.listen(SERVER_LISTEN_BACKLOG_SIZE);
+        g_acceptor->open(g_endpoint.protocol());
+        g_acceptor->set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+        if (STATUS_SUCCESS != socket_tune_listener(g_acceptor->native_handle())) {
+            g_acceptor.reset();
+            g_reactors.clear();
+            return STATUS_FAIL;
+        }
+        g_acceptor->bind(g_endpoint);
+        g_acceptor->listen(FLAGS_listen_backlog);
     } catch (std::exception &e) {
         LOG(ERROR) << e.what();
+        g_acceptor.reset();
+        g_reactors.clear();
         return STATUS_FAIL;
     }
-    signal(SIGINT, server_terminate_handler);
+    // an idle session keeps its --message_size buffer
+    log_connection_footprint(sizeof(asio_session), FLAGS_message_size, connection_timeouts_enabled());
+    g_running_flag = true;
 
-    LOG(INFO) << "Server started";
+    LOG(INFO) << "Server started with " << reactor_num << " io_context(s)";
     return STATUS_SUCCESS;
 }
 
-void server_boost_asio::server_terminate_handler(int signum) {
-    if (!g_running_flag) {
-        g_acceptor.close();
-        LOG(WARNING) << "Server force stop";
-        logging_deinit();
-        exit(STATUS_FAIL);
-    }
+void server_boost_asio_threaded::server_stop() {
     g_running_flag = false;
-    g_io_service.stop();
-    LOG(INFO) << "Server stop command issued";
+    stop_reactors();
 }
 
-void server_boost_asio::server_worker() {
-    g_io_service.run();
+void server_boost_asio_threaded::stop_reactors() {
+    for (auto &reactor: g_reactors) {
+        reactor->io_context.stop();
+    }
+}
+
+void server_boost_asio_threaded::log_stats() {
+    LOG(INFO) << "Connections accepted: " << g_accept_count << ", shed: " << g_shed_count;
+    LOG(INFO) << "Connections reaped on timeout: " << asio_timeouts_get_reap_count();
+    LOG(INFO) << "Sessions allocated: " << asio_session_get_alloc_count()
+              << ", handlers allocated outside the sessions: " << asio_handler_get_alloc_count();
+}
+
+void server_boost_asio_threaded::server_worker(size_t thread_index) {
+    affinity_pin_thread(thread_index);
+    g_reactors[thread_index % g_reactors.size()]->io_context.run();
 }
 
-void server_boost_asio::client::connect_client() {
-    g_acceptor.async_accept([](boost::system::error_code ec, boost::asio::ip::tcp::socket socket_p) {
-        if (!ec) {
-            auto client_p = std::make_shared<boost::asio::ip::tcp::socket>(std::move(socket_p));
-            auto buffer_p = std::shared_ptr<char[]>{new char[EXPECTED_MESSAGE_SIZE]};
-            DLOG(INFO) << "New connection from " << get_client_name(client_p);
-            get_request_client(client_p, buffer_p);
+server_boost_asio_threaded::reactor_t &server_boost_asio_threaded::client::pick_reactor() {
+    size_t index = 0;
+
+    if (FLAGS_asio_dispatch == ASIO_DISPATCH_ROUND_ROBIN) {
+        index = g_next_reactor++ % g_reactors.size();
+    } else {
+        for (size_t i = 1; i < g_reactors.size(); ++i) {
+            if (g_reactors[i]->connection_count.load(std::memory_order_relaxed) <
+                g_reactors[index]->connection_count.load(std::memory_order_relaxed)) {
+                index = i;
+            }
+        }
+    }
+    return *g_reactors[index];
+}
+
+void server_boost_asio_threaded::client::connect_client() {
+    reactor_t &reactor = pick_reactor();
+
+    // the socket belongs to the picked reactor from the start, so all its completions run there
+    g_acceptor->async_accept(reactor.io_context, [&reactor](boost::system::error_code ec,
+                                                            reactor_socket_t reactor_socket) {
+        if (!ec && socket_admission_near_limit(reactor_socket.native_handle())) {
+            socket_shed(reactor_socket.release());
+            g_shed_count++;
+        } else if (!ec) {
+            boost::asio::ip::tcp::socket socket{std::move(reactor_socket)};
+            DLOG(INFO) << "New connection from " << get_client_peer(socket);
+            g_accept_count++;
+            reactor.connection_count.fetch_add(1, std::memory_order_relaxed);
+            boost::asio::post(reactor.io_context, [&reactor, socket = std::move(socket),
+                    accept_time_ns = stage_stats_now()]() mutable {
+                start_session(reactor, std::move(socket), accept_time_ns);
+            });
         } else {
             LOG(ERROR) << ec.message();
             g_rc = STATUS_FAIL;
@@ -120,50 +217,72 @@ void server_boost_asio::client::connect_client() {
         if (g_running_flag) {
             connect_client();
         } else {
-            g_io_service.stop();
+            stop_reactors();
         }
     });
 }
 
-void server_boost_asio::client::get_request_client(std::shared_ptr<boost::asio::ip::tcp::socket> socket_p,
-                                                   std::shared_ptr<char[]> buffer_p) {
-    socket_p->async_read_some(
-            boost::asio::buffer(buffer_p.get(), EXPECTED_MESSAGE_SIZE),
-            [buffer_p, socket_p](boost::system::error_code ec, size_t length) {
+void server_boost_asio_threaded::client::start_session(reactor_t &reactor, boost::asio::ip::tcp::socket socket,
+                                                       uint64_t accept_time_ns) {
+    asio_session_ptr session = asio_session::acquire(std::move(socket), accept_time_ns);
+
+    session->connection_count = &reactor.connection_count;
+    session->deadline.watch(reactor.timeouts, session->socket->native_handle());
+    get_request_client(std::move(session));
+}
+
+void server_boost_asio_threaded::client::get_request_client(asio_session_ptr session) {
+    // the handler takes the session, so it is referenced through a plain reference here
+    asio_session &s = *session;
+
+    s.socket->async_read_some(
+            boost::asio::buffer(s.buffer.get(), s.capacity),
+            make_alloc_handler(s.handler_memory, [session = std::move(session)](boost::system::error_code ec,
+                                                                                size_t length) mutable {
                 if (!ec) {
-                    DLOG(INFO) << "Read from " << get_client_name(socket_p) << " msg:\n"
-                               << std::string{buffer_p.get(), length};
-                    send_response_client(socket_p, buffer_p, length);
+                    if (0 != session->accept_time_ns) {
+                        stage_stats_record(STAGE_ACCEPT_TO_FIRST_READ, session->accept_time_ns);
+                        session->accept_time_ns = 0;
+                    }
+                    DLOG(INFO) << "Read from " << get_client_peer(*session->socket) << " msg:\n"
+                               << std::string{session->buffer.get(), length};
+                    session->deadline.refresh(true);
+                    send_response_client(std::move(session), length);
                 } else {
-                    close_client(socket_p);
+                    close_client(std::move(session));
                 }
-            }
+            })
     );
 }
 
-void server_boost_asio::client::send_response_client(std::shared_ptr<boost::asio::ip::tcp::socket> socket_p,
-                                                     std::shared_ptr<char[]> buffer_p, size_t length) {
-    socket_p->async_write_some(
-            boost::asio::buffer(buffer_p.get(), length),
-            [buffer_p, socket_p](boost::system::error_code ec, size_t length) {
+void server_boost_asio_threaded::client::send_response_client(asio_session_ptr session, size_t length) {
+    uint64_t send_time_ns = stage_stats_now();
+    asio_session &s = *session;
+
+    // async_write resumes partial writes itself, so the whole chunk is echoed before the next read
+    boost::asio::async_write(
+            *s.socket, boost::asio::buffer(s.buffer.get(), length),
+            make_alloc_handler(s.handler_memory, [session = std::move(session), length, send_time_ns](
+                    boost::system::error_code ec, size_t) mutable {
                 if (!ec) {
-                    get_request_client(socket_p, buffer_p);
+                    stage_stats_record(STAGE_WRITE, send_time_ns);
+                    session->deadline.refresh(false);
+                    // a read which filled the buffer means a bigger payload is streaming in
+                    if (length == session->capacity && session->capacity < FLAGS_stream_buffer_max_size) {
+                        session->grow_buffer();
+                    }
+                    get_request_client(std::move(session));
                 } else {
-                    close_client(socket_p);
+                    close_client(std::move(session));
                 }
-            }
+            })
     );
 }
 
-void server_boost_asio::client::close_client(std::shared_ptr<boost::asio::ip::tcp::socket> client_p) {
-    DLOG(INFO) << "Connection closed for " << get_client_name(client_p);
-    client_p->close();
+void server_boost_asio_threaded::client::close_client(asio_session_ptr session) {
+    DLOG(INFO) << "Connection closed for " << get_client_peer(*session->socket);
 }
 
-std::string server_boost_asio::client::get_client_name(
-        std::shared_ptr<boost::asio::ip::tcp::socket> client_p) {
-    std::stringstream s{};
-    s << client_p->remote_endpoint().address().to_string() << ":"
-      << client_p->remote_endpoint().port();
-    return s.str();
+peer_addr server_boost_asio_threaded::client::get_client_peer(boost::asio::ip::tcp::socket &socket) {
+    return socket_get_peer(socket.native_handle());
 }
@@ -4,67 +4,91 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <sys/poll.h>
-#include <csignal>
+#include <sys/eventfd.h>
 #include <cstring>
+#include <cerrno>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <thread>
 #include <atomic>
-#include <mutex>
 #include <memory>
-#include <list>
 
 #include "common/io.h"
 #include "common/defines.h"
 #include "common/socket.h"
 #include "common/logging.h"
-#include "common/thread_safe_radio_queue.h"
+#include "common/lock_free_radio_queue.h"
+#include "common/work_steal_deque.h"
+#include "common/slot_map.h"
+#include "common/buffer_pool.h"
+#include "common/stage_stats.h"
+#include "common/config.h"
+#include "common/affinity.h"
+#include "common/timing_wheel.h"
+#include "common/connection.h"
 
 
-#define WORKER_NUM                      (8)
-#define WORK_QUEUE_MAX_SIZE             (0)
-#define GC_THRESHOLD                    (10)
-#define FD_POOL_TIMEOUT_MS              (1)
 
 #define SERVER_FD_INDEX                 (0)
+#define WAKEUP_FD_INDEX                 (1)
+#define FIRST_CLIENT_FD_INDEX           (2)
 #define FD_POOL_DUMMY_FD                (-1)
+#define SERVER_FD_EVENTS                (POLLIN | POLLERR | POLLHUP | POLLNVAL)
 #define INFTIM                          (-1)
 
 
 // Type declarations
 namespace server_custom_thread_pool {
     namespace client {
-        enum class client_state {
+        enum class client_state : uint8_t {
             IDLE,
             READ,
             WRITE,
             CLOSED
         };
 
+        // Slots are recycled by g_client_db; a slot is reset on connect.
+        // The state hands the client between the threads: a transition is one compare-exchange,
+        // and the thread which made it owns the client until the next one
         struct client_data {
-            const int fd;
-            const std::string name;
-            size_t pool_index;
-            client_state state;
-            std::mutex mutex{};
-
-            client_data(const int fd, std::string &&name, size_t pool_index, client_state state)
-                    : fd(fd), name(std::move(name)), pool_index(pool_index), state(state) {};
-
-            ~client_data() = default;
+            // 0 after the first read
+            uint64_t accept_time_ns = 0;
+            slot_key key{};
+            peer_addr peer{};
+            int fd = -1;
+            uint32_t pool_index = 0;
+            // idle deadline; owned by the main thread
+            timer_id timer = TIMER_ID_NONE;
+            std::atomic<client_state> state = client_state::CLOSED;
+            // the deadline passed while a worker had the client; owned by the main thread
+            bool overdue = false;
         };
     }
     namespace worker {
         struct job_data {
             client::client_data *client;
-            std::string message{};
+            // pooled, so passing a message between threads does not touch the heap
+            pooled_buffer message{};
+            // for the queue sojourn time
+            uint64_t enqueue_time_ns = 0;
 
             job_data() : client(nullptr) {}
 
-            explicit job_data(client::client_data *client) : client(client) {}
+            explicit job_data(client::client_data *client) : client(client), enqueue_time_ns(stage_stats_now()) {}
+
+            job_data(client::client_data *client, pooled_buffer &&message) : client(client),
+                                                                             message(std::move(message)),
+                                                                             enqueue_time_ns(stage_stats_now()) {}
+        };
 
-            job_data(client::client_data *client, std::string &&message) : client(client),
-                                                                           message(std::move(message)) {}
+        struct worker_data {
+            // follow-up jobs of the clients handled by this worker
+            t_work_steal_deque<job_data> local_jobs{};
+            // stats; written by the owner only
+            std::atomic<size_t> local_job_count = 0;
+            std::atomic<size_t> global_job_count = 0;
+            std::atomic<size_t> stolen_job_count = 0;
         };
     }
 }
@@ -72,69 +96,108 @@ namespace server_custom_thread_pool {
 
 namespace server_custom_thread_pool {
     bool g_running_flag = false;
-    std::atomic<size_t> g_garbage_count = 0;
     int g_server_fd = -1;
+    // client slot index + FIRST_CLIENT_FD_INDEX; owned by the main thread
     std::vector<pollfd> g_fd_pool_db{};
-    std::list<client::client_data> g_client_db{};
-    std::mutex g_db_mutex{};
+    // owned by the main thread; workers only use pointers to the values, which never move
+    slot_map<client::client_data> g_client_db{};
     std::vector<std::thread> g_worker_pool{};
-    t_queue_radio<worker::job_data> g_job_pool{WORK_QUEUE_MAX_SIZE};
+    // sized by --work_queue_size in server_init
+    std::unique_ptr<t_queue_lock_free_radio<worker::job_data>> g_job_pool{};
+    std::vector<std::unique_ptr<worker::worker_data>> g_worker_data_db{};
+    // Workers hand re-armed and closed clients to the dispatcher, which exclusively owns the client DB
+    int g_wakeup_fd = -1;
+    std::atomic_bool g_wakeup_pending = false;
+    std::unique_ptr<t_queue_lock_free<slot_key>> g_rearm_queue{};
+    // A client holds at most one entry of g_job_pool or g_rearm_queue, so with fewer clients than this
+    // neither ring fills up and the blocking pushes of the dispatcher and the workers never wait on each other
+    size_t g_max_clients = 0;
+    // worker_data of the current worker thread; nullptr in the main thread
+    thread_local worker::worker_data *t_worker_data = nullptr;
+    size_t g_accept_count = 0;
+    // connections reset by the admission control and listener pauses near the fd limit
+    size_t g_shed_count = 0;
+    size_t g_defer_count = 0;
+    // idle deadlines of the clients, refreshed when a client is re-armed; owned by the main thread.
+    // The owner of a timer is the client slot index
+    timing_wheel g_timers{};
+    // read once per poll batch
+    uint64_t g_now_ms = 0;
+    // idle clients reaped by the main thread and writes failed by SO_SNDTIMEO in the workers
+    std::atomic<size_t> g_reap_count = 0;
 
     int server_init(uint16_t port);
 
+    int server_run();
+
     void server_deinit();
 
-    void server_terminate_handler(int signum);
+    void server_stop();
+
+    void log_stats();
+
+    void wakeup_dispatcher();
 
-    // Garbage Collector
-    void gc_routine(bool force = false);
+    void rearm_clients();
+
+    // poll timeout: until the next deadline
+    int get_wait_timeout();
 
     namespace client {
-        int connect_client();
+        // accepts up to --accept_batch pending connections
+        int connect_clients();
+
+        // stops polling the listener until a client is released; the new connections wait in the listen backlog
+        void defer_clients();
 
         void close_client(client_data &client);
 
-        int get_request_client(client_data &client, std::string &msg_buffer);
+        void release_client(client_data &client);
+
+        int get_request_client(client_data &client, pooled_buffer &msg_buffer);
+
+        int send_response_client(client_data &client, const pooled_buffer &msg_buffer);
 
-        int send_response_client(client_data &client, const std::string &msg_buffer);
+        // closes the idle clients whose deadline passed; call only from main thread
+        void reap_clients();
     }
 
     namespace worker {
-        void worker_routine();
+        void worker_routine(size_t worker_index);
+
+        worker::job_data get_job(size_t worker_index);
+
+        bool steal_job(size_t worker_index, worker::job_data &job);
+
+        void log_worker_stats();
 
         void schedule_read_job(client::client_data &client);
 
-        void schedule_write_job(client::client_data &client, std::string &&msg_buffer);
+        void schedule_write_job(client::client_data &client, pooled_buffer &&msg_buffer);
 
         void schedule_idle_job(client::client_data &client);
     }
 }
 
 
-int echo_server_custom_thread_pool_main(uint16_t port) {
-    int trig_fds_count;
-
-    using namespace server_custom_thread_pool;
+const engine_t g_engine_custom_thread_pool{"custom_thread_pool", server_custom_thread_pool::server_init,
+                                           server_custom_thread_pool::server_run,
+                                           server_custom_thread_pool::server_stop,
+                                           server_custom_thread_pool::log_stats};
 
-    if (STATUS_SUCCESS != server_init(port)) {
-        return STATUS_FAIL;
-    }
+int server_custom_thread_pool::server_run() {
+    int trig_fds_count;
 
-    g_running_flag = true;
     while (g_running_flag) {
-        trig_fds_count = poll(g_fd_pool_db.data(), g_fd_pool_db.size(), FD_POOL_TIMEOUT_MS);
+        trig_fds_count = poll(g_fd_pool_db.data(), g_fd_pool_db.size(), get_wait_timeout());
+        g_now_ms = timing_wheel_now_ms();
         if (trig_fds_count < 0) {
             if (EINTR == errno) {
                 continue; // while (g_running_flag)
             } else if (EINVAL == errno) {
-                // enforce GC to free up space if possible
-                if (g_garbage_count > 0) {
-                    gc_routine(true);
-                } else {
-                    // run out of FD; should not happen if we check fd num limit before accept
-                    PLOG(ERROR) << "poll fail; run out of file descriptors";
-                    break; // while
-                }
+                // run out of FD; should not happen if we check fd num limit before accept
+                PLOG(ERROR) << "poll fail; run out of file descriptors";
+                break; // while
             }
             if (g_running_flag) {
                 PLOG(ERROR) << "Error calling poll";
@@ -143,9 +206,16 @@ int echo_server_custom_thread_pool_main(uint16_t port) {
             }
             break; // while (g_running_flag)
         } else if (0 == trig_fds_count) {
+            client::reap_clients();
             continue; // while (g_running_flag)
         }
 
+        // Re-armed clients are handled first: none of them can be closed by the code below before that
+        if (g_fd_pool_db[WAKEUP_FD_INDEX].revents) {
+            trig_fds_count--;
+            rearm_clients();
+        }
+
         // Server socket fd event
         if (g_fd_pool_db[SERVER_FD_INDEX].revents) {
             trig_fds_count--;
@@ -157,30 +227,28 @@ int echo_server_custom_thread_pool_main(uint16_t port) {
                 LOG(INFO) << "Server socket closed";
                 break; // while (g_running_flag)
             }
-            if (STATUS_SUCCESS != client::connect_client()) {
+            if (STATUS_SUCCESS != client::connect_clients()) {
                 break;  // while (g_running_flag)
             }
         }
 
         // Client requests handling
-        for (auto &elem: g_client_db) {
-            if (0 == trig_fds_count) {
-                break; // for
-            } else if (0 == g_fd_pool_db[elem.pool_index].revents) {
+        for (size_t index = FIRST_CLIENT_FD_INDEX; index < g_fd_pool_db.size() && trig_fds_count > 0; ++index) {
+            if (0 == g_fd_pool_db[index].revents) {
                 continue; // for
             }
             trig_fds_count--;
+            client::client_data &client = g_client_db[index - FIRST_CLIENT_FD_INDEX];
 
             // Error handling
-            if (POLLIN != g_fd_pool_db[elem.pool_index].revents) {
-                client::close_client(elem);
+            if (POLLIN != g_fd_pool_db[index].revents) {
+                client::close_client(client);
                 continue; // for
             }
-            worker::schedule_read_job(elem);
+            worker::schedule_read_job(client);
         } // for
 
-        // Cleanup garbage in DB
-        gc_routine();
+        client::reap_clients();
     } // while (g_running_flag)
 
     server_deinit();
@@ -192,47 +260,71 @@ int server_custom_thread_pool::server_init(uint16_t port) {
     if (g_server_fd < 0) {
         return STATUS_FAIL;
     }
+    // the accept batch ends when the backlog is empty
+    if (STATUS_SUCCESS != socket_set_nonblocking(g_server_fd)) {
+        close(g_server_fd);
+        return STATUS_FAIL;
+    }
 
-    g_fd_pool_db.reserve(SERVER_EXPECT_CONNECTIONS);
-    g_worker_pool.reserve(WORKER_NUM);
+    g_fd_pool_db.reserve(FLAGS_expect_connections);
+    g_client_db.reserve(FLAGS_expect_connections);
+    // the messages are pooled buffers held only while a worker echoes them
+    log_connection_footprint(decltype(g_client_db)::slot_size + sizeof(pollfd), 0, 0 != FLAGS_idle_timeout_ms);
+    g_worker_pool.reserve(FLAGS_threads);
+    g_worker_data_db.reserve(FLAGS_threads);
+    for (uint32_t i = 0; i < FLAGS_threads; ++i) {
+        g_worker_data_db.emplace_back(std::make_unique<worker::worker_data>());
+    }
 
-    g_fd_pool_db.emplace_back(pollfd{g_server_fd, POLLIN | POLLERR | POLLHUP | POLLNVAL, 0});
-    g_job_pool.publish();
+    if (FLAGS_work_queue_size < FLAGS_expect_connections) {
+        LOG(ERROR) << "Error --work_queue_size " << FLAGS_work_queue_size << " is below --expect_connections "
+                   << FLAGS_expect_connections;
+        close(g_server_fd);
+        return STATUS_FAIL;
+    }
+    g_job_pool = std::make_unique<t_queue_lock_free_radio<worker::job_data>>(FLAGS_work_queue_size);
+    g_rearm_queue = std::make_unique<t_queue_lock_free<slot_key>>(FLAGS_work_queue_size);
+    // the poison pill passed between the stopping workers takes a job slot too
+    g_max_clients = g_job_pool->get_max_size() - FLAGS_threads;
+
+    g_wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (g_wakeup_fd < 0) {
+        PLOG(ERROR) << "Error calling eventfd";
+        close(g_server_fd);
+        return STATUS_FAIL;
+    }
+
+    g_fd_pool_db.emplace_back(pollfd{g_server_fd, SERVER_FD_EVENTS, 0});
+    g_fd_pool_db.emplace_back(pollfd{g_wakeup_fd, POLLIN, 0});
+    g_job_pool->publish();
 
     DLOG(INFO) << "Starting workers...";
     // Start workers
-    for (uint16_t i = 0; i < WORKER_NUM; ++i) {
-        g_worker_pool.emplace_back(worker::worker_routine);
+    for (size_t i = 0; i < g_worker_data_db.size(); ++i) {
+        g_worker_pool.emplace_back(worker::worker_routine, i);
     }
     DLOG(INFO) << "All workers started";
 
-    signal(SIGINT, server_terminate_handler);
-
+    g_running_flag = true;
     return STATUS_SUCCESS;
 }
 
 void server_custom_thread_pool::server_deinit() {
     DLOG(INFO) << "Stopping workers...";
     // Stop workers
-    g_job_pool.unpublish(); // should send poison pill
-    for (uint16_t i = 0; i < WORKER_NUM; ++i) {
+    g_job_pool->unpublish(); // should send poison pill
+    for (size_t i = 0; i < g_worker_pool.size(); ++i) {
         g_worker_pool[i].join();
     }
     DLOG(INFO) << "All workers stopped";
 
+    close(g_wakeup_fd);
     close(g_server_fd);
     LOG(INFO) << "Server stopped";
 }
 
-void server_custom_thread_pool::server_terminate_handler(int signum) {
-    if (!g_running_flag) {
-        close(g_server_fd);
-        LOG(WARNING) << "Server force stop";
-        logging_deinit();
-        exit(STATUS_FAIL);
-    }
+void server_custom_thread_pool::server_stop() {
     g_running_flag = false;
-    LOG(INFO) << "Server stop command issued";
     if (-1 != g_server_fd) {
         shutdown(g_server_fd, SHUT_RDWR);
     } else {
@@ -240,140 +332,276 @@ void server_custom_thread_pool::server_terminate_handler(int signum) {
     }
 }
 
-void server_custom_thread_pool::gc_routine(bool force) {
-    std::lock_guard<std::mutex> db_lg{g_db_mutex};
-    size_t index;
-    size_t garbage_collected = 0;
-    if (g_garbage_count < GC_THRESHOLD && !force) {
+// the workers are joined by now
+void server_custom_thread_pool::log_stats() {
+    LOG(INFO) << "Connections accepted: " << g_accept_count << ", shed: " << g_shed_count
+              << ", deferred accepts: " << g_defer_count;
+    LOG(INFO) << "Connections reaped on timeout: " << g_reap_count;
+    worker::log_worker_stats();
+    LOG(INFO) << "Message buffers allocated: " << buffer_pool_get_alloc_count();
+}
+
+// called by workers; one eventfd write per dispatcher wakeup however many clients were re-armed
+void server_custom_thread_pool::wakeup_dispatcher() {
+    uint64_t value = 1;
+    if (g_wakeup_pending.exchange(true)) {
         return;
     }
+    if (sizeof(value) != write(g_wakeup_fd, &value, sizeof(value))) {
+        APLOG(ERROR) << "Error writing to eventfd";
+    }
+}
 
-    g_client_db.remove_if([&garbage_collected](client::client_data &elem) {
-        std::lock_guard<std::mutex> lg{elem.mutex};
-        bool rc;
-        rc = client::client_state::CLOSED == elem.state;
-        if (rc) {
-            garbage_collected++;
+// call only from main thread
+void server_custom_thread_pool::rearm_clients() {
+    uint64_t value;
+    slot_key key;
+    client::client_data *client;
+    client::client_state state;
+
+    if (sizeof(value) != read(g_wakeup_fd, &value, sizeof(value)) && EAGAIN != errno) {
+        APLOG(ERROR) << "Error reading from eventfd";
+    }
+    // clients queued after this point issue a new wakeup
+    g_wakeup_pending = false;
+    while (g_rearm_queue->try_pop_front(key)) {
+        client = g_client_db.get(key);
+        if (nullptr == client) {
+            continue; // while
         }
-        return rc;
-    });
-
-    g_fd_pool_db.clear();
-    g_fd_pool_db.reserve(g_client_db.size() + 1 /* for server fd */ + 1 /* for server fd */);
-    g_fd_pool_db.emplace_back(pollfd{g_server_fd, POLLIN | POLLERR | POLLHUP | POLLNVAL, 0});
-    index = 1;
-    for (auto &elem: g_client_db) {
-        {
-            std::lock_guard<std::mutex> lg{elem.mutex};
-            elem.pool_index = index;
-            index++;
-            if (client::client_state::IDLE == elem.state) {
-                g_fd_pool_db.emplace_back(pollfd{elem.fd, POLLIN | POLLERR | POLLHUP | POLLNVAL, 0});
-            } else {
-                g_fd_pool_db.emplace_back(pollfd{FD_POOL_DUMMY_FD, POLLIN | POLLERR | POLLHUP | POLLNVAL, 0});
+        state = client->state.load(std::memory_order_acquire);
+        if (client::client_state::IDLE == state) {
+            g_fd_pool_db[client->pool_index].fd = client->fd;
+            // an echo is done: the idle time counts from here
+            client->overdue = false;
+            if (TIMER_ID_NONE != client->timer) {
+                g_timers.update(client->timer, connection_deadline_ms(g_now_ms, false));
             }
+        } else if (client::client_state::CLOSED == state) {
+            client::release_client(*client);
         }
     }
+}
 
-    LOG(INFO) << "GC clean up " << g_garbage_count << " elements";
-    g_garbage_count -= garbage_collected;
+int server_custom_thread_pool::get_wait_timeout() {
+    int timeout_ms = g_timers.next_timeout_ms(timing_wheel_now_ms());
+    return -1 == timeout_ms ? INFTIM : timeout_ms;
 }
 
-int server_custom_thread_pool::client::connect_client() {
+int server_custom_thread_pool::client::connect_clients() {
     struct sockaddr_in client_addr{};
-    socklen_t client_addr_len = sizeof(client_addr);
+    socklen_t client_addr_len;
     int client_sock_fd;
+    bool near_limit;
+
+    for (uint32_t budget = FLAGS_accept_batch; budget > 0; --budget) {
+        if (g_client_db.get_size() >= g_max_clients) {
+            ALOG(WARNING) << "Work queues hold " << g_max_clients << " clients, the new connections wait for a "
+                          << "client to close";
+            client::defer_clients();
+            return STATUS_SUCCESS;
+        }
+        // the clients stay blocking: the workers read and write them only once poll reports them
+        client_sock_fd = socket_accept(g_server_fd, SOCK_CLOEXEC, &client_addr, &client_addr_len);
+        if (client_sock_fd < 0) {
+            if (EAGAIN == errno || EWOULDBLOCK == errno) {
+                return STATUS_SUCCESS;
+            } else if (EMFILE == errno || ENFILE == errno) {
+                ALOG(WARNING) << "Out of file descriptors, the new connections wait for a client to close";
+                client::defer_clients();
+                return STATUS_SUCCESS;
+            }
+            PLOG(ERROR) << "Error calling accept4()";
+            return STATUS_FAIL;
+        }
+        near_limit = socket_admission_near_limit(client_sock_fd);
+        if (near_limit && socket_admission_sheds()) {
+            socket_shed(client_sock_fd);
+            g_shed_count++;
+            continue; // for
+        }
 
-    client_sock_fd = accept(g_server_fd, (struct sockaddr *) &client_addr, &client_addr_len);
-    if (client_sock_fd < 0) {
-        PLOG(ERROR) << "Error calling accept()";
-        return STATUS_FAIL;
-    }
-    {
-        std::lock_guard<std::mutex> db_lg{g_db_mutex};
-        g_fd_pool_db.emplace_back(pollfd{client_sock_fd, POLLIN | POLLERR | POLLHUP | POLLNVAL, 0});
-        g_client_db.emplace_back(client_sock_fd, get_socket_addr_str(&client_addr, client_addr_len),
-                                 g_fd_pool_db.size() - 1, client::client_state::IDLE);
+        // a freed slot is reused first, so the poll set grows only with the peak connections number
+        slot_key key = g_client_db.insert();
+        client_data &client = g_client_db[key.index];
+        client.fd = client_sock_fd;
+        client.peer = peer_addr_from(client_addr);
+        client.pool_index = key.index + FIRST_CLIENT_FD_INDEX;
+        client.key = key;
+        client.accept_time_ns = stage_stats_now();
+        client.overdue = false;
+        // publishes the fields to the worker which takes the client
+        client.state.store(client::client_state::IDLE, std::memory_order_release);
+        // the workers write blocking; a peer which does not read fails the write after --write_timeout_ms
+        if (0 != FLAGS_write_timeout_ms) {
+            socket_set_timeouts(client_sock_fd, 0, FLAGS_write_timeout_ms);
+        }
+        if (0 != FLAGS_idle_timeout_ms) {
+            client.timer = g_timers.add(connection_deadline_ms(g_now_ms, false), key.index);
+        }
+        g_accept_count++;
+        if (client.pool_index == g_fd_pool_db.size()) {
+            g_fd_pool_db.emplace_back(pollfd{client_sock_fd, POLLIN | POLLERR | POLLHUP | POLLNVAL, 0});
+        } else {
+            g_fd_pool_db[client.pool_index] = pollfd{client_sock_fd, POLLIN | POLLERR | POLLHUP | POLLNVAL, 0};
+        }
+        DLOG(INFO) << "New connection from " << client.peer;
+
+        // the reserve is kept for this one; the next connections wait
+        if (near_limit) {
+            client::defer_clients();
+            return STATUS_SUCCESS;
+        }
     }
-    DLOG(INFO) << "New connection from " << g_client_db.back().name;
     return STATUS_SUCCESS;
 }
 
+void server_custom_thread_pool::client::defer_clients() {
+    g_fd_pool_db[SERVER_FD_INDEX].events = 0;
+    g_defer_count++;
+}
+
 void server_custom_thread_pool::client::close_client(client_data &client) {
-    {
-        std::lock_guard<std::mutex> lg{client.mutex};
-        if (client::client_state::CLOSED == client.state) {
-            LOG(WARNING) << "Try to close closed client " << client.name;
-            return;
-        }
-        client.state = client::client_state::CLOSED;
-        close(client.fd);
-        g_garbage_count++;
+    // only the thread which moves the client to CLOSED closes the socket
+    if (client::client_state::CLOSED == client.state.exchange(client::client_state::CLOSED,
+                                                              std::memory_order_acq_rel)) {
+        ALOG(WARNING) << "Try to close closed client " << client.peer;
+        return;
+    }
+    close(client.fd);
+    DLOG(INFO) << "Connection closed for " << client.peer;
+    // the slot is released by the main thread, which owns the client DB
+    if (nullptr == t_worker_data) {
+        client::release_client(client);
+    } else {
+        g_rearm_queue->emplace_back(slot_key{client.key});
+        wakeup_dispatcher();
     }
-    DLOG(INFO) << "Connection closed for " << client.name;
 }
 
-int server_custom_thread_pool::client::get_request_client(client_data &client, std::string &msg_buffer) {
-    {
-        std::lock_guard<std::mutex> lg{client.mutex};
-        if (client::client_state::READ != client.state) {
-            LOG(ERROR) << "Try to read from client[" << client.name << "] in invalid state["
-                       << static_cast<int>(client.state) << "]";
-            return STATUS_FAIL;
+// call only from main thread; O(1), the slot is reused by the next connection
+void server_custom_thread_pool::client::release_client(client_data &client) {
+    g_fd_pool_db[client.pool_index].fd = FD_POOL_DUMMY_FD;
+    if (TIMER_ID_NONE != client.timer) {
+        g_timers.cancel(client.timer);
+        client.timer = TIMER_ID_NONE;
+    }
+    g_client_db.erase(client.key);
+    // a deferring listener takes connections again; the next accept checks the limit anew
+    g_fd_pool_db[SERVER_FD_INDEX].events = SERVER_FD_EVENTS;
+}
+
+void server_custom_thread_pool::client::reap_clients() {
+    uint64_t index;
+    client::client_state state;
+
+    if (0 == g_timers.advance(g_now_ms)) {
+        return;
+    }
+    while (g_timers.pop_expired(index)) {
+        client_data &client = g_client_db[index];
+        // the timer id is already free
+        client.timer = TIMER_ID_NONE;
+        state = client.state.load(std::memory_order_acquire);
+        // only the main thread moves a client out of IDLE, so it cannot be taken by a worker meanwhile
+        if (client::client_state::IDLE == state && FD_POOL_DUMMY_FD == g_fd_pool_db[client.pool_index].fd) {
+            // an echo just ended: the queued re-arm still refers to the slot, so it is not released yet
+            client.timer = g_timers.add(connection_deadline_ms(g_now_ms, false), index);
+        } else if (client::client_state::IDLE == state) {
+            DLOG(INFO) << "Connection timed out for " << client.peer;
+            client::close_client(client);
+            g_reap_count.fetch_add(1, std::memory_order_relaxed);
+        } else if (client::client_state::CLOSED != state && client.overdue) {
+            // A worker holds the client for a whole timeout: the socket is shut down, not closed,
+            // so the blocked read or write fails and the worker closes the client
+            DLOG(INFO) << "Connection stalled for " << client.peer;
+            shutdown(client.fd, SHUT_RDWR);
+            g_reap_count.fetch_add(1, std::memory_order_relaxed);
+        } else if (client::client_state::CLOSED != state) {
+            // a client in a worker is not idle; its re-arm refreshes the deadline
+            client.overdue = true;
+            client.timer = g_timers.add(connection_deadline_ms(g_now_ms, false), index);
         }
     }
+}
+
+int server_custom_thread_pool::client::get_request_client(client_data &client, pooled_buffer &msg_buffer) {
+    client::client_state state = client.state.load(std::memory_order_acquire);
+    if (client::client_state::READ != state) {
+        ALOG(ERROR) << "Try to read from client[" << client.peer << "] in invalid state["
+                    << static_cast<int>(state) << "]";
+        return STATUS_FAIL;
+    }
     int io_status = read_msg(client.fd, msg_buffer);
     if (STATUS_SUCCESS != io_status) {
-        LOG(WARNING) << "Failed to read from " << client.name;
+        ALOG(WARNING) << "Failed to read from " << client.peer;
+        client::close_client(client);
         return STATUS_FAIL;
     }
     // Handling EOF message
-    if (msg_buffer.empty()) {
+    if (0 == msg_buffer.size()) {
         client::close_client(client);
         return STATUS_FAIL;
     }
+    // the READ state gives the worker exclusive access
+    if (0 != client.accept_time_ns) {
+        stage_stats_record(STAGE_ACCEPT_TO_FIRST_READ, client.accept_time_ns);
+        client.accept_time_ns = 0;
+    }
     return STATUS_SUCCESS;
 }
 
-int server_custom_thread_pool::client::send_response_client(client_data &client, const std::string &msg_buffer) {
-    {
-        std::lock_guard<std::mutex> lg{client.mutex};
-        if (client::client_state::WRITE != client.state) {
-            LOG(ERROR) << "Try to write to client[" << client.name << "] in invalid state["
-                       << static_cast<int>(client.state) << "]";
-            return STATUS_FAIL;
-        }
+int server_custom_thread_pool::client::send_response_client(client_data &client,
+                                                            const pooled_buffer &msg_buffer) {
+    client::client_state state = client.state.load(std::memory_order_acquire);
+    if (client::client_state::WRITE != state) {
+        ALOG(ERROR) << "Try to write to client[" << client.peer << "] in invalid state["
+                    << static_cast<int>(state) << "]";
+        return STATUS_FAIL;
     }
     int io_status = write_msg(client.fd, msg_buffer);
     if (STATUS_SUCCESS != io_status) {
-        LOG(WARNING) << "Error failed to write from " << client.name;
+        if (EAGAIN == errno || EWOULDBLOCK == errno) {
+            DLOG(INFO) << "Connection timed out for " << client.peer;
+            g_reap_count.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            ALOG(WARNING) << "Error failed to write from " << client.peer;
+        }
         client::close_client(client);
     }
     return io_status;
 }
 
-void server_custom_thread_pool::worker::worker_routine() {
+void server_custom_thread_pool::worker::worker_routine(size_t worker_index) {
     worker::job_data job;
+    client::client_state state;
     int rc;
 
-    g_job_pool.subscribe();
+    // the local deque and the buffer free list grow on the node of the worker
+    affinity_pin_thread(worker_index);
+    t_worker_data = g_worker_data_db[worker_index].get();
+    g_job_pool->subscribe();
     DLOG(INFO) << "Worker started";
     while (true) {
-        job = g_job_pool.pop_back();
+        job = worker::get_job(worker_index);
 
         // Handle poison pill
         if (nullptr == job.client) {
             DLOG(INFO) << "Worker received poison pill";
-            g_job_pool.unsubscribe();
-            g_job_pool.emplace_front_force(std::move(job));
+            g_job_pool->unsubscribe();
+            g_job_pool->emplace_back_force(std::move(job));
             break;
         }
+        stage_stats_record(STAGE_QUEUE_SOJOURN, job.enqueue_time_ns);
 
-        switch (job.client->state) {
+        state = job.client->state.load(std::memory_order_acquire);
+        switch (state) {
             case client::client_state::READ:
+                job.message = pooled_buffer::acquire();
                 rc = client::get_request_client(*job.client, job.message);
                 if (STATUS_SUCCESS == rc) {
-                    DLOG(INFO) << "Read from " << job.client->name << " msg:\n" << job.message;
+                    DLOG(INFO) << "Read from " << job.client->peer << " msg:\n"
+                               << std::string_view(job.message.data(), job.message.size());
                     worker::schedule_write_job(*job.client, std::move(job.message));
                 }
                 break;
@@ -381,69 +609,104 @@ void server_custom_thread_pool::worker::worker_routine() {
             case client::client_state::WRITE:
                 rc = client::send_response_client(*job.client, job.message);
                 if (STATUS_SUCCESS == rc) {
-                    DLOG(INFO) << "Send to " << job.client->name << " msg:\n" << job.message;
+                    DLOG(INFO) << "Send to " << job.client->peer << " msg:\n"
+                               << std::string_view(job.message.data(), job.message.size());
                     worker::schedule_idle_job(*job.client);
                 }
                 break;
 
             case client::client_state::IDLE:
-                LOG(WARNING) << "Worker encountered client[" << job.client->name << "] in invalid state[IDLE]";
+                ALOG(WARNING) << "Worker encountered client[" << job.client->peer << "] in invalid state[IDLE]";
                 break;
 
             case client::client_state::CLOSED:
-                LOG(WARNING) << "Worker encountered client[" << job.client->name << "] in invalid state[CLOSED]";
+                ALOG(WARNING) << "Worker encountered client[" << job.client->peer << "] in invalid state[CLOSED]";
                 break;
 
             default:
-                LOG(ERROR) << "Worker encountered client[" << job.client->name << "] in invalid state["
-                           << static_cast<int>(job.client->state) << ']';
+                ALOG(ERROR) << "Worker encountered client[" << job.client->peer << "] in invalid state["
+                            << static_cast<int>(state) << ']';
         }
     }
-    g_job_pool.unsubscribe();
+    g_job_pool->unsubscribe();
     DLOG(INFO) << "Worker stopped";
 }
 
+// own follow-up jobs first, then new jobs from the dispatcher, then jobs of other workers
+server_custom_thread_pool::worker::job_data server_custom_thread_pool::worker::get_job(size_t worker_index) {
+    worker::job_data job;
+
+    if (t_worker_data->local_jobs.try_pop_back(job)) {
+        t_worker_data->local_job_count.fetch_add(1, std::memory_order_relaxed);
+        return job;
+    }
+    if (g_job_pool->try_pop_front(job)) {
+        t_worker_data->global_job_count.fetch_add(1, std::memory_order_relaxed);
+        return job;
+    }
+    if (worker::steal_job(worker_index, job)) {
+        t_worker_data->stolen_job_count.fetch_add(1, std::memory_order_relaxed);
+        return job;
+    }
+    // Local jobs are always taken by their busy owner, so it is safe to park on the global queue
+    job = g_job_pool->pop_front();
+    t_worker_data->global_job_count.fetch_add(1, std::memory_order_relaxed);
+    return job;
+}
+
+bool server_custom_thread_pool::worker::steal_job(size_t worker_index, worker::job_data &job) {
+    for (size_t i = 1; i < g_worker_data_db.size(); ++i) {
+        size_t victim = (worker_index + i) % g_worker_data_db.size();
+        if (g_worker_data_db[victim]->local_jobs.try_steal_front(job)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void server_custom_thread_pool::worker::log_worker_stats() {
+    for (size_t i = 0; i < g_worker_data_db.size(); ++i) {
+        const worker::worker_data &data = *g_worker_data_db[i];
+        LOG(INFO) << "Worker[" << i << "] jobs: local " << data.local_job_count
+                  << ", global " << data.global_job_count << ", stolen " << data.stolen_job_count;
+    }
+}
+
 // call only from main thread
 void server_custom_thread_pool::worker::schedule_read_job(client::client_data &client) {
-    {
-        std::lock_guard<std::mutex> lg{client.mutex};
-        if (client::client_state::IDLE != client.state) {
-            LOG(WARNING) << "Client " << client.name << " tried to READ in invalid state["
-                         << static_cast<int>(client.state) << ']';
-            return;
-        }
-        client.state = client::client_state::READ;
+    client::client_state state = client::client_state::IDLE;
+    if (!client.state.compare_exchange_strong(state, client::client_state::READ, std::memory_order_acq_rel)) {
+        ALOG(WARNING) << "Client " << client.peer << " tried to READ in invalid state["
+                      << static_cast<int>(state) << ']';
+        return;
     }
-    // No need for mutex as write is performed in main thread which owns g_fd_pool_db exclusively
+    // No need for synchronization as main thread owns g_fd_pool_db exclusively
     g_fd_pool_db[client.pool_index].fd = FD_POOL_DUMMY_FD;
-    g_job_pool.emplace_back(worker::job_data{&client});
+    g_job_pool->emplace_back(worker::job_data{&client});
 }
 
 void server_custom_thread_pool::worker::schedule_write_job(client::client_data &client,
-                                                           std::string &&msg_buffer) {
-    {
-        std::lock_guard<std::mutex> lg{client.mutex};
-        if (client::client_state::READ != client.state) {
-            LOG(WARNING) << "Client " << client.name << " tried to WRITE in invalid state["
-                         << static_cast<int>(client.state) << ']';
-            return;
-        }
-        client.state = client::client_state::WRITE;
+                                                           pooled_buffer &&msg_buffer) {
+    client::client_state state = client::client_state::READ;
+    if (!client.state.compare_exchange_strong(state, client::client_state::WRITE, std::memory_order_acq_rel)) {
+        ALOG(WARNING) << "Client " << client.peer << " tried to WRITE in invalid state["
+                      << static_cast<int>(state) << ']';
+        return;
+    }
+    // keep the client on the worker which has its data in cache
+    if (nullptr != t_worker_data) {
+        t_worker_data->local_jobs.push_back(worker::job_data{&client, std::move(msg_buffer)});
+    } else {
+        g_job_pool->emplace_back_force(worker::job_data{&client, std::move(msg_buffer)});
     }
-    g_job_pool.emplace_back_force(worker::job_data{&client, std::move(msg_buffer)});
 }
 
 void server_custom_thread_pool::worker::schedule_idle_job(client::client_data &client) {
-    {
-        std::lock_guard<std::mutex> lg{client.mutex};
-        if (client::client_state::WRITE != client.state) {
-            LOG(WARNING) << "Client " << client.name << " tried to IDLE while not in WRITE state";
-            return;
-        }
-        client.state = client::client_state::IDLE;
-    }
-    {
-        std::lock_guard<std::mutex> db_lg{g_db_mutex};
-        g_fd_pool_db[client.pool_index].fd = client.fd;
+    client::client_state state = client::client_state::WRITE;
+    if (!client.state.compare_exchange_strong(state, client::client_state::IDLE, std::memory_order_acq_rel)) {
+        ALOG(WARNING) << "Client " << client.peer << " tried to IDLE while not in WRITE state";
+        return;
     }
+    g_rearm_queue->emplace_back(slot_key{client.key});
+    wakeup_dispatcher();
 }
@@ -0,0 +1,84 @@
+#include "echo_server_epoll.h"
+#include <iostream>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <memory>
+
+#include "common/defines.h"
+#include "common/socket.h"
+#include "common/logging.h"
+#include "common/config.h"
+#include "common/epoll_reactor.h"
+
+
+namespace server_epoll {
+    std::atomic_bool g_running_flag = false;
+    int g_server_fd = -1;
+    epoll_reactor_stats g_stats{};
+    std::unique_ptr<epoll_reactor> g_reactor{};
+
+    int server_init(uint16_t port);
+
+    void server_deinit();
+
+    int server_run();
+
+    void server_stop();
+
+    void log_stats();
+}
+
+const engine_t g_engine_epoll{"epoll", server_epoll::server_init, server_epoll::server_run, server_epoll::server_stop,
+                              server_epoll::log_stats};
+
+int server_epoll::server_run() {
+    int rc = g_reactor->run(g_running_flag);
+
+    server_deinit();
+    return rc;
+}
+
+int server_epoll::server_init(uint16_t port) {
+    g_server_fd = server_socket_init(port);
+    if (g_server_fd < 0) {
+        return STATUS_FAIL;
+    }
+    // edge-triggered mode requires draining the accept queue until EAGAIN
+    if (STATUS_SUCCESS != socket_set_nonblocking(g_server_fd)) {
+        close(g_server_fd);
+        return STATUS_FAIL;
+    }
+
+    g_reactor = std::make_unique<epoll_reactor>(g_stats);
+    if (STATUS_SUCCESS != g_reactor->init(g_server_fd, FLAGS_expect_connections)) {
+        g_reactor.reset();
+        close(g_server_fd);
+        return STATUS_FAIL;
+    }
+    epoll_reactor::log_footprint();
+
+    g_running_flag = true;
+    return STATUS_SUCCESS;
+}
+
+void server_epoll::server_deinit() {
+    g_reactor.reset();
+    close(g_server_fd);
+    LOG(INFO) << "Server stopped";
+}
+
+void server_epoll::server_stop() {
+    g_running_flag = false;
+    if (-1 != g_server_fd) {
+        shutdown(g_server_fd, SHUT_RDWR);
+    } else {
+        LOG(WARNING) << "Server socket is not set";
+    }
+}
+
+void server_epoll::log_stats() {
+    LOG(INFO) << "Connections accepted: " << g_stats.accept_count << ", shed: " << g_stats.shed_count
+              << ", deferred accepts: " << g_stats.defer_count;
+    LOG(INFO) << "Connections reaped on timeout: " << g_stats.reap_count;
+}
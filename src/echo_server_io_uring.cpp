@@ -0,0 +1,573 @@
+// liburing >= 2.3 and Linux >= 6.0 are required (multishot recv and provided buffer rings)
+#include "echo_server_io_uring.h"
+#include <iostream>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <liburing.h>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include "common/io.h"
+#include "common/defines.h"
+#include "common/socket.h"
+#include "common/logging.h"
+#include "common/stage_stats.h"
+#include "common/config.h"
+#include "common/timing_wheel.h"
+#include "common/connection.h"
+
+
+#define URING_CQE_BATCH                 (256)
+#define BUF_RING_GROUP_ID               (0)
+#define SEND_CHAIN_MAX                  (16)
+
+#define USER_DATA_OP_SHIFT              (32)
+#define USER_DATA_FD_MASK               (0xFFFFFFFFULL)
+
+
+namespace server_io_uring {
+    enum class op_type : uint64_t {
+        ACCEPT = 1,
+        RECV,
+        SEND
+    };
+
+    namespace client {
+        struct send_chunk {
+            uint16_t bid;
+            uint32_t offset;
+            uint32_t length;
+        };
+
+        struct client_data {
+            // received buffers in the echo order from send_head on; cleared once all are sent.
+            // An empty deque would still hold its map and a 512 B block per client
+            std::vector<send_chunk> send_queue{};
+            uint32_t send_head = 0;
+            uint32_t sends_in_flight = 0;
+            // 0 after the first read
+            uint64_t accept_time_ns = 0;
+            // submission of the send chain in flight
+            uint64_t send_time_ns = 0;
+            timer_id timer = TIMER_ID_NONE;
+            // false means the slot is free
+            bool connected = false;
+            bool recv_armed = false;
+            bool closing = false;
+        };
+    }
+}
+
+namespace server_io_uring {
+    bool g_running_flag = false;
+    int g_rc = STATUS_SUCCESS;
+    int g_server_fd = -1;
+    io_uring g_ring{};
+    io_uring_buf_ring *g_buf_ring = nullptr;
+    std::unique_ptr<char[]> g_buffers{};
+    int g_buf_recycled = 0;
+    // clients whose multishot recv stopped because the buffer ring was empty
+    std::vector<int> g_recv_starved{};
+    // indexed by client fd
+    std::vector<client::client_data> g_client_db{};
+    size_t g_accept_count = 0;
+    // connections reset by the admission control near the fd limit
+    size_t g_shed_count = 0;
+    // failed connections of a working listener, e.g. aborted by the peer or out of fds
+    size_t g_accept_error_count = 0;
+    // out of fds: the accept is re-armed once a client closes, at the latest at g_accept_retry_ms
+    bool g_accept_deferred = false;
+    uint64_t g_accept_retry_ms = 0;
+    // idle and write deadlines of the clients; the owner of a timer is the client fd
+    timing_wheel g_timers{};
+    // read once per completion batch
+    uint64_t g_now_ms = 0;
+    size_t g_reap_count = 0;
+
+    int server_init(uint16_t port);
+
+    void server_deinit();
+
+    int server_run();
+
+    void server_stop();
+
+    void log_stats();
+
+    int buf_ring_init();
+
+    void buf_recycle(uint16_t bid);
+
+    char *buf_addr(uint16_t bid);
+
+    io_uring_sqe *get_sqe(unsigned int required = 1);
+
+    void handle_cqe(const io_uring_cqe *cqe);
+
+    void arm_accept();
+
+    void handle_accept(const io_uring_cqe *cqe);
+
+    // re-arms the accept deferred for lack of fds once its retry time came
+    void retry_accept();
+
+    // submits the queued sqes and waits for a completion or the next deadline
+    int submit_and_wait();
+
+    namespace client {
+        void connect_client(int fd);
+
+        void try_close_client(int fd);
+
+        void arm_recv(int fd);
+
+        void handle_recv(int fd, const io_uring_cqe *cqe);
+
+        void submit_sends(int fd);
+
+        void handle_send(int fd, const io_uring_cqe *cqe);
+
+        // shuts down the clients whose deadline passed; they are closed once their operations complete
+        void reap_clients();
+    }
+}
+
+const engine_t g_engine_io_uring{"io_uring", server_io_uring::server_init, server_io_uring::server_run,
+                                 server_io_uring::server_stop, server_io_uring::log_stats};
+
+int server_io_uring::server_run() {
+    int rc;
+    unsigned int cqe_count;
+    io_uring_cqe *cqes[URING_CQE_BATCH];
+
+    arm_accept();
+    while (g_running_flag) {
+        // One syscall submits everything queued in the previous batch and waits for new completions
+        rc = submit_and_wait();
+        g_now_ms = timing_wheel_now_ms();
+        if (rc < 0) {
+            if (-ETIME == rc) {
+                client::reap_clients();
+                retry_accept();
+                continue; // while (g_running_flag)
+            }
+            if (-EINTR == rc) {
+                continue; // while (g_running_flag)
+            }
+            if (g_running_flag) {
+                LOG(ERROR) << "Error calling io_uring_submit_and_wait: " << strerror(-rc);
+                g_rc = STATUS_FAIL;
+            }
+            break; // while (g_running_flag)
+        }
+
+        do {
+            cqe_count = io_uring_peek_batch_cqe(&g_ring, cqes, URING_CQE_BATCH);
+            for (unsigned int index = 0; index < cqe_count; ++index) {
+                handle_cqe(cqes[index]);
+            }
+            io_uring_cq_advance(&g_ring, cqe_count);
+        } while (URING_CQE_BATCH == cqe_count);
+
+        // Publish buffers returned by the completed sends in one step
+        if (g_buf_recycled > 0) {
+            io_uring_buf_ring_advance(g_buf_ring, g_buf_recycled);
+            g_buf_recycled = 0;
+            for (int fd: g_recv_starved) {
+                client::arm_recv(fd);
+            }
+            g_recv_starved.clear();
+        }
+
+        client::reap_clients();
+        retry_accept();
+    } // while (g_running_flag)
+
+    server_deinit();
+    return g_rc;
+}
+
+int server_io_uring::server_init(uint16_t port) {
+    int rc;
+
+    g_server_fd = server_socket_init(port);
+    if (g_server_fd < 0) {
+        return STATUS_FAIL;
+    }
+
+    rc = io_uring_queue_init(FLAGS_uring_queue_depth, &g_ring, 0);
+    if (rc < 0) {
+        LOG(ERROR) << "Error calling io_uring_queue_init: " << strerror(-rc);
+        close(g_server_fd);
+        return STATUS_FAIL;
+    }
+
+    if (STATUS_SUCCESS != buf_ring_init()) {
+        io_uring_queue_exit(&g_ring);
+        close(g_server_fd);
+        return STATUS_FAIL;
+    }
+
+    g_client_db.reserve(FLAGS_expect_connections);
+    // the received data stays in the shared buffer ring
+    log_connection_footprint(sizeof(client::client_data), 0, connection_timeouts_enabled());
+
+    g_running_flag = true;
+    return STATUS_SUCCESS;
+}
+
+void server_io_uring::server_deinit() {
+    for (size_t fd = 0; fd < g_client_db.size(); ++fd) {
+        if (g_client_db[fd].connected) {
+            close(static_cast<int>(fd));
+        }
+    }
+    io_uring_queue_exit(&g_ring);
+    free(g_buf_ring);
+    close(g_server_fd);
+    LOG(INFO) << "Server stopped";
+}
+
+void server_io_uring::server_stop() {
+    g_running_flag = false;
+    if (-1 != g_server_fd) {
+        shutdown(g_server_fd, SHUT_RDWR);
+    } else {
+        LOG(WARNING) << "Server socket is not set";
+    }
+}
+
+void server_io_uring::log_stats() {
+    LOG(INFO) << "Connections accepted: " << g_accept_count << ", shed: " << g_shed_count
+              << ", failed accepts: " << g_accept_error_count;
+    LOG(INFO) << "Connections reaped on timeout: " << g_reap_count;
+}
+
+int server_io_uring::buf_ring_init() {
+    int rc;
+    void *ring_mem = nullptr;
+    io_uring_buf_reg reg{};
+    size_t ring_size = static_cast<size_t>(FLAGS_uring_buf_ring_entries) * sizeof(io_uring_buf);
+
+    // the ring shared with the kernel has to be page aligned
+    if (STATUS_SUCCESS != posix_memalign(&ring_mem, sysconf(_SC_PAGESIZE), ring_size)) {
+        LOG(ERROR) << "Error allocating provided buffer ring";
+        return STATUS_FAIL;
+    }
+    memset(ring_mem, 0, ring_size);
+    g_buf_ring = static_cast<io_uring_buf_ring *>(ring_mem);
+
+    reg.ring_addr = reinterpret_cast<uint64_t>(ring_mem);
+    reg.ring_entries = FLAGS_uring_buf_ring_entries;
+    reg.bgid = BUF_RING_GROUP_ID;
+    rc = io_uring_register_buf_ring(&g_ring, &reg, 0);
+    if (rc < 0) {
+        LOG(ERROR) << "Error calling io_uring_register_buf_ring: " << strerror(-rc);
+        free(g_buf_ring);
+        g_buf_ring = nullptr;
+        return STATUS_FAIL;
+    }
+
+    g_buffers.reset(new char[static_cast<size_t>(FLAGS_uring_buf_ring_entries) * FLAGS_message_size]);
+    for (uint16_t bid = 0; bid < FLAGS_uring_buf_ring_entries; ++bid) {
+        buf_recycle(bid);
+    }
+    io_uring_buf_ring_advance(g_buf_ring, g_buf_recycled);
+    g_buf_recycled = 0;
+    return STATUS_SUCCESS;
+}
+
+// the buffer is visible for the kernel after the next io_uring_buf_ring_advance
+void server_io_uring::buf_recycle(uint16_t bid) {
+    io_uring_buf_ring_add(g_buf_ring, buf_addr(bid), FLAGS_message_size, bid,
+                          io_uring_buf_ring_mask(FLAGS_uring_buf_ring_entries), g_buf_recycled);
+    g_buf_recycled++;
+}
+
+char *server_io_uring::buf_addr(uint16_t bid) {
+    return g_buffers.get() + static_cast<size_t>(bid) * FLAGS_message_size;
+}
+
+// returns an sqe making sure that `required` sqes fit into one submission
+io_uring_sqe *server_io_uring::get_sqe(unsigned int required) {
+    if (io_uring_sq_space_left(&g_ring) < required) {
+        io_uring_submit(&g_ring);
+    }
+    return io_uring_get_sqe(&g_ring);
+}
+
+// -ETIME if the deadline came first
+int server_io_uring::submit_and_wait() {
+    io_uring_cqe *cqe;
+    __kernel_timespec timeout{};
+    uint64_t now = timing_wheel_now_ms();
+    int timeout_ms = g_timers.next_timeout_ms(now);
+    int retry_ms;
+
+    if (g_accept_deferred) {
+        retry_ms = g_accept_retry_ms > now ? static_cast<int>(g_accept_retry_ms - now) : 0;
+        if (-1 == timeout_ms || retry_ms < timeout_ms) {
+            timeout_ms = retry_ms;
+        }
+    }
+
+    if (-1 == timeout_ms) {
+        return io_uring_submit_and_wait(&g_ring, 1);
+    }
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000;
+    return io_uring_submit_and_wait_timeout(&g_ring, &cqe, 1, &timeout, nullptr);
+}
+
+void server_io_uring::handle_cqe(const io_uring_cqe *cqe) {
+    uint64_t user_data = io_uring_cqe_get_data64(cqe);
+    auto op = static_cast<op_type>(user_data >> USER_DATA_OP_SHIFT);
+    auto fd = static_cast<int>(user_data & USER_DATA_FD_MASK);
+
+    switch (op) {
+        case op_type::ACCEPT:
+            handle_accept(cqe);
+            break;
+
+        case op_type::RECV:
+            client::handle_recv(fd, cqe);
+            break;
+
+        case op_type::SEND:
+            client::handle_send(fd, cqe);
+            break;
+
+        default:
+            ALOG(ERROR) << "Completion of unknown operation[" << (user_data >> USER_DATA_OP_SHIFT) << ']';
+    }
+}
+
+void server_io_uring::arm_accept() {
+    io_uring_sqe *sqe = get_sqe();
+    io_uring_prep_multishot_accept(sqe, g_server_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    io_uring_sqe_set_data64(sqe, static_cast<uint64_t>(op_type::ACCEPT) << USER_DATA_OP_SHIFT);
+}
+
+void server_io_uring::handle_accept(const io_uring_cqe *cqe) {
+    if (cqe->res >= 0 && socket_admission_near_limit(cqe->res)) {
+        // the multishot accept stays armed, so a deferring policy would not hold the backlog back
+        socket_shed(cqe->res);
+        g_shed_count++;
+    } else if (cqe->res >= 0) {
+        client::connect_client(cqe->res);
+    } else if (!g_running_flag || -EBADF == cqe->res || -EINVAL == cqe->res) {
+        // a shut down or broken listener stops the server
+        if (g_running_flag) {
+            LOG(ERROR) << "Error calling accept: " << strerror(-cqe->res);
+            g_rc = STATUS_FAIL;
+        }
+        LOG(INFO) << "Server socket closed";
+        g_running_flag = false;
+        return;
+    } else {
+        // EMFILE, ENFILE, ENOBUFS, ECONNABORTED: only this connection is lost
+        g_accept_error_count++;
+        ALOG(WARNING) << "Error calling accept: " << strerror(-cqe->res);
+    }
+
+    if ((cqe->flags & IORING_CQE_F_MORE) || !g_running_flag) {
+        return;
+    }
+    if (-EMFILE == cqe->res || -ENFILE == cqe->res) {
+        // re-armed now the accept would fail at once again; the backlog waits for a client to close
+        g_accept_deferred = true;
+        g_accept_retry_ms = g_now_ms + ACCEPT_RETRY_MS;
+        return;
+    }
+    arm_accept();
+}
+
+void server_io_uring::retry_accept() {
+    if (g_accept_deferred && g_now_ms >= g_accept_retry_ms) {
+        g_accept_deferred = false;
+        arm_accept();
+    }
+}
+
+void server_io_uring::client::connect_client(int fd) {
+    if (static_cast<size_t>(fd) >= g_client_db.size()) {
+        g_client_db.resize(fd + 1);
+    }
+    g_client_db[fd].connected = true;
+    g_client_db[fd].closing = false;
+    g_client_db[fd].accept_time_ns = stage_stats_now();
+    if (connection_timeouts_enabled()) {
+        g_client_db[fd].timer = g_timers.add(connection_deadline_ms(g_now_ms, false), fd);
+    }
+    g_accept_count++;
+    // multishot accept shares one address buffer between completions: the peer is queried only for a log line
+    DLOG(INFO) << "New connection from " << socket_get_peer(fd);
+    arm_recv(fd);
+}
+
+// the fd is closed only when no operation on it is in flight, so it can not be reused too early
+void server_io_uring::client::try_close_client(int fd) {
+    client_data &client = g_client_db[fd];
+    if (client.recv_armed || client.sends_in_flight > 0) {
+        return;
+    }
+    for (size_t index = client.send_head; index < client.send_queue.size(); ++index) {
+        buf_recycle(client.send_queue[index].bid);
+    }
+    client.send_queue.clear();
+    client.send_head = 0;
+    if (TIMER_ID_NONE != client.timer) {
+        g_timers.cancel(client.timer);
+        client.timer = TIMER_ID_NONE;
+    }
+    DLOG(INFO) << "Connection closed for " << socket_get_peer(fd);
+    close(fd);
+    client.connected = false;
+    // the freed fd takes a pending connection
+    if (g_accept_deferred) {
+        g_accept_retry_ms = g_now_ms;
+    }
+}
+
+void server_io_uring::client::arm_recv(int fd) {
+    client_data &client = g_client_db[fd];
+    if (client.closing || client.recv_armed) {
+        return;
+    }
+    io_uring_sqe *sqe = get_sqe();
+    io_uring_prep_recv_multishot(sqe, fd, nullptr, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_RING_GROUP_ID;
+    io_uring_sqe_set_data64(sqe, static_cast<uint64_t>(op_type::RECV) << USER_DATA_OP_SHIFT |
+                                 static_cast<uint64_t>(fd));
+    client.recv_armed = true;
+}
+
+void server_io_uring::client::handle_recv(int fd, const io_uring_cqe *cqe) {
+    client_data &client = g_client_db[fd];
+    bool more = cqe->flags & IORING_CQE_F_MORE;
+
+    if (!more) {
+        client.recv_armed = false;
+    }
+
+    if (cqe->res > 0) {
+        auto bid = static_cast<uint16_t>(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        DLOG(INFO) << "Read from " << socket_get_peer(fd) << " msg:\n" << std::string(buf_addr(bid), cqe->res);
+        if (0 != client.accept_time_ns) {
+            stage_stats_record(STAGE_ACCEPT_TO_FIRST_READ, client.accept_time_ns);
+            client.accept_time_ns = 0;
+        }
+        client.send_queue.push_back(send_chunk{bid, 0, static_cast<uint32_t>(cqe->res)});
+        if (0 == client.sends_in_flight && !client.closing) {
+            client::submit_sends(fd);
+        }
+        // the echo is pending until its send completes
+        if (TIMER_ID_NONE != client.timer) {
+            g_timers.update(client.timer, connection_deadline_ms(g_now_ms, true));
+        }
+        if (!more) {
+            client::arm_recv(fd);
+        }
+    } else if (-ENOBUFS == cqe->res) {
+        // rearmed as soon as sends return some buffers
+        g_recv_starved.push_back(fd);
+    } else {
+        // Handling EOF message or error
+        if (0 != cqe->res) {
+            ALOG(WARNING) << "Error failed to read from " << socket_get_peer(fd) << ": " << strerror(-cqe->res);
+        }
+        client.closing = true;
+        client::try_close_client(fd);
+    }
+}
+
+// sends of one client are linked so the kernel executes them in the receive order
+void server_io_uring::client::submit_sends(int fd) {
+    client_data &client = g_client_db[fd];
+    auto chain_length = static_cast<unsigned int>(std::min<size_t>(client.send_queue.size() - client.send_head,
+                                                                             SEND_CHAIN_MAX));
+    io_uring_sqe *sqe;
+
+    for (unsigned int index = 0; index < chain_length; ++index) {
+        const send_chunk &chunk = client.send_queue[client.send_head + index];
+        sqe = get_sqe(chain_length - index);
+        io_uring_prep_send(sqe, fd, buf_addr(chunk.bid) + chunk.offset, chunk.length - chunk.offset,
+                           MSG_NOSIGNAL | MSG_WAITALL);
+        io_uring_sqe_set_data64(sqe, static_cast<uint64_t>(op_type::SEND) << USER_DATA_OP_SHIFT |
+                                     static_cast<uint64_t>(fd));
+        if (index + 1 < chain_length) {
+            sqe->flags |= IOSQE_IO_LINK;
+        }
+    }
+    client.sends_in_flight = chain_length;
+    client.send_time_ns = stage_stats_now();
+}
+
+void server_io_uring::client::handle_send(int fd, const io_uring_cqe *cqe) {
+    client_data &client = g_client_db[fd];
+
+    client.sends_in_flight--;
+    if (-ECANCELED == cqe->res) {
+        // the chain was broken by a short send or an error; the chunk stays queued
+    } else if (cqe->res < 0) {
+        ALOG(WARNING) << "Error failed to write to " << socket_get_peer(fd) << ": " << strerror(-cqe->res);
+        client.closing = true;
+        // terminates the armed multishot recv
+        shutdown(fd, SHUT_RDWR);
+    } else {
+        // the write stage of io_uring is the time from the chain submission to the send completion
+        stage_stats_record(STAGE_WRITE, client.send_time_ns);
+        // completions of a chain arrive in order, so this is the front chunk
+        send_chunk &chunk = client.send_queue[client.send_head];
+        chunk.offset += cqe->res;
+        if (chunk.offset == chunk.length) {
+            buf_recycle(chunk.bid);
+            client.send_head++;
+            if (client.send_head == client.send_queue.size()) {
+                client.send_queue.clear();
+                client.send_head = 0;
+            }
+        }
+        // a later deadline is only stored, so the echo does not touch the wheel lists
+        if (TIMER_ID_NONE != client.timer) {
+            g_timers.update(client.timer, connection_deadline_ms(g_now_ms, !client.send_queue.empty()));
+        }
+    }
+
+    if (client.sends_in_flight > 0) {
+        return;
+    }
+    if (client.closing) {
+        client::try_close_client(fd);
+    } else if (!client.send_queue.empty()) {
+        client::submit_sends(fd);
+    }
+}
+
+void server_io_uring::client::reap_clients() {
+    uint64_t fd;
+
+    if (0 == g_timers.advance(g_now_ms)) {
+        return;
+    }
+    while (g_timers.pop_expired(fd)) {
+        client_data &client = g_client_db[fd];
+        // the timer id is already free
+        client.timer = TIMER_ID_NONE;
+        if (client.closing) {
+            continue; // while
+        }
+        DLOG(INFO) << "Connection timed out for " << socket_get_peer(static_cast<int>(fd));
+        client.closing = true;
+        g_reap_count++;
+        // terminates the armed multishot recv and the sends in flight; the last completion closes the fd
+        shutdown(static_cast<int>(fd), SHUT_RDWR);
+        client::try_close_client(static_cast<int>(fd));
+    }
+}
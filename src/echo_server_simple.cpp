@@ -5,62 +5,103 @@
 #include <netinet/in.h>
 #include <sys/poll.h>
 #include <csignal>
+#include <cerrno>
 #include <cstring>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <algorithm>
 
 #include "common/io.h"
 #include "common/defines.h"
 #include "common/socket.h"
 #include "common/logging.h"
+#include "common/slot_map.h"
+#include "common/stage_stats.h"
+#include "common/config.h"
+#include "common/timing_wheel.h"
+#include "common/connection.h"
 
 
-#define GC_THRESHOLD                    (300)
 #define SERVER_FD_INDEX                 (0)
+#define FIRST_CLIENT_FD_INDEX           (1)
 #define INFTIM                          (-1)
 #define FD_POOL_DUMMY_FD                (-1)
-#define FD_POOL_EMPTY_ADDRESS_STR       ("")
+#define SERVER_FD_EVENTS                (POLLIN | POLLERR | POLLHUP | POLLNVAL)
 
 
+namespace server_simple {
+    namespace client {
+        struct client_data {
+            splice_pipe pipe{};
+            // 0 after the first read
+            uint64_t accept_time_ns = 0;
+            peer_addr peer{};
+            timer_id timer = TIMER_ID_NONE;
+        };
+    }
+}
+
 namespace server_simple {
     bool g_running_flag = false;
-    size_t g_garbage_count = 0;
     int g_server_fd = -1;
+    // client slot index + FIRST_CLIENT_FD_INDEX; freed entries keep FD_POOL_DUMMY_FD until reused
     std::vector<pollfd> g_db_fd_pool{};
-    std::vector<std::string> g_db_addr_str{};
+    slot_map<client::client_data> g_client_db{};
+    size_t g_accept_count = 0;
+    // connections reset by the admission control and listener pauses near the fd limit
+    size_t g_shed_count = 0;
+    size_t g_defer_count = 0;
+    // idle deadlines of the clients; the owner of a timer is the client pool index.
+    // A blocked write is limited by SO_SNDTIMEO instead
+    timing_wheel g_timers{};
+    // read once per poll batch
+    uint64_t g_now_ms = 0;
+    size_t g_reap_count = 0;
 
     int server_init(uint16_t port);
 
-    void server_terminate_handler(int signum);
+    int server_run();
 
-    // Garbage Collector
-    int gc_routine();
+    void server_stop();
+
+    void log_stats();
+
+    // poll timeout: until the next deadline
+    int get_wait_timeout();
 
     namespace client {
-        int connect_client();
+        client_data &get_client(size_t client_pool_index);
+
+        // accepts up to --accept_batch pending connections
+        int connect_clients();
+
+        // stops polling the listener until a client closes; the new connections wait in the listen backlog
+        void defer_clients();
 
         void close_client(size_t client_pool_index);
 
-        int get_request_client(size_t client_pool_index, std::string &msg_buffer);
+        int get_request_client(size_t client_pool_index, stream_buffer &msg_buffer);
 
-        void send_response_client(size_t client_pool_index, const std::string &msg_buffer);
+        void send_response_client(size_t client_pool_index, const stream_buffer &msg_buffer);
+
+        // true if the pending data was echoed by splice(), possibly closing the client
+        bool splice_response_client(size_t client_pool_index);
+
+        // closes the clients whose deadline passed
+        void reap_clients();
     }
 }
 
-int echo_server_simple_main(uint16_t port) {
-    int trig_fds_count;
-    std::string msg_buffer{};
-
-    using namespace server_simple;
+const engine_t g_engine_simple{"simple", server_simple::server_init, server_simple::server_run,
+                               server_simple::server_stop, server_simple::log_stats};
 
-    if (STATUS_SUCCESS != server_init(port)) {
-        return STATUS_FAIL;
-    }
+int server_simple::server_run() {
+    int trig_fds_count;
+    stream_buffer msg_buffer{};
 
-    g_running_flag = true;
     while (g_running_flag) {
-        trig_fds_count = poll(g_db_fd_pool.data(), g_db_fd_pool.size(), INFTIM);
+        trig_fds_count = poll(g_db_fd_pool.data(), g_db_fd_pool.size(), get_wait_timeout());
+        g_now_ms = timing_wheel_now_ms();
         if (trig_fds_count < 0) {
             if (EINTR == errno) {
                 continue; // while (g_running_flag)
@@ -72,6 +113,7 @@ int echo_server_simple_main(uint16_t port) {
             }
             break; // while (g_running_flag)
         } else if (0 == trig_fds_count) {
+            client::reap_clients();
             continue; // while (g_running_flag)
         }
 
@@ -86,13 +128,13 @@ int echo_server_simple_main(uint16_t port) {
                 LOG(INFO) << "Server socket closed";
                 break; // while (g_running_flag)
             }
-            if (STATUS_SUCCESS != client::connect_client()) {
+            if (STATUS_SUCCESS != client::connect_clients()) {
                 break;  // while (g_running_flag)
             }
         }
 
         // Client requests handling
-        for (size_t index = 1; index < g_db_fd_pool.size() && trig_fds_count > 0; ++index) {
+        for (size_t index = FIRST_CLIENT_FD_INDEX; index < g_db_fd_pool.size() && trig_fds_count > 0; ++index) {
             if (0 == g_db_fd_pool[index].revents) {
                 continue; // for
             }
@@ -104,18 +146,31 @@ int echo_server_simple_main(uint16_t port) {
                 continue; // for
             }
 
+            // the deadline moves on with every request
+            if (TIMER_ID_NONE != client::get_client(index).timer) {
+                g_timers.update(client::get_client(index).timer, connection_deadline_ms(g_now_ms, false));
+            }
+
+            if (0 != client::get_client(index).accept_time_ns) {
+                stage_stats_record(STAGE_ACCEPT_TO_FIRST_READ, client::get_client(index).accept_time_ns);
+                client::get_client(index).accept_time_ns = 0;
+            }
+
+            // Bulk payloads are spliced; small ones take the read/write path,
+            // where one copy is cheaper than two splices
+            if (FLAGS_splice_echo && client::splice_response_client(index)) {
+                continue; // for
+            }
+
             if (STATUS_SUCCESS != client::get_request_client(index, msg_buffer)) {
                 continue; // for
             }
-            DLOG(INFO) << "Read from " << g_db_addr_str[index] << " msg:\n" << msg_buffer;
+            DLOG(INFO) << "Read from " << client::get_client(index).peer << " msg:\n"
+                       << std::string_view(msg_buffer.data.get(), msg_buffer.end);
             client::send_response_client(index, msg_buffer);
-        } // for (size_t index = 1; index < g_db_fd_pool.size() && trig_fds_count > 0; ++index)
+        } // for (size_t index = FIRST_CLIENT_FD_INDEX; index < g_db_fd_pool.size() && trig_fds_count > 0; ++index)
 
-        // Cleanup garbage in DB
-        if (STATUS_SUCCESS != gc_routine()) {
-            LOG(ERROR) << "Error critical bug during garbage collector routine";
-            break; // while (g_running_flag)
-        }
+        client::reap_clients();
     } // while (g_running_flag)
 
     close(g_server_fd);
@@ -128,28 +183,25 @@ int server_simple::server_init(uint16_t port) {
     if (g_server_fd < 0) {
         return STATUS_FAIL;
     }
+    // the accept batch ends when the backlog is empty
+    if (STATUS_SUCCESS != socket_set_nonblocking(g_server_fd)) {
+        close(g_server_fd);
+        return STATUS_FAIL;
+    }
 
-    g_db_fd_pool.reserve(SERVER_EXPECT_CONNECTIONS);
-    g_db_addr_str.reserve(SERVER_EXPECT_CONNECTIONS);
-
-    g_db_fd_pool.emplace_back(pollfd{g_server_fd, POLLIN | POLLERR | POLLHUP | POLLNVAL, 0});
-    // g_db_addr_str expects not empty string
-    g_db_addr_str.emplace_back("server_addr");
+    g_db_fd_pool.reserve(FLAGS_expect_connections);
+    g_client_db.reserve(FLAGS_expect_connections);
 
-    signal(SIGINT, server_terminate_handler);
+    g_db_fd_pool.emplace_back(pollfd{g_server_fd, SERVER_FD_EVENTS, 0});
+    // the messages are read into one shared buffer; a bulk client keeps a pipe in the kernel
+    log_connection_footprint(decltype(g_client_db)::slot_size + sizeof(pollfd), 0, 0 != FLAGS_idle_timeout_ms);
 
+    g_running_flag = true;
     return STATUS_SUCCESS;
 }
 
-void server_simple::server_terminate_handler(int signum) {
-    if (!g_running_flag) {
-        close(g_server_fd);
-        LOG(WARNING) << "Server force stop";
-        logging_deinit();
-        exit(STATUS_FAIL);
-    }
+void server_simple::server_stop() {
     g_running_flag = false;
-    LOG(INFO) << "Server stop command issued";
     if (-1 != g_server_fd) {
         shutdown(g_server_fd, SHUT_RDWR);
     } else {
@@ -157,86 +209,160 @@ void server_simple::server_terminate_handler(int signum) {
     }
 }
 
-int server_simple::gc_routine() {
-    int rc = STATUS_SUCCESS;
-    size_t del_num_fd = 0;
-    size_t del_num_str = 0;
+void server_simple::log_stats() {
+    LOG(INFO) << "Connections accepted: " << g_accept_count << ", shed: " << g_shed_count
+              << ", deferred accepts: " << g_defer_count;
+    LOG(INFO) << "Connections reaped on timeout: " << g_reap_count;
+}
 
-    if (g_garbage_count < GC_THRESHOLD) {
-        return STATUS_SUCCESS;
-    }
+int server_simple::get_wait_timeout() {
+    int timeout_ms = g_timers.next_timeout_ms(timing_wheel_now_ms());
+    return -1 == timeout_ms ? INFTIM : timeout_ms;
+}
 
-    g_db_fd_pool.erase(std::remove_if(g_db_fd_pool.begin(), g_db_fd_pool.end(),
-                                      [&del_num_fd](const pollfd &elem) {
-                                          if (elem.fd == FD_POOL_DUMMY_FD) {
-                                              del_num_fd++;
-                                          }
-                                          return elem.fd == FD_POOL_DUMMY_FD;
-                                      }), g_db_fd_pool.end());
-    g_db_addr_str.erase(std::remove_if(g_db_addr_str.begin(), g_db_addr_str.end(),
-                                       [&del_num_str](const std::string &elem) {
-                                           if (elem.empty()) {
-                                               del_num_str++;
-                                           }
-                                           return elem.empty();
-                                       }), g_db_addr_str.end());
-
-    if (del_num_fd == g_garbage_count && del_num_str == g_garbage_count) {
-        LOG(INFO) << "GC clean up " << g_garbage_count << " elements";
-        rc = STATUS_SUCCESS;
-    } else {
-        LOG(ERROR) << "GC encountered a critical BUG" << g_garbage_count;
-        rc = STATUS_FAIL;
-    }
-    g_garbage_count = 0;
-    return rc;
+server_simple::client::client_data &server_simple::client::get_client(size_t client_pool_index) {
+    return g_client_db[client_pool_index - FIRST_CLIENT_FD_INDEX];
 }
 
-int server_simple::client::connect_client() {
+int server_simple::client::connect_clients() {
     struct sockaddr_in client_addr{};
-    socklen_t client_addr_len = sizeof(client_addr);
+    socklen_t client_addr_len;
     int client_sock_fd;
+    bool near_limit;
+
+    for (uint32_t budget = FLAGS_accept_batch; budget > 0; --budget) {
+        // the clients stay blocking: they are read and written only once poll reports them
+        client_sock_fd = socket_accept(g_server_fd, SOCK_CLOEXEC, &client_addr, &client_addr_len);
+        if (client_sock_fd < 0) {
+            if (EAGAIN == errno || EWOULDBLOCK == errno) {
+                return STATUS_SUCCESS;
+            } else if (EMFILE == errno || ENFILE == errno) {
+                ALOG(WARNING) << "Out of file descriptors, the new connections wait for a client to close";
+                client::defer_clients();
+                return STATUS_SUCCESS;
+            }
+            PLOG(ERROR) << "Error calling accept4()";
+            return STATUS_FAIL;
+        }
+        near_limit = socket_admission_near_limit(client_sock_fd);
+        if (near_limit && socket_admission_sheds()) {
+            socket_shed(client_sock_fd);
+            g_shed_count++;
+            continue; // for
+        }
 
-    client_sock_fd = accept(g_server_fd, (struct sockaddr *) &client_addr, &client_addr_len);
-    if (client_sock_fd < 0) {
-        PLOG(ERROR) << "Error calling accept()";
-        return STATUS_FAIL;
+        // a freed slot is reused first, so the poll set grows only with the peak connections number
+        size_t client_pool_index = g_client_db.insert().index + FIRST_CLIENT_FD_INDEX;
+        if (client_pool_index == g_db_fd_pool.size()) {
+            g_db_fd_pool.emplace_back(pollfd{client_sock_fd, POLLIN | POLLERR | POLLHUP | POLLNVAL, 0});
+        } else {
+            g_db_fd_pool[client_pool_index] = pollfd{client_sock_fd, POLLIN | POLLERR | POLLHUP | POLLNVAL, 0};
+        }
+        client::get_client(client_pool_index).peer = peer_addr_from(client_addr);
+        client::get_client(client_pool_index).accept_time_ns = stage_stats_now();
+        if (0 != FLAGS_write_timeout_ms) {
+            socket_set_timeouts(client_sock_fd, 0, FLAGS_write_timeout_ms);
+        }
+        if (0 != FLAGS_idle_timeout_ms) {
+            client::get_client(client_pool_index).timer = g_timers.add(connection_deadline_ms(g_now_ms, false),
+                                                                        client_pool_index);
+        }
+        g_accept_count++;
+        DLOG(INFO) << "New connection from " << client::get_client(client_pool_index).peer;
+
+        // the reserve is kept for this one; the next connections wait
+        if (near_limit) {
+            client::defer_clients();
+            return STATUS_SUCCESS;
+        }
     }
-    g_db_fd_pool.emplace_back(pollfd{client_sock_fd, POLLIN | POLLERR | POLLHUP | POLLNVAL, 0});
-    // g_db_addr_str expects not empty string
-    g_db_addr_str.emplace_back(get_socket_addr_str(&client_addr, client_addr_len));
-    DLOG(INFO) << "New connection from " << g_db_addr_str.back();
     return STATUS_SUCCESS;
 }
 
+void server_simple::client::defer_clients() {
+    g_db_fd_pool[SERVER_FD_INDEX].events = 0;
+    g_defer_count++;
+}
+
 void server_simple::client::close_client(size_t client_pool_index) {
     // Disconnect
     close(g_db_fd_pool[client_pool_index].fd);
-    DLOG(INFO) << "Connection closed for " << g_db_addr_str[client_pool_index];
+    DLOG(INFO) << "Connection closed for " << client::get_client(client_pool_index).peer;
     g_db_fd_pool[client_pool_index].fd = FD_POOL_DUMMY_FD;
-    g_db_addr_str[client_pool_index] = FD_POOL_EMPTY_ADDRESS_STR;
-    g_garbage_count++;
+    splice_pipe_release(client::get_client(client_pool_index).pipe);
+    if (TIMER_ID_NONE != client::get_client(client_pool_index).timer) {
+        g_timers.cancel(client::get_client(client_pool_index).timer);
+        client::get_client(client_pool_index).timer = TIMER_ID_NONE;
+    }
+    g_client_db.erase(g_client_db.get_key(client_pool_index - FIRST_CLIENT_FD_INDEX));
+    // a deferring listener takes connections again; the next accept checks the limit anew
+    g_db_fd_pool[SERVER_FD_INDEX].events = SERVER_FD_EVENTS;
 }
 
-int server_simple::client::get_request_client(size_t client_pool_index, std::string &msg_buffer) {
+int server_simple::client::get_request_client(size_t client_pool_index, stream_buffer &msg_buffer) {
     int io_status = read_msg(g_db_fd_pool[client_pool_index].fd, msg_buffer);
     if (STATUS_SUCCESS != io_status) {
-        LOG(WARNING) << "Error failed to read from " << g_db_addr_str[client_pool_index];
+        ALOG(WARNING) << "Error failed to read from " << client::get_client(client_pool_index).peer;
         client::close_client(client_pool_index);
         return STATUS_FAIL;
     }
     // Handling EOF message
-    if (msg_buffer.empty()) {
+    if (0 == msg_buffer.end) {
         client::close_client(client_pool_index);
         return STATUS_FAIL;
     }
     return STATUS_SUCCESS;
 }
 
-void server_simple::client::send_response_client(size_t client_pool_index, const std::string &msg_buffer) {
+void server_simple::client::send_response_client(size_t client_pool_index, const stream_buffer &msg_buffer) {
     int io_status = write_msg(g_db_fd_pool[client_pool_index].fd, msg_buffer);
     if (STATUS_SUCCESS != io_status) {
-        LOG(WARNING) << "Error failed to write from " << g_db_addr_str[client_pool_index];
+        if (EAGAIN == errno || EWOULDBLOCK == errno) {
+            DLOG(INFO) << "Connection timed out for " << client::get_client(client_pool_index).peer;
+            g_reap_count++;
+        } else {
+            ALOG(WARNING) << "Error failed to write from " << client::get_client(client_pool_index).peer;
+        }
+        client::close_client(client_pool_index);
+    }
+}
+
+bool server_simple::client::splice_response_client(size_t client_pool_index) {
+    ssize_t pending_size = socket_get_pending_size(g_db_fd_pool[client_pool_index].fd);
+    if (pending_size < FLAGS_splice_threshold) {
+        // EOF and errors are detected by the regular read
+        return false;
+    }
+
+    int io_status = echo_splice(g_db_fd_pool[client_pool_index].fd, client::get_client(client_pool_index).pipe,
+                                pending_size);
+    if (STATUS_FAIL == io_status) {
+        if (EAGAIN == errno || EWOULDBLOCK == errno) {
+            DLOG(INFO) << "Connection timed out for " << client::get_client(client_pool_index).peer;
+            g_reap_count++;
+        } else {
+            ALOG(WARNING) << "Error failed to splice for " << client::get_client(client_pool_index).peer;
+        }
+        client::close_client(client_pool_index);
+    } else if (STATUS_EOF == io_status) {
+        client::close_client(client_pool_index);
+    } else {
+        DLOG(INFO) << "Spliced " << pending_size << " bytes for " << client::get_client(client_pool_index).peer;
+    }
+    return true;
+}
+
+void server_simple::client::reap_clients() {
+    uint64_t client_pool_index;
+
+    if (0 == g_timers.advance(g_now_ms)) {
+        return;
+    }
+    while (g_timers.pop_expired(client_pool_index)) {
+        // the timer id is already free
+        client::get_client(client_pool_index).timer = TIMER_ID_NONE;
+        DLOG(INFO) << "Connection timed out for " << client::get_client(client_pool_index).peer;
         client::close_client(client_pool_index);
+        g_reap_count++;
     }
 }
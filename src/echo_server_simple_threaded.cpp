@@ -1,86 +1,171 @@
 #include "echo_server_simple_threaded.h"
 #include <iostream>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
-#include <csignal>
+#include <cstring>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <thread>
+#include <deque>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cerrno>
 
 #include "common/io.h"
 #include "common/defines.h"
 #include "common/socket.h"
 #include "common/logging.h"
+#include "common/stage_stats.h"
+#include "common/config.h"
+#include "common/timing_wheel.h"
+#include "common/connection.h"
 
 
+// Type declarations
+namespace server_simple_threaded {
+    namespace client {
+        // an accepted connection waiting for a free handler thread
+        struct pending_client {
+            int fd = -1;
+            peer_addr peer{};
+            uint64_t accept_time_ns = 0;
+        };
+    }
+
+    namespace pool {
+        struct worker_data {
+            pthread_t thread{};
+            // the served client, -1 while the thread waits for one; guarded by g_pool_mutex
+            int fd = -1;
+            bool served = false;
+        };
+    }
+}
+
+
+// A bounded pool of blocking handler threads with small stacks: a thread serves one connection at a time
+// and takes the next accepted one when its client closes, so threads are started only to raise the peak.
 namespace server_simple_threaded {
     bool g_running_flag = false;
     int g_server_fd = -1;
+    size_t g_accept_count = 0;
+    // connections reset by the admission control near the fd limit, or while no handler thread runs
+    size_t g_shed_count = 0;
+    // connections closed by SO_RCVTIMEO and SO_SNDTIMEO: a blocked handler has no loop to check a timer wheel
+    std::atomic<size_t> g_reap_count = 0;
+
+    // the pool state below is guarded by g_pool_mutex
+    std::mutex g_pool_mutex{};
+    std::condition_variable g_pool_cv{};
+    std::deque<client::pending_client> g_pending_clients{};
+    // a thread keeps a pointer to its entry, so the entries never move
+    std::vector<std::unique_ptr<pool::worker_data>> g_workers{};
+    size_t g_idle_count = 0;
+    bool g_pool_stop = false;
+    // connections taken by a thread which served another one before
+    size_t g_reuse_count = 0;
 
     int server_init(uint16_t port);
 
-    void server_terminate_handler(int signum);
+    int server_run();
 
-    namespace client {
-        void client_handler(int fd, std::string name);
+    void server_stop();
+
+    void log_stats();
 
-        int connect_client(int &fd, std::string &name);
+    namespace pool {
+        // call with g_pool_mutex locked
+        int spawn_worker();
 
-        void close_client(int fd, const std::string &name);
+        void *worker_routine(void *arg);
 
-        int get_request_client(int fd, const std::string &name, std::string &msg_buffer);
+        // STATUS_FAIL if the client was shed: no handler thread runs and none could start
+        int submit_client(client::pending_client &&client);
 
-        int send_response_client(int fd, const std::string &name, const std::string &msg_buffer);
+        // wakes the handlers blocked on their clients and joins all threads
+        void pool_deinit();
     }
-}
 
-int echo_server_simple_threaded_main(uint16_t port) {
-    int client_fd;
-    std::string client_name{};
-    std::string msg_buffer{};
-    std::vector<std::thread> thread_db{};
+    namespace client {
+        void client_handler(int fd, const peer_addr &peer, uint64_t accept_time_ns);
 
-    using namespace server_simple_threaded;
+        int connect_client(int &fd, peer_addr &peer);
 
-    thread_db.reserve(SERVER_EXPECT_CONNECTIONS);
+        void close_client(int fd, const peer_addr &peer);
 
-    if (STATUS_SUCCESS != server_init(port)) {
-        return STATUS_FAIL;
+        int get_request_client(int fd, const peer_addr &peer, stream_buffer &msg_buffer);
+
+        int send_response_client(int fd, const peer_addr &peer, const stream_buffer &msg_buffer);
     }
+}
+
+const engine_t g_engine_simple_threaded{"simple_threaded", server_simple_threaded::server_init,
+                                        server_simple_threaded::server_run, server_simple_threaded::server_stop,
+                                        server_simple_threaded::log_stats};
+
+int server_simple_threaded::server_run() {
+    int client_fd;
+    peer_addr client_peer{};
 
-    g_running_flag = true;
     while (g_running_flag) {
-        if (STATUS_SUCCESS != client::connect_client(client_fd, client_name)) {
+        if (STATUS_SUCCESS != client::connect_client(client_fd, client_peer)) {
             break;  // while (g_running_flag)
         }
-        thread_db.emplace_back(client::client_handler, client_fd, client_name);
+        if (-1 == client_fd) {
+            continue; // while (g_running_flag)
+        }
+        if (STATUS_SUCCESS == pool::submit_client(client::pending_client{client_fd, client_peer, stage_stats_now()})) {
+            g_accept_count++;
+        }
     } // while (g_running_flag)
 
+    pool::pool_deinit();
     close(g_server_fd);
     LOG(INFO) << "Server stopped";
     return STATUS_SUCCESS;
 }
 
 int server_simple_threaded::server_init(uint16_t port) {
+    // one thread at least: it proves the threads can start with the configured stack
+    uint32_t prespawn = std::max(std::min(FLAGS_blocking_pool_prespawn, FLAGS_blocking_pool_size), 1U);
+
     g_server_fd = server_socket_init(port);
     if (g_server_fd < 0) {
         return STATUS_FAIL;
     }
 
-    signal(SIGINT, server_terminate_handler);
+    LOG(INFO) << "Starting " << prespawn << " of at most " << FLAGS_blocking_pool_size << " handler threads with "
+              << FLAGS_thread_stack_size / 1024 << " KiB stacks";
+    // a served client holds its handler thread: the message buffer and at most the reserved stack
+    log_connection_footprint(sizeof(pool::worker_data) + sizeof(std::unique_ptr<pool::worker_data>),
+                             FLAGS_message_size + 1 + FLAGS_thread_stack_size, false);
+    g_workers.reserve(FLAGS_blocking_pool_size);
+    {
+        std::lock_guard<std::mutex> lg{g_pool_mutex};
+        for (uint32_t i = 0; i < prespawn; ++i) {
+            if (STATUS_SUCCESS != pool::spawn_worker()) {
+                break; // for
+            }
+        }
+        if (g_workers.empty()) {
+            LOG(ERROR) << "Error no handler thread could start";
+            close(g_server_fd);
+            g_server_fd = -1;
+            return STATUS_FAIL;
+        }
+    }
+
+    g_running_flag = true;
     return STATUS_SUCCESS;
 }
 
-void server_simple_threaded::server_terminate_handler(int signum) {
-    if (!g_running_flag) {
-        close(g_server_fd);
-        LOG(WARNING) << "Server force stop";
-        logging_deinit();
-        exit(STATUS_FAIL);
-    }
+void server_simple_threaded::server_stop() {
     g_running_flag = false;
-    LOG(WARNING) << "Server stop command issued";
     if (-1 != g_server_fd) {
         shutdown(g_server_fd, SHUT_RDWR);
     } else {
@@ -88,66 +173,193 @@ void server_simple_threaded::server_terminate_handler(int signum) {
     }
 }
 
-void server_simple_threaded::client::client_handler(int fd, std::string name) {
-    std::string msg_buffer{};
+// the threads are joined by now
+void server_simple_threaded::log_stats() {
+    LOG(INFO) << "Connections accepted: " << g_accept_count << ", shed: " << g_shed_count;
+    LOG(INFO) << "Handler threads started: " << g_workers.size() << ", connections served by a reused thread: "
+              << g_reuse_count;
+    LOG(INFO) << "Connections reaped on timeout: " << g_reap_count;
+}
+
+int server_simple_threaded::pool::spawn_worker() {
+    pthread_attr_t attr;
+    int rc;
+
+    pthread_attr_init(&attr);
+    // the stack is only reserved; RSS grows with the pages a handler touches
+    rc = pthread_attr_setstacksize(&attr, FLAGS_thread_stack_size);
+    if (0 == rc) {
+        g_workers.emplace_back(std::make_unique<worker_data>());
+        rc = pthread_create(&g_workers.back()->thread, &attr, worker_routine, g_workers.back().get());
+        if (0 != rc) {
+            g_workers.pop_back();
+        }
+    }
+    pthread_attr_destroy(&attr);
+    if (0 != rc) {
+        // the pending clients wait for a running thread
+        ALOG(WARNING) << "Error failed to start a handler thread: " << strerror(rc);
+        return STATUS_FAIL;
+    }
+    g_idle_count++;
+    return STATUS_SUCCESS;
+}
+
+void *server_simple_threaded::pool::worker_routine(void *arg) {
+    auto &worker = *static_cast<worker_data *>(arg);
+    client::pending_client client{};
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock{g_pool_mutex};
+            g_pool_cv.wait(lock, [] { return g_pool_stop || !g_pending_clients.empty(); });
+            if (g_pool_stop) {
+                break; // while
+            }
+            client = std::move(g_pending_clients.front());
+            g_pending_clients.pop_front();
+            g_idle_count--;
+            g_reuse_count += worker.served ? 1 : 0;
+            worker.served = true;
+            worker.fd = client.fd;
+        }
+
+        client::client_handler(client.fd, client.peer, client.accept_time_ns);
+
+        // the slot is cleared before the fd is closed, so pool_deinit never shuts down a reused fd number
+        {
+            std::lock_guard<std::mutex> lg{g_pool_mutex};
+            worker.fd = -1;
+            g_idle_count++;
+        }
+        client::close_client(client.fd, client.peer);
+    } // while (true)
+    return nullptr;
+}
+
+int server_simple_threaded::pool::submit_client(client::pending_client &&client) {
+    {
+        std::lock_guard<std::mutex> lg{g_pool_mutex};
+        // a busy pool grows up to --blocking_pool_size; beyond it the client waits for a thread to finish
+        if (g_idle_count <= g_pending_clients.size() && g_workers.size() < FLAGS_blocking_pool_size) {
+            spawn_worker();
+        }
+        // the threads run until the stop, so a pool without one would never serve the queue
+        if (g_workers.empty()) {
+            socket_shed(client.fd);
+            g_shed_count++;
+            return STATUS_FAIL;
+        }
+        g_pending_clients.emplace_back(std::move(client));
+    }
+    g_pool_cv.notify_one();
+    return STATUS_SUCCESS;
+}
+
+void server_simple_threaded::pool::pool_deinit() {
+    {
+        std::lock_guard<std::mutex> lg{g_pool_mutex};
+        g_pool_stop = true;
+        for (auto &worker: g_workers) {
+            if (-1 != worker->fd) {
+                shutdown(worker->fd, SHUT_RDWR);
+            }
+        }
+        for (auto &client: g_pending_clients) {
+            client::close_client(client.fd, client.peer);
+        }
+        g_pending_clients.clear();
+    }
+    g_pool_cv.notify_all();
+    for (auto &worker: g_workers) {
+        pthread_join(worker->thread, nullptr);
+    }
+    DLOG(INFO) << "All handler threads stopped";
+}
+
+void server_simple_threaded::client::client_handler(int fd, const peer_addr &peer, uint64_t accept_time_ns) {
+    stream_buffer msg_buffer{};
 
     while (true) {
-        if (STATUS_SUCCESS != client::get_request_client(fd, name, msg_buffer)) {
+        if (STATUS_SUCCESS != client::get_request_client(fd, peer, msg_buffer)) {
             break;
         }
-        DLOG(INFO) << "Read from " << name << " msg:\n" << msg_buffer;
-        if (STATUS_SUCCESS != client::send_response_client(fd, name, msg_buffer)) {
+        if (0 != accept_time_ns) {
+            stage_stats_record(STAGE_ACCEPT_TO_FIRST_READ, accept_time_ns);
+            accept_time_ns = 0;
+        }
+        DLOG(INFO) << "Read from " << peer << " msg:\n"
+                   << std::string_view(msg_buffer.data.get(), msg_buffer.end);
+        if (STATUS_SUCCESS != client::send_response_client(fd, peer, msg_buffer)) {
             break;
         }
     }
 }
 
-int server_simple_threaded::client::connect_client(int &fd, std::string &name) {
+// fd is -1 if the connection was shed
+int server_simple_threaded::client::connect_client(int &fd, peer_addr &peer) {
     struct sockaddr_in client_addr{};
-    socklen_t client_addr_len = sizeof(client_addr);
+    socklen_t client_addr_len;
     int client_sock_fd;
 
-    client_sock_fd = accept(g_server_fd, (struct sockaddr *) &client_addr, &client_addr_len);
+    client_sock_fd = socket_accept(g_server_fd, SOCK_CLOEXEC, &client_addr, &client_addr_len);
     if (client_sock_fd < 0) {
         if (g_running_flag) {
-            PLOG(ERROR) << "Error calling accept()";
+            PLOG(ERROR) << "Error calling accept4()";
         }
         // EXIT PROGRAM
         return STATUS_FAIL;
     }
+    if (socket_admission_near_limit(client_sock_fd)) {
+        socket_shed(client_sock_fd);
+        g_shed_count++;
+        fd = -1;
+        return STATUS_SUCCESS;
+    }
+    if (connection_timeouts_enabled()) {
+        socket_set_timeouts(client_sock_fd, FLAGS_idle_timeout_ms, FLAGS_write_timeout_ms);
+    }
     fd = client_sock_fd;
-    name = get_socket_addr_str(&client_addr, client_addr_len);
-    DLOG(INFO) << "New connection from " << name;
+    peer = peer_addr_from(client_addr);
+    DLOG(INFO) << "New connection from " << peer;
     return STATUS_SUCCESS;
 }
 
-void server_simple_threaded::client::close_client(int fd, const std::string &name) {
+void server_simple_threaded::client::close_client(int fd, const peer_addr &peer) {
     // Disconnect
     close(fd);
-    DLOG(INFO) << "Connection closed for " << name;
+    DLOG(INFO) << "Connection closed for " << peer;
 }
 
-int server_simple_threaded::client::get_request_client(int fd, const std::string &name, std::string &msg_buffer) {
+// the handler thread closes the client once it fails
+int server_simple_threaded::client::get_request_client(int fd, const peer_addr &peer, stream_buffer &msg_buffer) {
     int io_status = read_msg(fd, msg_buffer);
     if (STATUS_SUCCESS != io_status) {
-        LOG(WARNING) << "failed to read from " << name;
-        client::close_client(fd, name);
+        if (EAGAIN == errno || EWOULDBLOCK == errno) {
+            DLOG(INFO) << "Connection timed out for " << peer;
+            g_reap_count.fetch_add(1, std::memory_order_relaxed);
+            return STATUS_FAIL;
+        }
+        ALOG(WARNING) << "failed to read from " << peer;
         return STATUS_FAIL;
     }
     // Handling EOF message
-    if (msg_buffer.empty()) {
-        client::close_client(fd, name);
+    if (0 == msg_buffer.end) {
         return STATUS_FAIL;
     }
     return STATUS_SUCCESS;
 }
 
 int server_simple_threaded::client::send_response_client(int fd,
-                                                         const std::string &name, const std::string &msg_buffer) {
+                                                         const peer_addr &peer, const stream_buffer &msg_buffer) {
     int io_status = write_msg(fd, msg_buffer);
     if (STATUS_SUCCESS != io_status) {
-        LOG(WARNING) << "failed to write to " << name;
-        client::close_client(fd, name);
+        if (EAGAIN == errno || EWOULDBLOCK == errno) {
+            DLOG(INFO) << "Connection timed out for " << peer;
+            g_reap_count.fetch_add(1, std::memory_order_relaxed);
+            return STATUS_FAIL;
+        }
+        ALOG(WARNING) << "failed to write to " << peer;
         return STATUS_FAIL;
     }
     return STATUS_SUCCESS;
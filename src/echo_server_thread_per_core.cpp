@@ -0,0 +1,120 @@
+#include "echo_server_thread_per_core.h"
+#include <iostream>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+#include "common/defines.h"
+#include "common/socket.h"
+#include "common/logging.h"
+#include "common/config.h"
+#include "common/affinity.h"
+#include "common/epoll_reactor.h"
+
+
+namespace server_thread_per_core {
+    std::atomic_bool g_running_flag = false;
+    std::atomic_int g_rc = STATUS_SUCCESS;
+    // one SO_REUSEPORT listener per thread; filled before the threads start
+    std::vector<int> g_server_fds{};
+    std::vector<std::thread> g_thread_list{};
+    epoll_reactor_stats g_stats{};
+
+    int server_init(uint16_t port);
+
+    int server_run();
+
+    void server_deinit();
+
+    void server_stop();
+
+    void log_stats();
+
+    // Shared-nothing: every thread runs its own reactor with its listener, event loop and connection table
+    void server_worker(size_t thread_index);
+}
+
+const engine_t g_engine_thread_per_core{"thread_per_core", server_thread_per_core::server_init,
+                                        server_thread_per_core::server_run, server_thread_per_core::server_stop,
+                                        server_thread_per_core::log_stats};
+
+int server_thread_per_core::server_run() {
+    for (size_t i = 1; i < g_server_fds.size(); ++i) {
+        g_thread_list.emplace_back(server_worker, i);
+    }
+    server_worker(0);
+    for (auto &thread: g_thread_list) {
+        thread.join();
+    }
+
+    server_deinit();
+    return g_rc;
+}
+
+int server_thread_per_core::server_init(uint16_t port) {
+    size_t thread_num = FLAGS_threads;
+    int server_fd;
+
+    LOG(INFO) << "Starting " << thread_num << " reactor threads";
+
+    // All listeners exist before any thread runs, so the kernel spreads connections over all of them
+    g_server_fds.reserve(thread_num);
+    for (size_t i = 0; i < thread_num; ++i) {
+        server_fd = server_socket_reuseport_init(port);
+        if (server_fd < 0 || STATUS_SUCCESS != socket_set_nonblocking(server_fd)) {
+            if (server_fd >= 0) {
+                close(server_fd);
+            }
+            server_deinit();
+            return STATUS_FAIL;
+        }
+        g_server_fds.push_back(server_fd);
+        // the listener of thread i gets the connections received on the CPU of thread i
+        if (FLAGS_incoming_cpu && affinity_get_cpu(i) >= 0) {
+            socket_set_incoming_cpu(server_fd, affinity_get_cpu(i));
+        }
+    }
+    g_thread_list.reserve(thread_num - 1);
+    epoll_reactor::log_footprint();
+
+    g_running_flag = true;
+    return STATUS_SUCCESS;
+}
+
+void server_thread_per_core::server_deinit() {
+    for (int server_fd: g_server_fds) {
+        close(server_fd);
+    }
+    g_server_fds.clear();
+    LOG(INFO) << "Server stopped";
+}
+
+// wakes up every reactor: a shut down listener reports EPOLLHUP
+void server_thread_per_core::server_stop() {
+    g_running_flag = false;
+    for (int server_fd: g_server_fds) {
+        shutdown(server_fd, SHUT_RDWR);
+    }
+}
+
+void server_thread_per_core::log_stats() {
+    LOG(INFO) << "Connections accepted: " << g_stats.accept_count << ", shed: " << g_stats.shed_count
+              << ", deferred accepts: " << g_stats.defer_count;
+    LOG(INFO) << "Connections reaped on timeout: " << g_stats.reap_count;
+}
+
+void server_thread_per_core::server_worker(size_t thread_index) {
+    // keep the thread and its connection state on one core; the reactor tables are allocated on its node
+    affinity_pin_thread(thread_index);
+
+    epoll_reactor reactor{g_stats};
+    if (STATUS_SUCCESS != reactor.init(g_server_fds[thread_index], FLAGS_expect_connections / g_server_fds.size()) ||
+        STATUS_SUCCESS != reactor.run(g_running_flag)) {
+        // one failed reactor stops the server
+        g_rc = STATUS_FAIL;
+        server_stop();
+    }
+    DLOG(INFO) << "Reactor thread " << thread_index << " stopped";
+}
@@ -0,0 +1,290 @@
+#include "echo_server_udp.h"
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+#include "common/defines.h"
+#include "common/socket.h"
+#include "common/logging.h"
+#include "common/stage_stats.h"
+#include "common/config.h"
+#include "common/affinity.h"
+
+// older libc headers do not have the UDP offload options
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT                     (103)
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO                         (104)
+#endif
+
+
+// Every thread receives a batch of datagrams with one recvmmsg and echoes all of them with one sendmmsg.
+// With --udp_reuseport the kernel shards the datagrams over per-thread sockets by the flow hash.
+namespace server_udp {
+    struct worker_data {
+        int fd = -1;
+        std::vector<mmsghdr> recv_msgs{};
+        std::vector<mmsghdr> send_msgs{};
+        std::vector<iovec> recv_iovs{};
+        std::vector<iovec> send_iovs{};
+        std::vector<sockaddr_in> addrs{};
+        // UDP_DATAGRAM_BUFFER_SIZE bytes per datagram of a batch
+        std::vector<char> buffers{};
+        // the UDP_GRO cmsg of a received datagram and the UDP_SEGMENT cmsg of its echo
+        std::vector<char> recv_controls{};
+        std::vector<char> send_controls{};
+        uint64_t packet_count = 0;
+        uint64_t byte_count = 0;
+        uint64_t batch_count = 0;
+        // truncated datagrams and failed sends
+        uint64_t drop_count = 0;
+    };
+
+    constexpr size_t g_recv_control_size = CMSG_SPACE(sizeof(int));
+    constexpr size_t g_send_control_size = CMSG_SPACE(sizeof(uint16_t));
+
+    std::atomic_bool g_running_flag = false;
+    std::atomic_int g_rc = STATUS_SUCCESS;
+    // one socket per thread with --udp_reuseport, otherwise one shared socket
+    std::vector<int> g_server_fds{};
+    std::vector<std::thread> g_thread_list{};
+    std::atomic<uint64_t> g_packet_count = 0;
+    std::atomic<uint64_t> g_byte_count = 0;
+    std::atomic<uint64_t> g_batch_count = 0;
+    std::atomic<uint64_t> g_drop_count = 0;
+
+    int server_init(uint16_t port);
+
+    int server_run();
+
+    void server_deinit();
+
+    void server_stop();
+
+    void log_stats();
+
+    void server_worker(size_t thread_index);
+
+    int worker_init(worker_data &worker, size_t thread_index);
+
+    // returns the number of echoes to send
+    size_t prepare_echoes(worker_data &worker, size_t received);
+
+    void send_echoes(worker_data &worker, size_t count);
+}
+
+const engine_t g_engine_udp{"udp", server_udp::server_init, server_udp::server_run, server_udp::server_stop,
+                            server_udp::log_stats};
+
+int server_udp::server_run() {
+    for (size_t i = 1; i < FLAGS_threads; ++i) {
+        g_thread_list.emplace_back(server_worker, i);
+    }
+    server_worker(0);
+    for (auto &thread: g_thread_list) {
+        thread.join();
+    }
+
+    server_deinit();
+    return g_rc;
+}
+
+int server_udp::server_init(uint16_t port) {
+    size_t socket_num = FLAGS_udp_reuseport ? FLAGS_threads : 1;
+    int server_fd;
+
+    LOG(INFO) << "Starting " << FLAGS_threads << " threads on " << socket_num << " UDP socket(s)";
+
+    // All sockets exist before any thread runs, so the kernel spreads datagrams over all of them
+    g_server_fds.reserve(socket_num);
+    for (size_t i = 0; i < socket_num; ++i) {
+        server_fd = server_udp_socket_init(port, FLAGS_udp_reuseport);
+        if (server_fd < 0) {
+            server_deinit();
+            return STATUS_FAIL;
+        }
+        g_server_fds.push_back(server_fd);
+        int enable = 1;
+        if (FLAGS_udp_gro && STATUS_SUCCESS != setsockopt(server_fd, IPPROTO_UDP, UDP_GRO, &enable, sizeof(enable))) {
+            PLOG(ERROR) << "Error setting UDP_GRO";
+            server_deinit();
+            return STATUS_FAIL;
+        }
+        // the socket of thread i gets the datagrams received on the CPU of thread i
+        if (FLAGS_udp_reuseport && FLAGS_incoming_cpu && affinity_get_cpu(i) >= 0) {
+            socket_set_incoming_cpu(server_fd, affinity_get_cpu(i));
+        }
+    }
+    g_thread_list.reserve(FLAGS_threads - 1);
+
+    g_running_flag = true;
+    return STATUS_SUCCESS;
+}
+
+void server_udp::server_deinit() {
+    for (int server_fd: g_server_fds) {
+        close(server_fd);
+    }
+    g_server_fds.clear();
+    LOG(INFO) << "Server stopped";
+}
+
+// a shut down socket wakes up the threads blocked in recvmmsg
+void server_udp::server_stop() {
+    g_running_flag = false;
+    for (int server_fd: g_server_fds) {
+        shutdown(server_fd, SHUT_RDWR);
+    }
+}
+
+void server_udp::log_stats() {
+    uint64_t batch_count = g_batch_count;
+
+    LOG(INFO) << "Datagrams echoed: " << g_packet_count << ", bytes: " << g_byte_count
+              << ", dropped: " << g_drop_count << ", receive batches: " << batch_count << ", datagrams per batch: "
+              << (0 == batch_count ? 0.0 : static_cast<double>(g_packet_count) / static_cast<double>(batch_count));
+}
+
+void server_udp::server_worker(size_t thread_index) {
+    worker_data worker{};
+    int received;
+
+    if (STATUS_SUCCESS != worker_init(worker, thread_index)) {
+        g_rc = STATUS_FAIL;
+        server_stop();
+        return;
+    }
+
+    while (g_running_flag) {
+        // the kernel overwrites the lengths of the address, the control data and the flags
+        for (auto &msg: worker.recv_msgs) {
+            msg.msg_hdr.msg_namelen = sizeof(sockaddr_in);
+            msg.msg_hdr.msg_controllen = FLAGS_udp_gro ? g_recv_control_size : 0;
+            msg.msg_hdr.msg_flags = 0;
+        }
+        // blocks for the first datagram only
+        received = recvmmsg(worker.fd, worker.recv_msgs.data(), static_cast<unsigned int>(worker.recv_msgs.size()),
+                            MSG_WAITFORONE, nullptr);
+        if (!g_running_flag) {
+            break; // while (g_running_flag)
+        }
+        if (received < 0) {
+            if (EINTR == errno) {
+                continue; // while (g_running_flag)
+            }
+            PLOG(ERROR) << "Error calling recvmmsg";
+            g_rc = STATUS_FAIL;
+            server_stop();
+            break; // while (g_running_flag)
+        }
+        worker.batch_count++;
+        send_echoes(worker, prepare_echoes(worker, received));
+    }
+
+    g_packet_count += worker.packet_count;
+    g_byte_count += worker.byte_count;
+    g_batch_count += worker.batch_count;
+    g_drop_count += worker.drop_count;
+    DLOG(INFO) << "UDP thread stopped";
+}
+
+int server_udp::worker_init(worker_data &worker, size_t thread_index) {
+    size_t batch_size = FLAGS_udp_batch_size;
+
+    // keep the thread and its buffers on one core; they are allocated after pinning, on its node
+    affinity_pin_thread(thread_index);
+
+    worker.fd = g_server_fds[thread_index % g_server_fds.size()];
+    worker.recv_msgs.resize(batch_size);
+    worker.send_msgs.resize(batch_size);
+    worker.recv_iovs.resize(batch_size);
+    worker.send_iovs.resize(batch_size);
+    worker.addrs.resize(batch_size);
+    worker.buffers.resize(batch_size * UDP_DATAGRAM_BUFFER_SIZE);
+    worker.recv_controls.resize(batch_size * g_recv_control_size);
+    worker.send_controls.resize(batch_size * g_send_control_size);
+
+    for (size_t i = 0; i < batch_size; ++i) {
+        worker.recv_iovs[i] = iovec{worker.buffers.data() + i * UDP_DATAGRAM_BUFFER_SIZE, UDP_DATAGRAM_BUFFER_SIZE};
+        msghdr &hdr = worker.recv_msgs[i].msg_hdr;
+        hdr.msg_name = &worker.addrs[i];
+        hdr.msg_iov = &worker.recv_iovs[i];
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = worker.recv_controls.data() + i * g_recv_control_size;
+    }
+    DLOG(INFO) << "UDP thread " << thread_index << " started";
+    return STATUS_SUCCESS;
+}
+
+size_t server_udp::prepare_echoes(worker_data &worker, size_t received) {
+    size_t count = 0;
+
+    for (size_t i = 0; i < received; ++i) {
+        msghdr &recv_hdr = worker.recv_msgs[i].msg_hdr;
+        size_t length = worker.recv_msgs[i].msg_len;
+        int segment_size = 0;
+
+        if (recv_hdr.msg_flags & MSG_TRUNC) {
+            worker.drop_count++;
+            continue; // for
+        }
+        // a coalesced datagram is echoed as the same segments
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&recv_hdr); nullptr != cmsg; cmsg = CMSG_NXTHDR(&recv_hdr, cmsg)) {
+            if (IPPROTO_UDP == cmsg->cmsg_level && UDP_GRO == cmsg->cmsg_type) {
+                memcpy(&segment_size, CMSG_DATA(cmsg), sizeof(segment_size));
+            }
+        }
+
+        worker.send_iovs[count] = iovec{recv_hdr.msg_iov->iov_base, length};
+        msghdr &send_hdr = worker.send_msgs[count].msg_hdr;
+        send_hdr.msg_name = recv_hdr.msg_name;
+        send_hdr.msg_namelen = recv_hdr.msg_namelen;
+        send_hdr.msg_iov = &worker.send_iovs[count];
+        send_hdr.msg_iovlen = 1;
+        send_hdr.msg_control = nullptr;
+        send_hdr.msg_controllen = 0;
+        if (segment_size > 0 && static_cast<size_t>(segment_size) < length) {
+            auto gso_size = static_cast<uint16_t>(segment_size);
+            send_hdr.msg_control = worker.send_controls.data() + count * g_send_control_size;
+            send_hdr.msg_controllen = g_send_control_size;
+            cmsghdr *cmsg = CMSG_FIRSTHDR(&send_hdr);
+            cmsg->cmsg_level = IPPROTO_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(gso_size));
+            memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+        }
+        worker.packet_count += 0 == segment_size ? 1 : (length + segment_size - 1) / segment_size;
+        worker.byte_count += length;
+        count++;
+    }
+    return count;
+}
+
+void server_udp::send_echoes(worker_data &worker, size_t count) {
+    uint64_t send_time_ns = stage_stats_now();
+    size_t sent = 0;
+    int rc;
+
+    while (sent < count) {
+        rc = sendmmsg(worker.fd, worker.send_msgs.data() + sent, static_cast<unsigned int>(count - sent), 0);
+        if (rc < 0) {
+            if (EINTR == errno) {
+                continue; // while
+            }
+            // the error belongs to the first datagram; an unreachable peer must not stop the others
+            APLOG(WARNING) << "Error failed to echo a datagram";
+            worker.drop_count++;
+            sent++;
+            continue; // while
+        }
+        sent += rc;
+    }
+    stage_stats_record(STAGE_WRITE, send_time_ns);
+}
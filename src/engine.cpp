@@ -0,0 +1,125 @@
+#include "engine.h"
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <csignal>
+#include <cerrno>
+#include <atomic>
+#include <thread>
+
+#include "common/defines.h"
+#include "common/logging.h"
+#include "echo_server_simple.h"
+#include "echo_server_simple_threaded.h"
+#include "echo_server_custom_thread_pool.h"
+#include "echo_server_boost_asio.h"
+#include "echo_server_boost_asio_threaded.h"
+#include "echo_server_boost_asio_coroutine.h"
+#include "echo_server_epoll.h"
+#include "echo_server_io_uring.h"
+#include "echo_server_thread_per_core.h"
+#include "echo_server_udp.h"
+
+DEFINE_string(engine, "epoll", "Server engine: simple, simple_threaded, custom_thread_pool, boost_asio, "
+                               "boost_asio_threaded, boost_asio_coroutine, epoll, io_uring, thread_per_core "
+                               "or udp");
+
+namespace {
+    const engine_t *const g_engines[] = {
+            &g_engine_simple,
+            &g_engine_simple_threaded,
+            &g_engine_custom_thread_pool,
+            &g_engine_boost_asio,
+            &g_engine_boost_asio_threaded,
+            &g_engine_boost_asio_coroutine,
+            &g_engine_epoll,
+            &g_engine_io_uring,
+            &g_engine_thread_per_core,
+            &g_engine_udp,
+    };
+
+    const engine_t *g_engine = nullptr;
+    std::atomic_bool g_stop_issued = false;
+    // set once run returned; wakes the stop thread without stopping the engine
+    std::atomic_bool g_engine_done = false;
+    int g_stop_fd = -1;
+
+    void engine_terminate_handler(int signum) {
+        int saved_errno = errno;
+        uint64_t value = 1;
+
+        if (g_stop_issued.exchange(true)) {
+            LOG(WARNING) << "Server force stop";
+            logging_deinit();
+            exit(STATUS_FAIL);
+        }
+        // only async-signal-safe calls here: stopping an engine takes the locks the interrupted thread may hold
+        if (write(g_stop_fd, &value, sizeof(value)) < 0) {}
+        errno = saved_errno;
+    }
+
+    void engine_stop_routine() {
+        uint64_t value;
+
+        while (read(g_stop_fd, &value, sizeof(value)) < 0 && EINTR == errno) {}
+        if (!g_engine_done) {
+            LOG(INFO) << "Server stop command issued";
+            g_engine->stop();
+        }
+    }
+}
+
+const engine_t *engine_find(const std::string &name) {
+    for (const engine_t *engine: g_engines) {
+        if (name == engine->name) {
+            return engine;
+        }
+    }
+    return nullptr;
+}
+
+std::string engine_get_names() {
+    std::string names{};
+
+    for (const engine_t *engine: g_engines) {
+        if (!names.empty()) {
+            names += ',';
+        }
+        names += engine->name;
+    }
+    return names;
+}
+
+int engine_main(const engine_t &engine, uint16_t port) {
+    std::thread stop_thread{};
+    uint64_t value = 1;
+    int rc;
+
+    LOG(INFO) << "Starting engine " << engine.name;
+    g_engine = &engine;
+    g_stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (g_stop_fd < 0) {
+        PLOG(ERROR) << "Error calling eventfd";
+        return STATUS_FAIL;
+    }
+    signal(SIGINT, engine_terminate_handler);
+    // a write to a reset or reaped connection fails with EPIPE instead of killing the server
+    signal(SIGPIPE, SIG_IGN);
+
+    rc = engine.init(port);
+    if (STATUS_SUCCESS == rc) {
+        // stop must not run concurrently with init: a SIGINT during init stays counted in the eventfd,
+        // so the stop thread started now stops the engine at once
+        stop_thread = std::thread{engine_stop_routine};
+        rc = engine.run();
+        engine.log_stats();
+
+        g_engine_done = true;
+        if (write(g_stop_fd, &value, sizeof(value)) < 0) {
+            PLOG(ERROR) << "Error waking the engine stop thread";
+        }
+        stop_thread.join();
+    }
+    close(g_stop_fd);
+    g_stop_fd = -1;
+    return rc;
+}
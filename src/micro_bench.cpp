@@ -0,0 +1,242 @@
+#include "micro_bench.h"
+#include <iostream>
+#include <netinet/in.h>
+#include <iomanip>
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include "common/defines.h"
+#include "common/logging.h"
+#include "common/config.h"
+#include "common/thread_safe_queue.h"
+#include "common/lock_free_queue.h"
+#include "common/connection.h"
+
+
+#define BENCH_NAME_MIN_WIDTH            (34)
+
+DEFINE_string(benches, "all", "Comma-separated micro benchmarks to run, 'all' - every one of them");
+DEFINE_uint64(bench_ops, 1000000, "Operations per benchmark run");
+DEFINE_uint32(queue_threads, 2, "queue: producer threads, and as many consumer threads");
+
+
+namespace micro_bench {
+    struct bench_t {
+        const char *name;
+        // STATUS_FAIL stops the remaining benchmarks
+        int (*run)();
+    };
+
+    struct run_result {
+        std::string name;
+        uint64_t ops = 0;
+        uint64_t elapsed_ns = 0;
+    };
+
+    std::vector<run_result> g_results{};
+
+    int run_queue();
+
+    int run_async_log();
+
+    const bench_t g_benches[] = {
+            // the mutex queue of the original pool against the ring replacing it, both bounded by --work_queue_size
+            {"queue", run_queue},
+            // the cost of an ALOG call on the data path thread; the flush to glog is not timed
+            {"async_log", run_async_log},
+    };
+
+    std::vector<std::string> split_list(const std::string &list, char delimiter = ',');
+
+    uint64_t now_ns();
+
+    // n producers and n consumers move FLAGS_bench_ops values through the queue
+    template<typename Queue>
+    void bench_queue(const std::string &name, Queue &queue, uint32_t n);
+
+    // times FLAGS_bench_ops calls of log(i) in batches of one ring; the flushes between them are not timed
+    template<typename Log>
+    void bench_async_log(const std::string &name, Log log);
+
+    void print_results();
+}
+
+int micro_bench_main() {
+    using namespace micro_bench;
+
+    std::vector<std::string> names = split_list(FLAGS_benches);
+    for (const auto &name: names) {
+        bool found = "all" == name;
+        for (const auto &bench: g_benches) {
+            found = found || name == bench.name;
+        }
+        if (!found) {
+            LOG(ERROR) << "Error unknown benchmark " << name;
+            return STATUS_FAIL;
+        }
+    }
+    if (0 == FLAGS_bench_ops) {
+        LOG(ERROR) << "Error --bench_ops must be positive";
+        return STATUS_FAIL;
+    }
+
+    for (const auto &bench: g_benches) {
+        bool selected = false;
+        for (const auto &name: names) {
+            selected = selected || "all" == name || name == bench.name;
+        }
+        if (!selected) {
+            continue; // for
+        }
+        LOG(INFO) << "Running " << bench.name;
+        if (STATUS_SUCCESS != bench.run()) {
+            LOG(ERROR) << "Error benchmark " << bench.name << " failed";
+            print_results();
+            return STATUS_FAIL;
+        }
+    }
+
+    print_results();
+    return STATUS_SUCCESS;
+}
+
+int micro_bench::run_queue() {
+    uint32_t threads = std::max<uint32_t>(FLAGS_queue_threads, 1);
+
+    {
+        t_queue<uint64_t> queue{FLAGS_work_queue_size};
+        bench_queue("queue t_queue", queue, threads);
+    }
+    {
+        t_queue_lock_free<uint64_t> queue{FLAGS_work_queue_size};
+        bench_queue("queue t_queue_lock_free", queue, threads);
+    }
+    return STATUS_SUCCESS;
+}
+
+int micro_bench::run_async_log() {
+    size_t drop_count = async_log_get_drop_count();
+    peer_addr peer{htonl(INADDR_LOOPBACK), htons(ECHO_SERVER_PORT)};
+
+    if (!FLAGS_async_log) {
+        LOG(ERROR) << "Error async_log needs --async_log";
+        return STATUS_FAIL;
+    }
+    // the records are written to glog: keep them off the console and, for the rest of the run, out of the INFO file
+    google::SetStderrLogging(google::GLOG_FATAL);
+    google::SetLogDestination(google::GLOG_INFO, "");
+
+    // the shape of the data path records
+    bench_async_log("async_log ALOG peer", [&peer](uint64_t) {
+        ALOG(INFO) << "Error failed to read from " << peer;
+    });
+    bench_async_log("async_log ALOG 2 integers", [](uint64_t i) {
+        ALOG(INFO) << "Client " << i << " tried to READ in invalid state[" << static_cast<int>(i & 3) << ']';
+    });
+
+    google::SetStderrLogging(google::GLOG_INFO);
+    if (async_log_get_drop_count() != drop_count) {
+        LOG(ERROR) << "Error async_log dropped " << async_log_get_drop_count() - drop_count << " records";
+        return STATUS_FAIL;
+    }
+    return STATUS_SUCCESS;
+}
+
+template<typename Log>
+void micro_bench::bench_async_log(const std::string &name, Log log) {
+    uint64_t batch = FLAGS_async_log_ring_size;
+    uint64_t elapsed_ns = 0;
+    uint64_t start_time_ns;
+
+    // a batch fills the emptied ring at most, so no record is dropped
+    for (uint64_t done = 0; done < FLAGS_bench_ops; done += batch) {
+        uint64_t count = std::min(batch, FLAGS_bench_ops - done);
+        async_log_flush();
+        start_time_ns = now_ns();
+        for (uint64_t i = done; i < done + count; ++i) {
+            log(i);
+        }
+        elapsed_ns += now_ns() - start_time_ns;
+    }
+    async_log_flush();
+    g_results.push_back(run_result{name, FLAGS_bench_ops, elapsed_ns});
+}
+
+template<typename Queue>
+void micro_bench::bench_queue(const std::string &name, Queue &queue, uint32_t n) {
+    std::vector<std::thread> threads{};
+    std::atomic_bool start_flag = false;
+    uint64_t start_time_ns;
+
+    threads.reserve(2 * n);
+    for (uint32_t i = 0; i < n; ++i) {
+        // thread i moves its share of the values, the first one takes the remainder
+        uint64_t ops = FLAGS_bench_ops / n + (0 == i ? FLAGS_bench_ops % n : 0);
+        threads.emplace_back([&queue, &start_flag, ops]() {
+            while (!start_flag.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            for (uint64_t value = 0; value < ops; ++value) {
+                queue.emplace_back(uint64_t{value});
+            }
+        });
+        threads.emplace_back([&queue, &start_flag, ops]() {
+            while (!start_flag.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            for (uint64_t count = 0; count < ops; ++count) {
+                queue.pop_front();
+            }
+        });
+    }
+
+    start_time_ns = now_ns();
+    start_flag.store(true, std::memory_order_release);
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    g_results.push_back(run_result{name + " " + std::to_string(n) + "x" + std::to_string(n), FLAGS_bench_ops,
+                                   now_ns() - start_time_ns});
+}
+
+std::vector<std::string> micro_bench::split_list(const std::string &list, char delimiter) {
+    std::vector<std::string> res{};
+    std::stringstream s{list};
+    std::string item;
+
+    while (std::getline(s, item, delimiter)) {
+        if (!item.empty()) {
+            res.push_back(item);
+        }
+    }
+    return res;
+}
+
+uint64_t micro_bench::now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void micro_bench::print_results() {
+    size_t name_width = BENCH_NAME_MIN_WIDTH;
+    for (const auto &result: g_results) {
+        name_width = std::max(name_width, result.name.size() + 2);
+    }
+
+    std::cout << std::left << std::setw(static_cast<int>(name_width)) << "bench" << std::right
+              << std::setw(12) << "ops" << std::setw(12) << "Mops/s" << std::setw(10) << "ns/op" << std::endl;
+    for (const auto &result: g_results) {
+        double elapsed_ns = static_cast<double>(std::max<uint64_t>(result.elapsed_ns, 1));
+        std::cout << std::left << std::setw(static_cast<int>(name_width)) << result.name << std::right
+                  << std::setw(12) << result.ops
+                  << std::setw(12) << std::fixed << std::setprecision(2)
+                  << static_cast<double>(result.ops) * 1000.0 / elapsed_ns
+                  << std::setw(10) << std::setprecision(1) << elapsed_ns / static_cast<double>(result.ops)
+                  << std::endl;
+    }
+}